@@ -78,6 +78,7 @@ is what most commands require. */
 
 int do_action(buffer *b, action a, int64_t c, char *p) {
 	static char msg[MAX_MESSAGE_SIZE];
+	static char *find_any_string;
 	line_desc *next_ld;
 	HIGHLIGHT_STATE next_line_state;
 	int error = OK, recording;
@@ -505,7 +506,7 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 
 			need_attr_update = false;
 			/* Poke the correct state into the next line. */
-			if (b->syn) ((line_desc *)b->cur_line_desc->ld_node.next)->highlight_state = b->next_state;
+			if (b->syn) set_line_state(b, (line_desc *)b->cur_line_desc->ld_node.next, b->next_state);
 
 			if (b->opt.auto_indent) a = auto_indent_line(b, b->cur_line + 1, (line_desc *)b->cur_line_desc->ld_node.next, INT_MAX);
 			move_to_sol(b);
@@ -572,8 +573,9 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 				if (col > 1 && (b->win_x + b->cur_x + col) % b->opt.tab_size == 0) {
 					if (b->syn) {
 						freeze_attributes(b, b->cur_line_desc);
-						memmove(b->attr_buf + b->cur_pos + 1, b->attr_buf + b->cur_pos + col, b->attr_len - (b->cur_pos + col));
-						b->attr_buf[b->cur_pos] = -1;
+						const int64_t i = b->cur_char - b->attr_start;
+						memmove(b->attr_buf + i + 1, b->attr_buf + i + col, (b->attr_len - (i + col)) * sizeof *b->attr_buf);
+						b->attr_buf[i] = -1;
 						b->attr_len -= (col - 1);
 					}
 					delete_stream(b, b->cur_line_desc, b->cur_line, b->cur_pos, col);
@@ -603,7 +605,7 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 			if (b->cur_pos < b->cur_line_desc->line_len) {
 				/* Deletion inside a line. */
 				const int old_char = b->encoding == ENC_UTF8 ? utf8char(&b->cur_line_desc->line[b->cur_pos]) : b->cur_line_desc->line[b->cur_pos];
-				const uint32_t old_attr = b->syn ? b->attr_buf[b->cur_pos] : 0;
+				const uint32_t old_attr = b->syn ? b->attr_buf[b->cur_char - b->attr_start] : 0;
 				delete_one_char(b, b->cur_line_desc, b->cur_line, b->cur_pos);
 
 				update_deleted_char(b, old_char, old_attr, b->cur_line_desc, b->cur_pos, b->cur_char, b->cur_y, b->cur_x);
@@ -613,12 +615,12 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 				/* Here we handle the case in which two lines are joined. Note that if the first line is empty,
 					it is just deleted by delete_one_char(), so we must store its initial state and restore
 					it after the deletion. */
-				if (b->syn && b->cur_pos == 0) next_line_state = b->cur_line_desc->highlight_state;
+				if (b->syn && b->cur_pos == 0) next_line_state = line_state(b, b->cur_line_desc);
 				delete_one_char(b, b->cur_line_desc, b->cur_line, b->cur_pos);
-				if (b->syn && b->cur_pos == 0) b->cur_line_desc->highlight_state = next_line_state;
+				if (b->syn && b->cur_pos == 0) set_line_state(b, b->cur_line_desc, next_line_state);
 
 				if (b->syn) {
-					b->next_state = parse(b->syn, b->cur_line_desc, b->cur_line_desc->highlight_state, b->encoding == ENC_UTF8); 
+					b->next_state = parse_visible(b, b->cur_line_desc);
 					update_line(b, b->cur_y, false, true);
 				}
 				else update_partial_line(b, b->cur_y, b->cur_x, true, false);
@@ -646,7 +648,7 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 					must poke into the next line initial state the correct state. */
 					if (b->syn) {
 						freeze_attributes(b, b->cur_line_desc);
-						((line_desc *)b->cur_line_desc->ld_node.next)->highlight_state = b->next_state;
+						set_line_state(b, (line_desc *)b->cur_line_desc->ld_node.next, b->next_state);
 					}
 
 					assert(b->cur_line_desc->ld_node.next->next != NULL);
@@ -663,7 +665,7 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 					/* We need to avoid updates until we fix the next line. */
 					need_attr_update = false;
 					/* We poke into the next line initial state the correct state. */
-					if (b->syn) ((line_desc *)b->cur_line_desc->ld_node.next)->highlight_state = b->next_state;
+					if (b->syn) set_line_state(b, (line_desc *)b->cur_line_desc->ld_node.next, b->next_state);
 
 					assert(b->cur_line_desc->ld_node.next->next != NULL);
 					if (b->opt.auto_indent) a = auto_indent_line(b, b->cur_line + 1, (line_desc *)b->cur_line_desc->ld_node.next, INT_MAX);
@@ -723,7 +725,7 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 					/* Now the only valid part of the local attribute buffer is before b->cur_pos. 
 						We perform a differential update so that if we undelete in the middle of
 						a line we avoid to rewrite the part up to b->cur_pos. */
-					b->attr_len = b->cur_pos;
+					b->attr_len = max(b->cur_char - b->attr_start, 0);
 					update_line(b, b->cur_y, false, true);
 					next_line_state = b->next_state;
 				}
@@ -732,7 +734,7 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 			if (b->syn) {
 				assert(b->cur_line_desc->ld_node.next->next != NULL);
 				/* For each undeletion, we must poke into the next line its correct initial state. */
-				((line_desc *)b->cur_line_desc->ld_node.next)->highlight_state = next_line_state;
+				set_line_state(b, (line_desc *)b->cur_line_desc->ld_node.next, next_line_state);
 			}
 			/* We actually scroll down the remaining lines, if necessary. */
 			if (b->cur_y < ne_lines - 2) scroll_window(b, b->cur_y + 1, 1);
@@ -825,11 +827,9 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 					change_filename(b, p);
 					b->syn = NULL; /* So that autoprefs will load the right syntax. */
 					if (b->opt.auto_prefs && extension(p)) {
-						if (b->allocated_chars - b->free_chars <= MAX_SYNTAX_SIZE) {
-							load_auto_prefs(b, extension(p));
-							reset_syntax_states(b);
-						}
-						else if (error == OK) error = FILE_TOO_LARGE_SYNTAX_HIGHLIGHTING_DISABLED;
+						load_auto_prefs(b, extension(p));
+						reset_syntax_states(b);
+						if (b->syn && b->window_syntax && error == OK) error = LARGE_FILE_WINDOW_SYNTAX_HIGHLIGHTING;
 					}
 				}
 				print_error(error);
@@ -845,6 +845,16 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		about();
 		return OK;
 
+	case STATS_A:
+		if (p) {
+			error = print_error(save_stats(p));
+			free(p);
+			return error ? ERROR : OK;
+		}
+		stats_message(msg, MAX_MESSAGE_SIZE);
+		print_message(msg);
+		return OK;
+
 	case REFRESH_A:
 		clear_entire_screen();
 		ttysize();
@@ -873,6 +883,61 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		b->last_was_regexp = (a == FINDREGEXP_A);
 		return error ? ERROR : 0;
 
+	case FINDANY_A:
+		if (p || (p = request_string("Find Any (empty for clip)", find_any_string, true, COMPLETE_NONE, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto))) {
+
+			const encoding_type encoding = detect_encoding(p, strlen(p));
+
+			if (encoding != ENC_ASCII && b->encoding != ENC_ASCII && encoding != b->encoding) {
+				free(p);
+				return INCOMPATIBLE_SEARCH_STRING_ENCODING;
+			}
+
+			if (*p) {
+				free(find_any_string);
+				find_any_string = p;
+			}
+			print_error(error = find_any(b, p));
+			if (!*p) free(p);
+		}
+
+		return error ? ERROR : 0;
+
+	case INCREMENTALFIND_A:
+		error = incremental_find(b);
+		if (error == OK && b->recording) record_action(b->cur_macro, FIND_A, -1, b->find_string, verbose_macros);
+		b->last_was_replace = 0;
+		return print_error(error) ? ERROR : OK;
+
+	case FINDALL_A:
+		if (!b->find_string) return NO_SEARCH_STRING;
+		else {
+			const encoding_type search_encoding = detect_encoding(b->find_string, strlen(b->find_string));
+			if (search_encoding != ENC_ASCII && b->encoding != ENC_ASCII && search_encoding != b->encoding) return INCOMPATIBLE_SEARCH_STRING_ENCODING;
+
+			if (print_error(error = build_match_index(b))) return ERROR;
+			if (!b->matches->count) {
+				print_error(NOT_FOUND);
+				return ERROR;
+			}
+
+			snprintf(msg, MAX_MESSAGE_SIZE, "%" PRId64 " match%s found.", b->matches->count, b->matches->count > 1 ? "es" : "");
+			print_message(msg);
+			return OK;
+		}
+
+	case NEXTMATCH_A:
+	case PREVMATCH_A:
+		NORMALIZE(c);
+		for(int64_t i = 0; i < c && !stop; i++)
+			if (print_error(error = goto_match(b, a == NEXTMATCH_A))) return ERROR;
+
+		if (stop) return STOPPED;
+
+		snprintf(msg, MAX_MESSAGE_SIZE, "Match %" PRId64 " of %" PRId64 ".", b->matches->cur + 1, b->matches->count);
+		print_message(msg);
+		return OK;
+
 	case REPLACE_A:
 	case REPLACEONCE_A:
 	case REPLACEALL_A:
@@ -1073,6 +1138,11 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		turbo = c;
 		return OK;
 
+	case FRAMEINTERVAL_A:
+		if (c < 0 && (c = request_number("Frame Interval (ms)", frame_interval))<0) return NUMERIC_ERROR(c);
+		frame_interval = c;
+		return OK;
+
 	case CLIPNUMBER_A:
 		if (c < 0 && (c = request_number("Clip Number", b->opt.cur_clip))<0) return NUMERIC_ERROR(c);
 		b->opt.cur_clip = c;
@@ -1196,6 +1266,10 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		b->find_string_changed = 1;
 		return OK;
 
+	case HIGHLIGHTMATCHES_A:
+		SET_USER_FLAG(b, c, opt.highlight_matches);
+		return OK;
+
 	case SEARCHBACK_A:
 		SET_USER_FLAG(b, c, opt.search_back);
 		b->find_string_changed = 1;
@@ -1573,6 +1647,12 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		}
 		return ERROR;
 
+	case SYNTAXSTATS_A:
+		error = syntax_stats(b, p, msg, MAX_MESSAGE_SIZE);
+		if (error == OK && !p) print_message(msg);
+		free(p);
+		return print_error(error) ? ERROR : OK;
+
 	case ESCAPE_A:
 		handle_menus();
 		return OK;
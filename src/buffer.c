@@ -123,21 +123,27 @@ char_pool *get_char_pool(buffer * const b, char * const p) {
 
 
 
+/* True if the line descriptors of the given buffer contain their initial
+   syntax state. */
+
+#define LINE_STATES(b) (do_syntax && !(b)->window_syntax)
+
 /* These functions allocate and deallocate line descriptor pools. The size of
    the pool is the number of lines, and is forced to be at least
-   STD_LINE_DESC_POOL_SIZE. */
+   STD_LINE_DESC_POOL_SIZE. If states is false, the pool contains
+   no_syntax_line_desc structures. */
 
 
-line_desc_pool *alloc_line_desc_pool(int64_t pool_size) {
+line_desc_pool *alloc_line_desc_pool(int64_t pool_size, const bool states) {
 	if (pool_size < STD_LINE_DESC_POOL_SIZE) pool_size = STD_LINE_DESC_POOL_SIZE;
 
 	line_desc_pool * const ldp = calloc(1, sizeof(line_desc_pool));
 	if (ldp) {
-		if (ldp->pool = calloc(pool_size, do_syntax ? sizeof(line_desc) : sizeof(no_syntax_line_desc))) {
+		if (ldp->pool = calloc(pool_size, states ? sizeof(line_desc) : sizeof(no_syntax_line_desc))) {
 			ldp->size = pool_size;
 			new_list(&ldp->free_list);
 			for(int64_t i = 0; i < pool_size; i++) 
-				if (do_syntax) add_tail(&ldp->free_list, &ldp->pool[i].ld_node);
+				if (states) add_tail(&ldp->free_list, &ldp->pool[i].ld_node);
 				else add_tail(&ldp->free_list, &((no_syntax_line_desc *)ldp->pool)[i].ld_node);
 			return ldp;
 		}
@@ -210,6 +216,7 @@ buffer *alloc_buffer(const buffer * const cur_b) {
 			b->opt.no_file_req    = cur_b->opt.no_file_req;
 
 			b->opt.case_search    = cur_b->opt.case_search;
+			b->opt.highlight_matches = cur_b->opt.highlight_matches;
 			b->opt.binary         = cur_b->opt.binary;
 			b->opt.utf8auto       = cur_b->opt.utf8auto;
 			b->opt.visual_bell    = cur_b->opt.visual_bell;
@@ -234,7 +241,13 @@ void free_buffer_contents(buffer * const b) {
 
 	block_signals();
 
+	invalidate_line_matches(NULL);
+	invalidate_line_brackets(NULL);
+	invalidate_column_index(NULL, 0);
+	invalidate_parse_index(NULL, 0);
 	free_list(&b->line_desc_pool_list, free_line_desc_pool);
+	free_line_states(b);
+	b->window_syntax = false;
 	free_list(&b->char_pool_list, free_char_pool);
 	new_list(&b->line_desc_list);
 	b->cur_line_desc = b->top_line_desc = NULL;
@@ -248,6 +261,8 @@ void free_buffer_contents(buffer * const b) {
 	free_char_stream(b->last_deleted);
 	b->last_deleted = NULL;
 
+	free_match_index(b);
+
 	free(b->filename);
 	b->filename = NULL;
 
@@ -270,7 +285,7 @@ void clear_buffer(buffer * const b) {
 
 	line_desc * const ld = alloc_line_desc(b);
 	add_head(&b->line_desc_list, &ld->ld_node);
-	if (do_syntax) {
+	if (LINE_STATES(b)) {
 		ld->highlight_state.state = 0;
 		ld->highlight_state.stack = NULL;
 		ld->highlight_state.saved_s[0] = 0;
@@ -407,7 +422,7 @@ line_desc *alloc_line_desc(buffer * const b) {
 
 			ld->line = NULL;
 			ld->line_len = 0;
-			if (do_syntax) ld->highlight_state.state = -1;
+			if (LINE_STATES(b)) ld->highlight_state.state = -1;
 			release_signals();
 			return ld;
 		}
@@ -417,12 +432,12 @@ line_desc *alloc_line_desc(buffer * const b) {
 	using the standard pool size, and let's put it at the start
 	of the list, so that it is always scanned first. */
 
-	if (ldp = alloc_line_desc_pool(0)) {
+	if (ldp = alloc_line_desc_pool(0, LINE_STATES(b))) {
 		add_head(&b->line_desc_pool_list, &ldp->ldp_node);
 		line_desc * const ld = (line_desc *)ldp->free_list.head;
 		rem(&ld->ld_node);
 		ldp->allocated_items = 1;
-		if (do_syntax) ld->highlight_state.state = -1;
+		if (LINE_STATES(b)) ld->highlight_state.state = -1;
 		release_signals();
 		return ld;
 	}
@@ -443,13 +458,18 @@ void free_line_desc(buffer * const b, line_desc * const ld) {
 	line_desc_pool *ldp;
 	for(ldp = (line_desc_pool *)b->line_desc_pool_list.head; ldp->ldp_node.next; ldp = (line_desc_pool *)ldp->ldp_node.next) {
 		assert_line_desc_pool(ldp);
-		if (ld >= ldp->pool && (do_syntax && ld < ldp->pool + ldp->size || !do_syntax && ld < (line_desc*)((no_syntax_line_desc *)ldp->pool + ldp->size))) break;
+		if (ld >= ldp->pool && (LINE_STATES(b) && ld < ldp->pool + ldp->size || !LINE_STATES(b) && ld < (line_desc*)((no_syntax_line_desc *)ldp->pool + ldp->size))) break;
 	}
 
 	assert(ldp->ldp_node.next != NULL);
 
 	block_signals();
 
+	invalidate_line_matches(ld);
+	invalidate_line_brackets(ld);
+	invalidate_column_index(ld, 0);
+	invalidate_parse_index(ld, 0);
+	if (b->window_syntax) forget_line_state(b, ld);
 	add_head(&ldp->free_list, &ld->ld_node);
 
 	if (--ldp->allocated_items == 0) {
@@ -706,6 +726,12 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 
 	block_signals();
 
+	invalidate_line_matches(ld);
+	invalidate_line_brackets(ld);
+	invalidate_column_index(ld, pos);
+	if (memchr(stream, 0, stream_len)) invalidate_parse_index(ld, pos);
+	else shift_parse_index(ld, pos, stream_len);
+
 	if (b->opt.do_undo && !(b->undoing || b->redoing)) {
 		const int error = add_undo_step(b, line, pos, -stream_len);
 		if (error) {
@@ -714,6 +740,9 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 		}
 	}
 
+	line_desc * const first_ld = ld;
+	const int64_t first_line = line;
+
 	const char *s = stream;
 	while(s - stream < stream_len) {
 		int64_t const len = strnlen_ne(s, stream_len - (s - stream));
@@ -825,6 +854,8 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 		s += len + 1;
 	}
 
+	update_match_index(b, first_ld, first_line, 1, line - first_line + 1);
+
 	release_signals();
 	return OK;
 }
@@ -886,6 +917,12 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 
 	block_signals();
 
+	invalidate_line_matches(ld);
+	invalidate_line_brackets(ld);
+	invalidate_column_index(ld, pos);
+	if (pos + len > ld->line_len) invalidate_parse_index(ld, pos);
+	else shift_parse_index(ld, pos, -len);
+
 	if (b->opt.do_undo && !(b->undoing || b->redoing)) {
 		const int error = add_undo_step(b, line, pos, len);
 		if (error) {
@@ -894,6 +931,8 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 		}
 	}
 
+	int64_t joined_lines = 0;
+
 	while(len) {
 		/* First case: we are just on the end of a line. We join the current
 		line with the following one (if it's there of course). If, however,
@@ -975,6 +1014,7 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 
 			ld->line_len += next_ld->line_len;
 			b->num_lines--;
+			joined_lines++;
 
 			rem(&next_ld->ld_node);
 			free_line_desc(b, next_ld);
@@ -1040,6 +1080,8 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 
 	if (b->opt.do_undo && !(b->undoing || b->redoing)) fix_last_undo_step(b, -len);
 
+	update_match_index(b, ld, line, joined_lines + 1, 1);
+
 	release_signals();
 	return OK;
 }
@@ -1225,7 +1267,10 @@ int load_fh_in_buffer(buffer *b, int fh) {
 		else b->encoding = ENC_8_BIT;
 	}
 
-	line_desc_pool * const ldp = alloc_line_desc_pool(num_lines + STANDARD_LINE_INCREMENT);
+	/* Syntax states of large files are computed on demand (see line_state()). */
+	b->window_syntax = do_syntax && len > MAX_SYNTAX_SIZE * parse_threads();
+
+	line_desc_pool * const ldp = alloc_line_desc_pool(num_lines + STANDARD_LINE_INCREMENT, LINE_STATES(b));
 	if (ldp) {
 
 		char *p = cp->pool;
@@ -1236,7 +1281,7 @@ int load_fh_in_buffer(buffer *b, int fh) {
 		on the first pass).*/
 
 		for(int64_t i = 0; i < num_lines; i++) {
-			line_desc *ld = do_syntax ? &ldp->pool[i] : (line_desc *)&((no_syntax_line_desc *)ldp->pool)[i];
+			line_desc *ld = LINE_STATES(b) ? &ldp->pool[i] : (line_desc *)&((no_syntax_line_desc *)ldp->pool)[i];
 			rem(&ld->ld_node);
 			add_tail(&b->line_desc_list, &ld->ld_node);
 
@@ -1298,16 +1343,13 @@ int load_fh_in_buffer(buffer *b, int fh) {
 	return OUT_OF_MEMORY;
 }
 
-/* Recomputes initial states for all lines in a buffer. */
+/* Recomputes initial states for all lines in a buffer (in parallel, if the
+   buffer is large: see parse_lines()). In window mode, we just forget the
+   states computed so far. */
 
 void reset_syntax_states(buffer *b) {
-	if (b->syn) {
-		HIGHLIGHT_STATE next_line_state = { 0, 0, "" };
-		for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next; ld = (line_desc *)ld->ld_node.next) {
-			ld->highlight_state = next_line_state;
-			next_line_state = parse(b->syn, ld, next_line_state, b->encoding == ENC_UTF8);
-		}
-	}	
+	if (b->window_syntax) clear_line_states(b);
+	else if (b->syn) parse_lines(b->syn, (line_desc *)b->line_desc_list.head, b->num_lines, b->allocated_chars - b->free_chars, b->encoding == ENC_UTF8);
 }
 
 
@@ -360,6 +360,80 @@ int paste_to_buffer(buffer *b, int n) {
 }
 
 
+/* Records in the current macro of the given buffer the insertion of a stream
+   pasted through the terminal, as InsertString and InsertLine commands. The
+   commands are played with insert mode on and auto-indent and word wrap off
+   (restoring the user preferences afterwards), so that the macro reproduces
+   the paste exactly. Each string is quoted, as otherwise leading spaces or
+   enclosing quotes would be lost when parsing the command line. */
+
+static int record_paste(buffer * const b, const char_stream * const cs) {
+	char * const s = malloc(cs->len + 3);
+	if (!s) return OUT_OF_MEMORY;
+
+	record_action(b->cur_macro, PUSHPREFS_A, -1, NULL, verbose_macros);
+	record_action(b->cur_macro, INSERT_A, 1, NULL, verbose_macros);
+	record_action(b->cur_macro, AUTOINDENT_A, 0, NULL, verbose_macros);
+	record_action(b->cur_macro, WORDWRAP_A, 0, NULL, verbose_macros);
+
+	for(int64_t pos = 0; pos <= cs->len; ) {
+		int64_t len = 0;
+		while(pos + len < cs->len && cs->stream[pos + len]) len++;
+		if (len) {
+			s[0] = '"';
+			memcpy(s + 1, cs->stream + pos, len);
+			strcpy(s + 1 + len, "\"");
+			record_action(b->cur_macro, INSERTSTRING_A, -1, s, verbose_macros);
+		}
+		if ((pos += len + 1) <= cs->len) record_action(b->cur_macro, INSERTLINE_A, -1, NULL, verbose_macros);
+	}
+
+	record_action(b->cur_macro, POPPREFS_A, -1, NULL, verbose_macros);
+	free(s);
+	return OK;
+}
+
+
+/* Inserts at the cursor position a stream pasted through the terminal (see
+   read_paste()) as a single undo step, and moves the cursor after it, as if
+   the stream had been typed, but without auto-indent or word wrap. If a macro
+   is being recorded, the insertion is recorded, too (see record_paste()). */
+
+int paste_stream_to_buffer(buffer *b, const char_stream *cs) {
+	if (b->opt.read_only) return FILE_IS_READ_ONLY;
+	if (!cs->len) return OK;
+	if (cs->encoding != ENC_ASCII && b->encoding != ENC_ASCII && cs->encoding != b->encoding) return INCOMPATIBLE_CLIP_ENCODING;
+
+	line_desc * const ld = b->cur_line_desc, * const end_ld = (line_desc *)b->cur_line_desc->ld_node.next;
+	if (b->encoding == ENC_ASCII) b->encoding = cs->encoding;
+
+	start_undo_chain(b);
+	if (b->cur_pos > ld->line_len)
+		insert_spaces(b, ld, b->cur_line, ld->line_len, b->win_x + b->cur_x - calc_width(ld, ld->line_len, b->opt.tab_size, b->encoding));
+
+	insert_stream(b, ld, b->cur_line, b->cur_pos, cs->stream, cs->len);
+	end_undo_chain(b);
+
+	assert(ld == b->cur_line_desc);
+	update_syntax_and_lines(b, ld, end_ld);
+	update_window_lines(b, b->cur_y, ne_lines - 2, false);
+
+	/* We compute the position following the stream. */
+
+	int64_t new_lines = 0, last = -1;
+	for(int64_t i = 0; i < cs->len; i++)
+		if (!cs->stream[i]) {
+			new_lines++;
+			last = i;
+		}
+
+	const int64_t pos = (new_lines ? 0 : b->cur_pos) + cs->len - (last + 1);
+	goto_line(b, b->cur_line + new_lines);
+	goto_pos(b, pos);
+	return b->recording ? record_paste(b, cs) : OK;
+}
+
+
 
 /* Works like copy_to_clip(), but the region to copy is the rectangle defined
    by the cursor and the marker. Same comments apply. Note that in case of a
@@ -23,6 +23,8 @@
 #include "help.h"
 #include "hash.h"
 
+#include <time.h>
+
 #undef TABSIZE
 
 /* The standard macro descriptor allocation dimension. */
@@ -93,9 +95,12 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(EXIT          ), NO_ARGS                                                               },
 	{ NAHL(FASTGUI       ),                           IS_OPTION                                   },
 	{ NAHL(FIND          ),           ARG_IS_STRING                                               },
+	{ NAHL(FINDALL       ), NO_ARGS                                                               },
+	{ NAHL(FINDANY       ),           ARG_IS_STRING |                             EMPTY_STRING_OK },
 	{ NAHL(FINDREGEXP    ),           ARG_IS_STRING                                               },
 	{ NAHL(FLAGS         ), NO_ARGS |                             DO_NOT_RECORD                   },
 	{ NAHL(FLASH         ), NO_ARGS                                                               },
+	{ NAHL(FRAMEINTERVAL ),                           IS_OPTION                                   },
 	{ NAHL(FREEFORM      ),                           IS_OPTION                                   },
 	{ NAHL(GOTOBOOKMARK  ),           ARG_IS_STRING |                             EMPTY_STRING_OK },
 	{ NAHL(GOTOCOLUMN    ),0                                                                      },
@@ -103,6 +108,8 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(GOTOMARK      ), NO_ARGS                                                               },
 	{ NAHL(HELP          ),           ARG_IS_STRING |             DO_NOT_RECORD                   },
 	{ NAHL(HEXCODE       ),                           IS_OPTION                                   },
+	{ NAHL(HIGHLIGHTMATCHES),                         IS_OPTION                                   },
+	{ NAHL(INCREMENTALFIND), NO_ARGS |                            DO_NOT_RECORD                   },
 	{ NAHL(INSERT        ),                           IS_OPTION                                   },
 	{ NAHL(INSERTCHAR    ),0                                                                      },
 	{ NAHL(INSERTLINE    ),0                                                                      },
@@ -131,6 +138,7 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(MOVETOS       ), NO_ARGS                                                               },
 	{ NAHL(NEWDOC        ), NO_ARGS                                                               },
 	{ NAHL(NEXTDOC       ),0                                                                      },
+	{ NAHL(NEXTMATCH     ),0                                                                      },
 	{ NAHL(NEXTPAGE      ),0                                                                      },
 	{ NAHL(NEXTWORD      ),0                                                                      },
 	{ NAHL(NOFILEREQ     ),                           IS_OPTION                                   },
@@ -148,6 +156,7 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(POPPREFS      ),0                                                                      },
 	{ NAHL(PRESERVECR    ),                           IS_OPTION                                   },
 	{ NAHL(PREVDOC       ),0                                                                      },
+	{ NAHL(PREVMATCH     ),0                                                                      },
 	{ NAHL(PREVPAGE      ),0                                                                      },
 	{ NAHL(PREVWORD      ),0                                                                      },
 	{ NAHL(PUSHPREFS     ),                           IS_OPTION                                   },
@@ -175,9 +184,11 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(SETBOOKMARK   ),           ARG_IS_STRING |                             EMPTY_STRING_OK },
 	{ NAHL(SHIFT         ),           ARG_IS_STRING |                             EMPTY_STRING_OK },
 	{ NAHL(SHIFTTABS     ),                           IS_OPTION                                   },
+	{ NAHL(STATS         ),           ARG_IS_STRING |             DO_NOT_RECORD                   },
 	{ NAHL(STATUSBAR     ),                           IS_OPTION                                   },
 	{ NAHL(SUSPEND       ), NO_ARGS                                                               },
 	{ NAHL(SYNTAX        ),           ARG_IS_STRING | IS_OPTION                                   },
+	{ NAHL(SYNTAXSTATS   ),           ARG_IS_STRING |             DO_NOT_RECORD                   },
 	{ NAHL(SYSTEM        ),           ARG_IS_STRING                                               },
 	{ NAHL(TABS          ),                           IS_OPTION                                   },
 	{ NAHL(TABSIZE       ),                           IS_OPTION                                   },
@@ -519,6 +530,9 @@ int play_macro(buffer *b, char_stream *cs) {
 
 	b->executing_macro = 1;
 	int error = OK;
+#ifdef NE_TEST
+	struct timespec last_status = { 0 }, now;
+#endif
 	while(!stop && p - stream < len) {	
 #ifdef NE_TEST
 		fprintf(stderr, "%s\n", p); /* During tests, we output to stderr the current command. */
@@ -532,7 +546,12 @@ int play_macro(buffer *b, char_stream *cs) {
 
 #ifdef NE_TEST
 		refresh_window(cur_buffer);
-		draw_status_bar();
+		/* The status bar is updated at most every frame_interval milliseconds. */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (frame_interval <= 0 || (now.tv_sec - last_status.tv_sec) * 1000 + (now.tv_nsec - last_status.tv_nsec) / 1000000 >= frame_interval) {
+			draw_status_bar();
+			last_status = now;
+		}
 #endif
 		p += strlen(p) + 1;
 	}
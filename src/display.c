@@ -71,6 +71,336 @@ int highlight_cmp(HIGHLIGHT_STATE *x, HIGHLIGHT_STATE *y) {
 }
 
 
+/* When the highlight_matches flag is set, the occurrences of the find string
+   in the visible lines are displayed in inverse video. For each screen row we
+   cache the matches of the line descriptor it displays; an entry is
+   invalidated when its line descriptor is modified or freed, and entries are
+   moved around when the window is scrolled. An invalid entry keeps its number
+   of matches, which tells us whether there are highlighted characters on the
+   row (in which case the row cannot be updated differentially). Only the
+   visible part of a line is scanned, so an entry is valid just for the
+   visible span [from, to) it has been computed for. */
+
+typedef struct {
+	const line_desc *ld;
+	match_pos *match;
+	int64_t count, size;
+	int64_t from, to;
+	bool valid;
+} row_matches;
+
+static row_matches *row_match;
+static int row_match_rows;
+
+
+/* Invalidates the cached matches of the given line descriptor, or of all rows
+   if ld is NULL. It must be called whenever a line descriptor is modified or
+   freed. */
+
+void invalidate_line_matches(const line_desc * const ld) {
+	for(int i = 0; i < row_match_rows; i++)
+		if (!ld || row_match[i].ld == ld) row_match[i].valid = false;
+}
+
+
+/* Moves the cached matches after a scroll of the window starting at the
+   given row (see scroll_window()). The row that has been blanked gets an
+   empty entry. */
+
+static void scroll_row_matches(const int row, const int n) {
+	const int last = ne_lines - 2;
+	if (row >= row_match_rows || last >= row_match_rows || row >= last) return;
+
+	row_matches blank;
+	if (n > 0) {
+		blank = row_match[last];
+		memmove(row_match + row + 1, row_match + row, (last - row) * sizeof *row_match);
+		row_match[row] = blank;
+		row_match[row].ld = NULL;
+		row_match[row].count = 0;
+		row_match[row].valid = false;
+	}
+	else {
+		blank = row_match[row];
+		memmove(row_match + row, row_match + row + 1, (last - row) * sizeof *row_match);
+		row_match[last] = blank;
+		row_match[last].ld = NULL;
+		row_match[last].count = 0;
+		row_match[last].valid = false;
+	}
+}
+
+
+/* Computes the span of the given line descriptor that is visible in the
+   window: *from is the position of the first character reaching column
+   b->win_x (with character index *chars), and *to the position following
+   the last character before column b->win_x + ne_columns. */
+
+static void visible_span(const buffer * const b, const line_desc * const ld, int64_t * const from, int64_t * const chars, int64_t * const to) {
+	int64_t pos = 0, col = 0, n = 0;
+	if (b->win_x > 0) pos = find_column_checkpoint(ld, b->win_x, b->opt.tab_size, b->encoding, &col, &n);
+
+	for(; pos < ld->line_len && col < b->win_x; pos = next_pos(ld->line, pos, b->encoding), n++) {
+		const int w = ld->line[pos] == '\t' ? b->opt.tab_size - col % b->opt.tab_size : get_char_width(&ld->line[pos], b->encoding);
+		if (col + w > b->win_x) break;
+		col += w;
+	}
+	*from = pos;
+	*chars = n;
+
+	for(; pos < ld->line_len && col < b->win_x + ne_columns; pos = next_pos(ld->line, pos, b->encoding))
+		col += ld->line[pos] == '\t' ? b->opt.tab_size - col % b->opt.tab_size : get_char_width(&ld->line[pos], b->encoding);
+	*to = pos;
+}
+
+
+/* Returns the cached matches of the given row, which displays the given line
+   descriptor, scanning its visible span if necessary, or NULL if matches are
+   not highlighted. *redraw is set to true if the row contains, or used to
+   contain, highlighted matches, in which case it must be redrawn entirely and
+   not differentially. The visible span is stored in *from, *chars and *to
+   (see visible_span()). */
+
+static row_matches *get_row_matches(buffer * const b, const int row, const line_desc * const ld, int64_t * const from, int64_t * const chars, int64_t * const to, bool * const redraw) {
+	*redraw = false;
+	if (!b->opt.highlight_matches || row < 0 || row >= ne_lines - 1) return NULL;
+
+	if (row_match_rows != ne_lines) {
+		/* The screen has been resized: everything will be redrawn. */
+		for(int i = ne_lines; i < row_match_rows; i++) {
+			free(row_match[i].match);
+			row_match[i].match = NULL;
+			row_match[i].size = 0;
+		}
+		row_matches * const new_row_match = realloc(row_match, ne_lines * sizeof *row_match);
+		if (!new_row_match) return NULL;
+		if (ne_lines > row_match_rows) memset(new_row_match + row_match_rows, 0, (ne_lines - row_match_rows) * sizeof *row_match);
+		row_match = new_row_match;
+		row_match_rows = ne_lines;
+	}
+
+	row_matches * const r = &row_match[row];
+	*redraw = r->count != 0;
+
+	visible_span(b, ld, from, chars, to);
+
+	if (!r->valid || r->ld != ld || r->from != *from || r->to != *to) {
+		match_pos *m;
+		const int64_t n = find_line_matches(b, ld, *from, *to, &m);
+
+		if (n > r->size) {
+			match_pos * const new_match = realloc(r->match, n * sizeof *r->match);
+			if (!new_match) return NULL;
+			r->match = new_match;
+			r->size = n;
+		}
+		memcpy(r->match, m, n * sizeof *m);
+		r->count = n;
+		r->ld = ld;
+		r->from = *from;
+		r->to = *to;
+		r->valid = true;
+	}
+
+	if (r->count != 0) *redraw = true;
+	return r;
+}
+
+
+/* Returns the attributes that must be used to display the given line
+   descriptor on the given row: if there are matches of the find string in the
+   line, they are merged with attr (which may be NULL); otherwise, attr is
+   returned. *start contains the character index of the first entry of attr,
+   and it is set to that of the returned array. *redraw is set as in
+   get_row_matches(). The returned array is static. */
+
+static const uint32_t *highlight_matches(buffer * const b, const int row, const line_desc * const ld, const uint32_t * const attr, int64_t * const start, bool * const redraw) {
+	static uint32_t *hl_attr;
+	static int64_t hl_attr_size;
+
+	int64_t from, chars, to;
+	const row_matches * const r = get_row_matches(b, row, ld, &from, &chars, &to, redraw);
+	if (!r || r->count == 0) return attr;
+
+	/* We cover the same characters as attr (see parse()), or the visible
+		span. A span has at most as many characters as bytes. */
+	const int64_t start_pos = attr ? attr_start_pos : from, len = attr ? attr_len : to - from;
+	if (len + 1 > hl_attr_size) {
+		uint32_t * const new_hl_attr = realloc(hl_attr, (len + 1) * sizeof *hl_attr);
+		if (!new_hl_attr) return attr;
+		hl_attr = new_hl_attr;
+		hl_attr_size = len + 1;
+	}
+
+	for(int64_t pos = start_pos, attr_pos = 0, i = 0; pos < ld->line_len && attr_pos < len; pos = next_pos(ld->line, pos, b->encoding), attr_pos++) {
+		while(i < r->count && r->match[i].pos + r->match[i].len <= pos) i++;
+		hl_attr[attr_pos] = attr ? attr[attr_pos] : 0;
+		if (i < r->count && r->match[i].pos <= pos) hl_attr[attr_pos] ^= INVERSE;
+	}
+
+	if (!attr) *start = chars;
+	return hl_attr;
+}
+
+
+
+/* In window mode (see MAX_SYNTAX_SIZE) line descriptors do not contain their
+   initial syntax state. The states of the lines displayed recently are kept
+   instead in a per-buffer hash table with linear probing indexed by line
+   descriptor, which is emptied when it gets too full. The state of a line
+   that is not in the table is computed parsing from the nearest line above it
+   that is in the table, going back at most WINDOW_SYNTAX_LINES lines or
+   WINDOW_SYNTAX_SIZE characters; if there is no such line, we start from the
+   idle state, and the state is just a guess. Guesses are refined as earlier
+   lines are displayed, as refresh_window() recomputes the states of the
+   visible lines starting from the first one. */
+
+#define STATE_CACHE_BITS 16
+#define STATE_CACHE_SIZE (1 << STATE_CACHE_BITS)
+
+struct line_state_cache {
+	int count;
+	struct {
+		const line_desc *ld;
+		HIGHLIGHT_STATE state;
+	} entry[STATE_CACHE_SIZE];
+};
+
+static int state_cache_slot(const line_desc * const ld) {
+	return (uint64_t)(uintptr_t)ld * 0x9E3779B97F4A7C15ULL >> (64 - STATE_CACHE_BITS);
+}
+
+/* Returns the cached state of a line descriptor, or NULL. */
+
+HIGHLIGHT_STATE *cached_line_state(const buffer * const b, const line_desc * const ld) {
+	struct line_state_cache * const c = b->state_cache;
+	if (!c) return NULL;
+	for(int i = state_cache_slot(ld); c->entry[i].ld; i = (i + 1) & (STATE_CACHE_SIZE - 1))
+		if (c->entry[i].ld == ld) return &c->entry[i].state;
+	return NULL;
+}
+
+/* Sets the initial syntax state of a line descriptor. */
+
+void set_line_state(buffer * const b, line_desc * const ld, const HIGHLIGHT_STATE state) {
+	if (!b->window_syntax) {
+		ld->highlight_state = state;
+		return;
+	}
+
+	HIGHLIGHT_STATE * const s = cached_line_state(b, ld);
+	if (s) {
+		*s = state;
+		return;
+	}
+
+	if (!b->state_cache && !(b->state_cache = calloc(1, sizeof *b->state_cache))) return;
+	struct line_state_cache * const c = b->state_cache;
+	if (c->count >= STATE_CACHE_SIZE / 4 * 3) clear_line_states(b);
+
+	int i;
+	for(i = state_cache_slot(ld); c->entry[i].ld; i = (i + 1) & (STATE_CACHE_SIZE - 1));
+	c->entry[i].ld = ld;
+	c->entry[i].state = state;
+	c->count++;
+}
+
+/* Returns the initial syntax state of a line descriptor, computing it in window mode if necessary. */
+
+HIGHLIGHT_STATE line_state(buffer * const b, line_desc * const ld) {
+	if (!b->window_syntax) return ld->highlight_state;
+
+	const HIGHLIGHT_STATE * const s = cached_line_state(b, ld);
+	if (s) return *s;
+
+	static const HIGHLIGHT_STATE idle;
+	HIGHLIGHT_STATE state = idle;
+	line_desc *start = ld;
+	int64_t size = 0;
+	for(int n = 0; start->ld_node.prev->prev && n < WINDOW_SYNTAX_LINES && size < WINDOW_SYNTAX_SIZE; n++) {
+		start = (line_desc *)start->ld_node.prev;
+		const HIGHLIGHT_STATE * const start_state = cached_line_state(b, start);
+		if (start_state) {
+			state = *start_state;
+			break;
+		}
+		size += start->line_len;
+	}
+
+	set_line_state(b, start, state);
+	while(start != ld) {
+		state = parse_line(b->syn, start, state, b->encoding == ENC_UTF8);
+		start = (line_desc *)start->ld_node.next;
+		set_line_state(b, start, state);
+	}
+	return state;
+}
+
+/* Removes a line descriptor from the cache. It must be called when a line descriptor is freed. */
+
+void forget_line_state(buffer * const b, const line_desc * const ld) {
+	struct line_state_cache * const c = b->state_cache;
+	if (!c) return;
+
+	int i = state_cache_slot(ld);
+	while(c->entry[i].ld != ld) {
+		if (!c->entry[i].ld) return;
+		i = (i + 1) & (STATE_CACHE_SIZE - 1);
+	}
+
+	/* We move back the following entries that would not be found anymore. */
+	for(int j = (i + 1) & (STATE_CACHE_SIZE - 1); c->entry[j].ld; j = (j + 1) & (STATE_CACHE_SIZE - 1)) {
+		const int k = state_cache_slot(c->entry[j].ld);
+		if (i <= j ? i < k && k <= j : i < k || k <= j) continue;
+		c->entry[i] = c->entry[j];
+		i = j;
+	}
+	c->entry[i].ld = NULL;
+	c->count--;
+}
+
+/* Empties the cache (when the syntax or the encoding change, or when the cache is full). */
+
+void clear_line_states(buffer * const b) {
+	if (!b->state_cache) return;
+	memset(b->state_cache, 0, sizeof *b->state_cache);
+}
+
+/* Frees the cache of a buffer, if any. */
+
+void free_line_states(buffer * const b) {
+	free(b->state_cache);
+	b->state_cache = NULL;
+}
+
+/* Recomputes in window mode the initial states of the visible lines, starting
+   from the first one, and schedules an update of the lines whose state changed.
+   Changes are propagated below the window through the lines in the cache. */
+
+static void refine_window_states(buffer * const b) {
+	line_desc *ld = b->top_line_desc;
+	for(int row = 1; ld->ld_node.next->next; row++) {
+		const bool visible = row < ne_lines - 1;
+		/* A visible line that is not in the cache might have been displayed before the cache was emptied. */
+		const HIGHLIGHT_STATE * const s = cached_line_state(b, (line_desc *)ld->ld_node.next);
+		if (!visible && !s) break;
+		HIGHLIGHT_STATE old_state = s ? *s : (HIGHLIGHT_STATE){ .state = -1 };
+		HIGHLIGHT_STATE next_state = visible ? parse_visible(b, ld) : parse_line(b->syn, ld, line_state(b, ld), b->encoding == ENC_UTF8);
+		ld = (line_desc *)ld->ld_node.next;
+		if (highlight_cmp(&old_state, &next_state)) {
+			if (visible) continue;
+			break;
+		}
+		set_line_state(b, ld, next_state);
+		if (visible) {
+			if (ld == b->cur_line_desc) b->attr_len = -1;
+			window_needs_refresh = true;
+			if (row < first_line) first_line = row;
+			if (row > last_line) last_line = row;
+		}
+	}
+}
+
 
 /* Updates the initial syntax state of line descriptors starting from a given line descriptor.
 If row is nonnegative, we assume that we have also to update differentially the given lines.
@@ -92,9 +422,9 @@ void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld)
 	if (b->syn && need_attr_update) {
  		bool got_end_ld = end_ld == NULL;
 		bool invalidate_attr_buf = false;
-		HIGHLIGHT_STATE next_line_state = b->attr_len < 0 ? parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8) : b->next_state;
+		HIGHLIGHT_STATE next_line_state = b->attr_len < 0 ? parse_visible(b, ld) : b->next_state;
 
-		assert(b->attr_len < 0 || b->attr_len == calc_char_len(ld, b->encoding));
+		assert(b->attr_len < 0 || b->attr_start + b->attr_len <= calc_char_len(ld, b->encoding));
 
 		/* We update lines until the currenct starting state is equal to next_line_state, but we go until
 			end_ld if it is not NULL. In any case, we bail out at the end of the file. */
@@ -103,7 +433,11 @@ void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld)
 			/* We move one row down. */
 			ld = (line_desc *) ld->ld_node.next;
 
-			if ((highlight_cmp(&ld->highlight_state, &next_line_state) && got_end_ld) || !ld->ld_node.next) break;
+			if (!ld->ld_node.next) break;
+			if (got_end_ld) {
+				HIGHLIGHT_STATE state = line_state(b, ld);
+				if (highlight_cmp(&state, &next_line_state)) break;
+			}
 			if (ld == end_ld) got_end_ld = true;
 
 			if (row >= 0) {
@@ -121,11 +455,15 @@ void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld)
 				}
 			}
 
-			ld->highlight_state = next_line_state;
-			next_line_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
+			set_line_state(b, ld, next_line_state);
+			next_line_state = parse_visible(b, ld);
 
-			if (row >= 0 && row < ne_lines - 1 && ! window_needs_refresh)
-				output_line_desc(row, 0, ld, b->win_x, ne_columns, b->opt.tab_size, true, b->encoding == ENC_UTF8, attr_buf, b->attr_buf, b->attr_len);
+			if (row >= 0 && row < ne_lines - 1 && ! window_needs_refresh) {
+				bool redraw;
+				int64_t start = attr_start;
+				const uint32_t * const attr = highlight_matches(b, row, ld, attr_buf, &start, &redraw);
+				output_line_desc(row, 0, ld, b->win_x, ne_columns, b->opt.tab_size, true, b->encoding == ENC_UTF8, attr, start, redraw || b->attr_start != attr_start ? NULL : b->attr_buf, b->attr_len);
+			}
 		}
 
 		if (invalidate_attr_buf) b->attr_len = -1;
@@ -146,12 +484,14 @@ void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld)
    then the line content is considered to be UTF-8 encoded.
 
    If attr is not NULL, it contains a the list of attributes for the line
-   descriptor; if diff is not NULL, the update is differential: we assume
-   that the line is already correctly displayed with the attributes
-   specified in diff. If diff_size is shorter than the current line, all
+   descriptor, starting from the character of index attr_start (at least
+   all output characters must be covered); if diff is not NULL, the update
+   is differential: we assume that the line is already correctly displayed
+   with the attributes specified in diff, which starts from the same
+   character. If diff_size is shorter than the current line, all
    characters without differential information will be updated. */
 
-void output_line_desc(const int row, const int col, line_desc *ld, const int64_t from_col, const int64_t num_cols, const int tab_size, const bool cleared_at_end, const bool utf8, const uint32_t * const attr, const uint32_t * const diff, const int64_t diff_size) {
+void output_line_desc(const int row, const int col, line_desc *ld, const int64_t from_col, const int64_t num_cols, const int tab_size, const bool cleared_at_end, const bool utf8, const uint32_t * const attr, const int64_t attr_start, const uint32_t * const diff, const int64_t diff_size) {
 	assert(ld != NULL);
 	assert(row < ne_lines - 1 && col < ne_columns);
 
@@ -159,10 +499,12 @@ void output_line_desc(const int row, const int col, line_desc *ld, const int64_t
 		current column (considering TABs) and in pos the current position in
 		the line (considering UTF-8 sequences, if necessary). s is always
 		ld->line + pos. The actual output screen column at any time is
-		col + curr_col - from_col. */
+		col + curr_col - from_col. On long lines, we start from a checkpoint
+		of the column index not after from_col, rather than from the start. */
 
-	const char *s = ld->line;
 	int64_t curr_col = 0, pos = 0, attr_pos = 0;
+	if (from_col > 0) pos = find_column_checkpoint(ld, from_col, tab_size, utf8 ? ENC_UTF8 : ENC_8_BIT, &curr_col, &attr_pos);
+	const char *s = ld->line + pos;
 
 	while(curr_col - from_col < num_cols && pos < ld->line_len) {
 		const int64_t output_col = col + curr_col - from_col;
@@ -173,13 +515,15 @@ void output_line_desc(const int row, const int col, line_desc *ld, const int64_t
 
 		if (*s == '\t') {
 			const int tab_width = tab_size - curr_col % tab_size;
-			int i;
-
-			for(i = 0; i < tab_width; i++)
-				if (curr_col + i >= from_col && curr_col + i < from_col + num_cols) {
-					move_cursor(row, output_col + i);
-					output_char(' ', attr ? attr[attr_pos] : 0, false);
-				}
+			const int64_t first = curr_col > from_col ? curr_col : from_col;
+			const int64_t last = curr_col + tab_width < from_col + num_cols ? curr_col + tab_width : from_col + num_cols;
+
+			/* The visible part of a TAB is output as a single run of spaces. */
+			if (first < last) {
+				const uint32_t a = attr ? attr[attr_pos - attr_start] : 0;
+				move_cursor(row, col + first - from_col);
+				output_spaces(last - first, &a);
+			}
 
 			curr_col += tab_width;
 		}
@@ -187,13 +531,27 @@ void output_line_desc(const int row, const int col, line_desc *ld, const int64_t
 			const int c_width = output_width(c);
 
 			if (output_col >= col || output_col + c_width > col && output_col >= 0) {
-				if (output_col + c_width <= ne_columns) {
+				if (output_col + c_width <= ne_columns && output_col >= col && c > 0 && c < 0x80 && !diff && s[1] == c && pos + 1 < ld->line_len) {
+					/* Runs of identical ASCII characters are output at once, so
+						that the terminal can repeat or erase them. */
+					int64_t n = 1;
+					while(pos + n < ld->line_len && s[n] == c && output_col + n < ne_columns && curr_col + n - from_col < num_cols
+						&& (!attr || attr[attr_pos - attr_start + n] == attr[attr_pos - attr_start])) n++;
+					move_cursor(row, output_col);
+					if (!attr) set_attr(0);
+					output_chars(s, attr ? &attr[attr_pos - attr_start] : NULL, n, false);
+					s += n - 1;
+					pos += n - 1;
+					curr_col += n - 1;
+					attr_pos += n - 1;
+				}
+				else if (output_col + c_width <= ne_columns) {
 					if (attr) {
 						/* In the case of a differential update, we output only
 							characters whose attributes have changed. */
-						if (!diff || diff && (attr_pos >= diff_size || diff[attr_pos] != attr[attr_pos])) {
+						if (!diff || diff && (attr_pos - attr_start >= diff_size || diff[attr_pos - attr_start] != attr[attr_pos - attr_start])) {
 							move_cursor(row, output_col);
-							output_char(c, attr[attr_pos], utf8);
+							output_char(c, attr[attr_pos - attr_start], utf8);
 						}
 					}
 					else {
@@ -205,7 +563,7 @@ void output_line_desc(const int row, const int col, line_desc *ld, const int64_t
 					/* The current character is too wide: we can only output spaces
 						in place of its visible part. */
 					move_cursor(row, output_col);
-					output_spaces(ne_columns - output_col, attr ? &attr[attr_pos] : NULL);
+					output_spaces(ne_columns - output_col, attr ? &attr[attr_pos - attr_start] : NULL);
 				}
 			}
 			curr_col += c_width;
@@ -241,7 +599,7 @@ void output_line_desc(const int row, const int col, line_desc *ld, const int64_t
    Returns the line descriptor corresponding to row, or NULL if the
    row is beyond the end of text. */
 
-line_desc *update_partial_line(buffer * const b, const int row, const int64_t from_col, const bool cleared_at_end, const bool differential) {
+line_desc *update_partial_line(buffer * const b, const int row, int64_t from_col, const bool cleared_at_end, bool differential) {
 	assert(row < ne_lines - 1); 
 
 	if (++updated_lines > TURBO) window_needs_refresh = true;
@@ -261,12 +619,21 @@ line_desc *update_partial_line(buffer * const b, const int row, const int64_t fr
 		clear_to_eol();
 		return NULL;
 	}
-	else if (b->syn) parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
+	else if (b->syn) parse_visible(b, ld);
 
 	if (! window_needs_refresh) {
 		assert(b->syn || ! differential);
 		assert(b->attr_len >= 0 || ! differential);
-		output_line_desc(row, from_col, ld, from_col + b->win_x, ne_columns - from_col, b->opt.tab_size, cleared_at_end, b->encoding == ENC_UTF8, b->syn ? attr_buf : NULL, differential ? b->attr_buf : NULL, differential ? b->attr_len : 0);
+		bool redraw;
+		int64_t start = b->syn ? attr_start : 0;
+		const uint32_t * const attr = highlight_matches(b, row, ld, b->syn ? attr_buf : NULL, &start, &redraw);
+		if (redraw) {
+			/* Matches might have appeared or disappeared anywhere on the line. */
+			from_col = 0;
+			differential = false;
+		}
+		if (differential && b->attr_start != attr_start) differential = false;
+		output_line_desc(row, from_col, ld, from_col + b->win_x, ne_columns - from_col, b->opt.tab_size, cleared_at_end, b->encoding == ENC_UTF8, attr, start, differential ? b->attr_buf : NULL, differential ? b->attr_len : 0);
 	}
 	return ld;
 }
@@ -280,9 +647,10 @@ void update_line(buffer * const b, const int n, const bool cleared_at_end, const
 	line_desc * const ld = update_partial_line(b, n, 0, cleared_at_end, differential);
 	if (b->syn && ld == b->cur_line_desc) {
 		/* If we updated the entire current line, we update the local attribute buffer. */
-		b->next_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);	
+		b->next_state = parse_visible(b, ld);
 		ensure_attr_buf(b, attr_len);	
 		memcpy(b->attr_buf, attr_buf, (b->attr_len = attr_len) * sizeof *b->attr_buf);
+		b->attr_start = attr_start;
 	}
 }
 
@@ -311,8 +679,11 @@ void update_window_lines(buffer * const b, const int start_line, const int end_l
 		assert(ld->ld_node.next != NULL);
 
 		if (i >= first_line) {
-			if (b->syn) parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
-			output_line_desc(i, 0, ld, b->win_x, ne_columns, b->opt.tab_size, false, b->encoding == ENC_UTF8, b->syn ? attr_buf : NULL, NULL, 0);
+			bool redraw;
+			if (b->syn) parse_visible(b, ld);
+			int64_t start = b->syn ? attr_start : 0;
+			const uint32_t * const attr = highlight_matches(b, i, ld, b->syn ? attr_buf : NULL, &start, &redraw);
+			output_line_desc(i, 0, ld, b->win_x, ne_columns, b->opt.tab_size, false, b->encoding == ENC_UTF8, attr, start, NULL, 0);
 		}
 		ld = (line_desc *)ld->ld_node.next;
 	}
@@ -332,6 +703,9 @@ void update_window_lines(buffer * const b, const int start_line, const int end_l
    an update. */
 
 void update_window(buffer * const b) {
+	/* The window might have been shifted horizontally, and on long lines
+	   the frozen attributes cover just the previously visible part. */
+	b->attr_len = -1;
 	update_window_lines(b, 0, ne_lines - 2, false);
 }
 
@@ -366,11 +740,29 @@ void update_syntax_and_lines(buffer *b, line_desc *start_ld, line_desc *end_ld)
    optimized (such as writing a space at the end of a line). TURBO is
    taken into consideration. */
 
+/* If the given row contains, or used to contain, highlighted matches, redraws
+   it entirely and returns true. This is used by the single-character update
+   functions, which could otherwise leave stale highlighting on the screen. */
+
+static bool must_redraw_matches(buffer * const b, const int line, const line_desc * const ld) {
+	int64_t from, chars, to;
+	bool redraw;
+	get_row_matches(b, line, ld, &from, &chars, &to, &redraw);
+	if (redraw) update_line(b, line, false, false);
+	return redraw;
+}
+
 void update_deleted_char(buffer * const b, const int c, const int a, const line_desc * const ld, int64_t pos, int64_t attr_pos, const int line, const int x) {
 	if (b->syn) {
 		assert(b->attr_len >= 0);
-		assert(b->attr_len - 1 == calc_char_len(ld, b->encoding));
-		memmove(b->attr_buf + attr_pos, b->attr_buf + attr_pos + 1, (--b->attr_len - attr_pos) * sizeof *b->attr_buf);
+		assert(b->attr_start + b->attr_len - 1 <= calc_char_len(ld, b->encoding));
+		assert(attr_pos >= b->attr_start && attr_pos < b->attr_start + b->attr_len);
+		memmove(b->attr_buf + attr_pos - b->attr_start, b->attr_buf + attr_pos - b->attr_start + 1, (--b->attr_len - (attr_pos - b->attr_start)) * sizeof *b->attr_buf);
+		if (attr_pos - b->attr_start + ne_columns > b->attr_len && b->attr_start + b->attr_len < ld->line_len) {
+			/* The frozen attributes of a long line might no longer cover the visible part. */
+			update_line(b, line, false, false);
+			return;
+		}
 	}
 
 	if (++updated_lines > TURBO) window_needs_refresh = true;
@@ -381,6 +773,8 @@ void update_deleted_char(buffer * const b, const int c, const int a, const line_
 		return;
 	}
 
+	if (must_redraw_matches(b, line, ld)) return;
+
 	if (pos > ld->line_len || (pos == ld->line_len && ((c == '\t' || c == ' ') && !a))) return;
 
 	move_cursor(line, x);
@@ -423,8 +817,8 @@ void update_deleted_char(buffer * const b, const int c, const int a, const line_
 				/* In this case, instead, we just shift the piece of text between
 					our current position and the TAB. Note that this is slower than
 					inserting and deleting, but MUCH nicer to see. */
-				output_chars(&ld->line[pos], b->syn ? &b->attr_buf[attr_pos] : NULL, j - pos, b->encoding == ENC_UTF8);
-				output_spaces(c_width, b->syn ? &b->attr_buf[curr_attr_pos] : NULL);
+				output_chars(&ld->line[pos], b->syn ? &b->attr_buf[attr_pos - b->attr_start] : NULL, j - pos, b->encoding == ENC_UTF8);
+				output_spaces(c_width, b->syn ? &b->attr_buf[curr_attr_pos - b->attr_start] : NULL);
 			}
 			tab_found = true;
 			break;
@@ -445,16 +839,22 @@ void update_deleted_char(buffer * const b, const int c, const int a, const line_
 void update_inserted_char(buffer * const b, const int c, const line_desc * const ld, const int64_t pos, const int64_t attr_pos, const int line, const int x) {
 	assert(pos < ld->line_len);
 
-	const uint32_t * const attr = b->syn ? &attr_buf[attr_pos] : NULL;
+	uint32_t new_attr;
+	const uint32_t * const attr = b->syn ? &new_attr : NULL;
 
 	if (b->syn) {
+		const int64_t i = attr_pos - b->attr_start;
 		assert(b->attr_len >= 0);
 		/*fprintf(stderr, "+b->attr_len: %d calc_char_len: %d pos: %d ld->line_len %d attr_pos: %d\n", b->attr_len,calc_char_len(ld, b->encoding), pos, ld->line_len, attr_pos);*/
-		assert(b->attr_len + 1 == calc_char_len(ld, b->encoding));
+		assert(b->attr_start + b->attr_len + 1 <= calc_char_len(ld, b->encoding));
+		assert(i >= 0 && i <= b->attr_len);
+		/* The new character temporarily gets the attributes of the character it
+			pushes forward (or of the previous one, at the end of the line). */
+		new_attr = i < b->attr_len ? b->attr_buf[i] : i > 0 ? b->attr_buf[i - 1] : 0;
 		/* We update the stored attribute vector. */
 		ensure_attr_buf(b, b->attr_len + 1);	
-		memmove(b->attr_buf + attr_pos + 1, b->attr_buf + attr_pos, (b->attr_len++ - attr_pos) * sizeof *b->attr_buf );
-		b->attr_buf[attr_pos] = *attr;
+		memmove(b->attr_buf + i + 1, b->attr_buf + i, (b->attr_len++ - i) * sizeof *b->attr_buf );
+		b->attr_buf[i] = new_attr;
 	}
 
 	if (++updated_lines > TURBO) window_needs_refresh = true;
@@ -465,6 +865,8 @@ void update_inserted_char(buffer * const b, const int c, const line_desc * const
 		return;
 	}
 
+	if (must_redraw_matches(b, line, ld)) return;
+
 	move_cursor(line, x);
 
 	const int c_len = b->encoding == ENC_UTF8 ? utf8seqlen(c) : 1;
@@ -517,14 +919,18 @@ void update_overwritten_char(buffer * const b, const int old_char, const int new
 	assert(ld != NULL);
 	assert(pos < ld->line_len);
 
-	const uint32_t * const attr = b->syn ? &attr_buf[attr_pos] : NULL;
+	uint32_t new_attr;
+	const uint32_t * const attr = b->syn ? &new_attr : NULL;
 
 	if (b->syn) {
+		const int64_t i = attr_pos - b->attr_start;
 		/* fprintf(stderr, "-b->attr_len: %d calc_char_len: %d pos: %d ld->line_len %d attr_pos: %d\n", b->attr_len,calc_char_len(ld, b->encoding), pos, ld->line_len, attr_pos);*/
-		assert(b->attr_len + 1 == calc_char_len(ld, b->encoding) || b->attr_len == calc_char_len(ld, b->encoding));
-		assert(attr_pos <= b->attr_len);
-		if (attr_pos == b->attr_len) ensure_attr_buf(b, ++b->attr_len);
-		b->attr_buf[attr_pos] = *attr;
+		assert(b->attr_start + b->attr_len <= calc_char_len(ld, b->encoding));
+		assert(i >= 0 && i <= b->attr_len);
+		/* As in update_inserted_char(). */
+		new_attr = i < b->attr_len ? b->attr_buf[i] : i > 0 ? b->attr_buf[i - 1] : 0;
+		if (i == b->attr_len) ensure_attr_buf(b, ++b->attr_len);
+		b->attr_buf[i] = new_attr;
 	}
 
 	if (++updated_lines > TURBO) window_needs_refresh = true;
@@ -535,6 +941,8 @@ void update_overwritten_char(buffer * const b, const int old_char, const int new
 		return;
 	}
 
+	if (must_redraw_matches(b, line, ld)) return;
+
 	const int old_width = old_char == '\t' ? b->opt.tab_size - x % b->opt.tab_size : output_width(old_char);
 	const int new_width = new_char == '\t' ? b->opt.tab_size - x % b->opt.tab_size : output_width(new_char);
 
@@ -579,7 +987,7 @@ void update_overwritten_char(buffer * const b, const int old_char, const int new
 					if (new_char == '\t') output_spaces(new_width, attr);
 					else output_char(new_char, attr ? *attr : -1, b->encoding == ENC_UTF8);
 					output_chars(&ld->line[pos], attr, j - pos, b->encoding == ENC_UTF8);
-					output_spaces(width_delta, b->syn ? &b->attr_buf[curr_attr_pos] : NULL);
+					output_spaces(width_delta, b->syn ? &b->attr_buf[curr_attr_pos - b->attr_start] : NULL);
 				}
 				else {
 					if (new_char == '\t') output_spaces(new_width, attr);
@@ -664,6 +1072,17 @@ void reset_window(void) {
    interact, so that he is presented with a correctly updated display. */
 
 void refresh_window(buffer * const b) {
+	if (set_highlight_pattern(b)) {
+		/* The highlighted matches on the screen are no longer correct. */
+		for(int i = 0; i < row_match_rows; i++) {
+			row_match[i].valid = false;
+			row_match[i].count = 0;
+		}
+		window_needs_refresh = true;
+		first_line = 0;
+		last_line = ne_lines - 2;
+	}
+	if (b->syn && b->window_syntax) refine_window_states(b);
 	if (window_needs_refresh) update_window_lines(b, first_line, last_line, true);
 	updated_lines = 0;
 }
@@ -694,6 +1113,7 @@ void scroll_window(buffer * const b, const int line, const int n) {
 		return;
 	}
 
+	scroll_row_matches(line, n);
 	if (n > 0) update_line(b, line, ins_del_lines(line, 1), false);
 	else update_line(b, ne_lines - 2, ins_del_lines(line, -1), false);
 }
@@ -706,12 +1126,222 @@ from the current line, you must take care of invalidating the attribute
 buffer afterwards (b->attr_len = -1). */
 
 HIGHLIGHT_STATE freeze_attributes(buffer *b, line_desc *ld) {
-	b->next_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);	
+	b->next_state = parse_visible(b, ld);
 	ensure_attr_buf(b, attr_len);	
 	memcpy(b->attr_buf, attr_buf, (b->attr_len = attr_len) * sizeof *b->attr_buf);
+	b->attr_start = attr_start;
 	return b->next_state;
 }
 
+
+/* Parses a line descriptor of the given buffer, asking for the attributes of
+   the characters that can be visible in the window (see parse()). Returns the
+   state at the end of the line. */
+
+HIGHLIGHT_STATE parse_visible(buffer * const b, line_desc * const ld) {
+	int64_t first = 0;
+	if (b->win_x > 0) first = calc_char_index(ld, calc_pos(ld, b->win_x, b->opt.tab_size, b->encoding), b->opt.tab_size, b->encoding);
+	HIGHLIGHT_STATE next_state = parse(b->syn, ld, line_state(b, ld), b->encoding == ENC_UTF8, first, first + ne_columns);
+
+	/* In window mode, we save a parse when the next line is displayed. */
+	line_desc * const next_ld = (line_desc *)ld->ld_node.next;
+	if (b->window_syntax && next_ld->ld_node.next && !cached_line_state(b, next_ld)) set_line_state(b, next_ld, next_state);
+	return next_state;
+}
+
+/* When the automatch flag is set, the bracket matching the one under the
+   cursor is searched for among the visible lines at each iteration of the
+   main loop. For each screen row we cache the brackets of the line
+   descriptor it displays, together with their syntax attributes, so that
+   cursor movements just scan the cached brackets. Entries are invalidated
+   like those of row_match, or when the initial syntax state of their line
+   changes; after a scroll, entries are recovered from the rows that used to
+   display the same line descriptors. Brackets match only brackets with the
+   same attributes, so brackets in strings or comments do not match brackets
+   in code. On long lines the attributes are known only around the visible
+   part (see parse()); brackets outside it match any bracket. */
+
+typedef struct {
+	int64_t pos;          /* The position of the bracket in the line. */
+	uint32_t attr;        /* Its attribute, if known_attr is true. */
+	signed char kind;     /* See bracket_kind(). */
+	bool known_attr;
+} bracket_pos;
+
+typedef struct {
+	const line_desc *ld;
+	HIGHLIGHT_STATE state;             /* The initial state of ld when the entry was computed. */
+	const struct high_syntax *syn;
+	encoding_type encoding;
+	int64_t win_x;                     /* The value of win_x when the entry was computed, if partial_attr is true. */
+	bracket_pos *bracket;
+	int64_t count, size;
+	bool partial_attr, valid;
+} row_brackets;
+
+static row_brackets *row_bracket;
+static int row_bracket_rows;
+
+
+/* Invalidates the cached brackets of the given line descriptor, or of all
+   rows if ld is NULL. It must be called whenever a line descriptor is modified
+   or freed. */
+
+void invalidate_line_brackets(const line_desc * const ld) {
+	for(int i = 0; i < row_bracket_rows; i++)
+		if (!ld || row_bracket[i].ld == ld) row_bracket[i].valid = false;
+}
+
+
+/* Adds a bracket to a row entry. Returns false if we ran out of memory. */
+
+static bool add_bracket(row_brackets * const r, const int64_t pos, const int kind, const uint32_t attr, const bool known_attr) {
+	if (r->count == r->size) {
+		const int64_t size = r->size ? r->size * 2 : 16;
+		bracket_pos * const new_bracket = realloc(r->bracket, size * sizeof *r->bracket);
+		if (!new_bracket) return false;
+		r->bracket = new_bracket;
+		r->size = size;
+	}
+	r->bracket[r->count++] = (bracket_pos){ pos, attr, kind, known_attr };
+	return true;
+}
+
+
+/* Recomputes the brackets of a row entry. Returns false if we ran out of memory. */
+
+static bool compute_row_brackets(buffer * const b, row_brackets * const r, line_desc * const ld) {
+	r->ld = ld;
+	r->syn = b->syn;
+	r->encoding = b->encoding;
+	r->win_x = b->win_x;
+	r->partial_attr = false;
+	r->count = 0;
+	r->valid = false;
+
+	int64_t pos = 0;
+	const unsigned char * const line = (const unsigned char *)ld->line;
+
+	if (b->syn) {
+		r->state = line_state(b, ld);
+		parse_visible(b, ld);
+		r->partial_attr = attr_start_pos > 0;
+
+		/* Brackets are ASCII characters, so a bytewise scan is fine outside the attributes. */
+		for(; pos < attr_start_pos; pos++)
+			if (bracket_kind(line[pos]) >= 0 && !add_bracket(r, pos, bracket_kind(line[pos]), 0, false)) return false;
+
+		for(int64_t i = 0; pos < ld->line_len && i < attr_len; pos = next_pos(ld->line, pos, b->encoding), i++)
+			if (bracket_kind(line[pos]) >= 0 && !add_bracket(r, pos, bracket_kind(line[pos]), attr_buf[i], true)) return false;
+
+		if (pos < ld->line_len) r->partial_attr = true;
+	}
+
+	for(; pos < ld->line_len; pos++)
+		if (bracket_kind(line[pos]) >= 0 && !add_bracket(r, pos, bracket_kind(line[pos]), 0, false)) return false;
+
+	r->valid = true;
+	return true;
+}
+
+
+/* Brings up to date the cached brackets of the visible rows. Returns the
+   number of visible rows, or -1 if we ran out of memory. */
+
+static int update_row_brackets(buffer * const b) {
+	const int rows = ne_lines - 1;
+
+	if (row_bracket_rows != rows) {
+		for(int i = rows; i < row_bracket_rows; i++) {
+			free(row_bracket[i].bracket);
+			row_bracket[i].bracket = NULL;
+			row_bracket[i].size = 0;
+		}
+		row_brackets * const new_row_bracket = realloc(row_bracket, rows * sizeof *row_bracket);
+		if (!new_row_bracket) return -1;
+		if (rows > row_bracket_rows) memset(new_row_bracket + row_bracket_rows, 0, (rows - row_bracket_rows) * sizeof *row_bracket);
+		row_bracket = new_row_bracket;
+		row_bracket_rows = rows;
+	}
+
+	line_desc *ld = b->top_line_desc;
+	int i;
+	for(i = 0; i < rows && ld->ld_node.next; i++, ld = (line_desc *)ld->ld_node.next) {
+		row_brackets *r = &row_bracket[i];
+		if (r->ld != ld) {
+			/* The window might have been scrolled. */
+			for(int j = i + 1; j < rows; j++)
+				if (row_bracket[j].ld == ld) {
+					const row_brackets t = *r;
+					*r = row_bracket[j];
+					row_bracket[j] = t;
+					break;
+				}
+		}
+
+		bool stale = r->ld != ld || !r->valid || r->syn != b->syn || r->encoding != b->encoding;
+		if (!stale && b->syn) {
+			HIGHLIGHT_STATE state = line_state(b, ld);
+			stale = !highlight_cmp(&r->state, &state) || r->partial_attr && r->win_x != b->win_x;
+		}
+		if (stale && !compute_row_brackets(b, r, ld)) return -1;
+	}
+
+	for(int j = i; j < rows; j++) {
+		row_bracket[j].ld = NULL;
+		row_bracket[j].count = 0;
+	}
+
+	return i;
+}
+
+
+/* Finds the visible bracket matching the one under the cursor, using the
+   cached brackets of the visible rows. Returns OK and sets *match_row and
+   *match, or an error code, as find_matching_bracket() does. */
+
+static int find_visible_matching_bracket(buffer * const b, int * const match_row, const bracket_pos ** const match) {
+	const line_desc * const ld = b->cur_line_desc;
+	if (b->cur_pos >= ld->line_len || bracket_kind((unsigned char)ld->line[b->cur_pos]) < 0) return NOT_ON_A_BRACKET;
+
+	const int rows = update_row_brackets(b);
+	if (rows < 0) return OUT_OF_MEMORY;
+
+	int row = b->cur_y;
+	const row_brackets *r = &row_bracket[row];
+	int64_t k = 0, h = r->count - 1;
+	while(k < h) {
+		const int64_t m = (k + h) / 2;
+		if (r->bracket[m].pos < b->cur_pos) k = m + 1;
+		else h = m;
+	}
+	assert(k < r->count && r->bracket[k].pos == b->cur_pos);
+
+	const bracket_pos * const start = &r->bracket[k];
+	const int dir = start->kind % 2 ? -1 : 1;
+	int n = 0;
+
+	for(;;) {
+		while(k >= 0 && k < r->count) {
+			const bracket_pos * const p = &r->bracket[k];
+			if (!p->known_attr || !start->known_attr || p->attr == start->attr) {
+				if (p->kind == start->kind) n++;
+				else if (p->kind == (start->kind ^ 1)) n--;
+				if (n == 0) {
+					*match_row = row;
+					*match = p;
+					return OK;
+				}
+			}
+			k += dir;
+		}
+		if ((row += dir) < 0 || row >= rows) return CANT_FIND_BRACKET;
+		r = &row_bracket[row];
+		k = dir > 0 ? 0 : r->count - 1;
+	}
+}
+
+
 /* (Un)highlights (depending on the value of show) the bracket matching
 the one under the cursor (if any). */
 
@@ -720,22 +1350,24 @@ void automatch_bracket(buffer * const b, const bool show) {
 	static uint32_t orig_attr;
 
 	if (show) {
-		int64_t match_pos, match_line;
+		int match_row;
+		const bracket_pos *match;
 		uint32_t tmp_attr;
-		line_desc *matching_ld;
-		if (find_matching_bracket(b, b->win_y, b->win_y + ne_lines - 2 >= b->num_lines - 1 ? b->num_lines - 1 : b->win_y + ne_lines - 2,
-								  &match_line, &match_pos, &c, &matching_ld) == OK) {
-			/* We limited find_matching_bracket()'s search to the visible lines, but not the
-			visible portions of those lines. Now ensure the matching pos is within the visible window. */
-			b->automatch.y = match_line - b->win_y;
-			b->automatch.x = calc_width(matching_ld, match_pos, b->opt.tab_size, b->encoding) - b->win_x;
+		if (find_visible_matching_bracket(b, &match_row, &match) == OK) {
+			/* We limited the search to the visible lines, but not the visible
+			portions of those lines. Now ensure the matching pos is within the visible window. */
+			const line_desc * const matching_ld = row_bracket[match_row].ld;
+			c = (unsigned char)matching_ld->line[match->pos];
+			b->automatch.y = match_row;
+			b->automatch.x = calc_width(matching_ld, match->pos, b->opt.tab_size, b->encoding) - b->win_x;
 			if (b->automatch.x >= 0 && b->automatch.x < ne_columns ) {
 				move_cursor(b->automatch.y, b->automatch.x);
-				if (b->syn) {
-					parse(b->syn, matching_ld, matching_ld->highlight_state, b->encoding == ENC_UTF8);
-					orig_attr = attr_buf[match_pos];
+				orig_attr = match->known_attr ? match->attr : 0; /* That's a stretch. FIX_ME */
+				if (b->opt.highlight_matches && match_row < row_match_rows && row_match[match_row].ld == matching_ld) {
+					const row_matches * const rm = &row_match[match_row];
+					for(int64_t i = 0; i < rm->count; i++)
+						if (rm->match[i].pos <= match->pos && match->pos < rm->match[i].pos + rm->match[i].len) orig_attr ^= INVERSE;
 				}
-				else orig_attr = 0; /* That's a stretch. FIX_ME */
 				tmp_attr = orig_attr;
 				if (b->opt.automatch & 1 ) { /* invert boldness of FG, BG */
 					switch (orig_attr & BG_MASK) {
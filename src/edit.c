@@ -136,27 +136,43 @@ int match_bracket(buffer *b) {
 	return rc;
 }
 
-int find_matching_bracket(buffer *b, const int64_t min_line, int64_t max_line, int64_t *match_line, int64_t *match_pos, int *c, line_desc ** match_ld) {
+/* The pairs of brackets we recognize. */
+
+static const unsigned char bracket_table[NUM_BRACKETS][2] = { { '(', ')' },
+																				  { '[', ']' },
+																				  { '{', '}' },
+																				  { '<', '>' },
+																				  { '`', '\'' } };
+
+/* If c is a bracket, returns twice the index of its pair in bracket_table, plus
+   one if it is a closing bracket; otherwise, returns -1. Thus, two brackets match
+   if their kinds differ just in the least significant bit. */
+
+int bracket_kind(const int c) {
+	static signed char kind[256];
+	static bool initialized;
+
+	if (!initialized) {
+		memset(kind, -1, sizeof kind);
+		for(int i = 0; i < NUM_BRACKETS; i++)
+			for(int j = 0; j < 2; j++) kind[bracket_table[i][j]] = i * 2 + j;
+		initialized = true;
+	}
 
-	static unsigned char bracket_table[NUM_BRACKETS][2] = { { '(', ')' },
-																			  { '[', ']' },
-																			  { '{', '}' },
-																			  { '<', '>' },
-																			  { '`', '\'' } };
+	return c >= 0 && c < 256 ? kind[c] : -1;
+}
+
+int find_matching_bracket(buffer *b, const int64_t min_line, int64_t max_line, int64_t *match_line, int64_t *match_pos, int *c, line_desc ** match_ld) {
 
 	line_desc *ld = b->cur_line_desc;
 
 	if (b->cur_pos >= ld->line_len) return NOT_ON_A_BRACKET;
 
-	int i, j, dir;
-	for(i = 0; i < NUM_BRACKETS; i++) {
-		for(j = 0; j < 2; j++)
-			if (ld->line[b->cur_pos] == bracket_table[i][j]) break;
-		if (j < 2) break;
-	}
-
-	if (i == NUM_BRACKETS && j == 2) return NOT_ON_A_BRACKET;
+	const int kind = bracket_kind((unsigned char)ld->line[b->cur_pos]);
+	if (kind < 0) return NOT_ON_A_BRACKET;
 
+	const int i = kind / 2, j = kind % 2;
+	int dir;
 	if (j) dir = -1;
 	else dir = 1;
 
@@ -90,7 +90,10 @@ char *error_msg[ERROR_COUNT] = {
 	/* 62 */ "Invalid Shift specified (use [<|>][#][s|t]; default is \">1t\").",
 	/* 63 */ "Insufficient white space for requested left shift.",
 	/* 64 */ "Document not saved.",
-	/* 65*/	"File is too large--syntax highlighting disabled (use SYNTAX to reactivate)."
+	/* 65*/	"File is large--syntax highlighting is computed just around the visible lines.",
+	/* 66 */ "No match index (use FindAll first).",
+	/* 67 */ "This document has no syntax (use SYNTAX first).",
+	/* 68 */ "The pattern list is too large."
 
 };
 
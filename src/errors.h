@@ -108,7 +108,10 @@ enum error {
 	/* 62 */ INVALID_SHIFT_SPECIFIED,
 	/* 63 */ INSUFFICIENT_WHITESPACE,
 	/* 64 */ DOCUMENT_NOT_SAVED,
-	/* 65 */ FILE_TOO_LARGE_SYNTAX_HIGHLIGHTING_DISABLED,
+	/* 65 */ LARGE_FILE_WINDOW_SYNTAX_HIGHLIGHTING,
+	/* 66 */ NO_MATCH_INDEX,
+	/* 67 */ NO_SYNTAX,
+	/* 68 */ PATTERN_LIST_TOO_LARGE,
 
 	ERROR_COUNT
 };
@@ -324,6 +324,7 @@ int setupterm(const char * const dummy1, const int dunmmy2, const int * const du
 	ne_exit_alt_charset_mode = tgetstr("ae", NULL);
 
 	ne_repeat_char = tgetstr("rp", NULL);
+	ne_erase_chars = tgetstr("ec", NULL);
 
 	ne_tilde_glitch = tgetflag("hz");
 	ne_memory_below = tgetflag("db");
@@ -120,7 +120,7 @@ int64_t request_number(const char * const prompt, const int64_t default_value) {
 
 	if (default_value >= 0) sprintf(t, "%" PRId64, default_value);
 
-	char * const result = request(prompt, default_value >= 0 ? t : NULL, false, 0, io_utf8);
+	char * const result = request(prompt, default_value >= 0 ? t : NULL, false, 0, io_utf8, NULL);
 	if (!result) return ABORT;
 	if (!*result) return ERROR;
 
@@ -141,7 +141,7 @@ int64_t request_number(const char * const prompt, const int64_t default_value) {
 
 char *request_string(const char * const prompt, const char * const default_string, const bool accept_null_string, const int completion_type, const bool prefer_utf8) {
 
-	const char * const result = request(prompt, default_string, true, completion_type, prefer_utf8);
+	const char * const result = request(prompt, default_string, true, completion_type, prefer_utf8, NULL);
 
 	if (result && (*result || accept_null_string)) return str_dup(result);
 
@@ -234,6 +234,11 @@ static void add_to_history(const char * const str) {
    If prefer_utf8 is true, editing an ASCII line inserting an ISO-8859-1 character
    will turn it into an UTF-8 line.
 
+   If update is not NULL, it is called with the current content of the input
+   line after each keystroke that does not terminate the request (this is
+   used by incremental search). It might return early if there is pending
+   input, so it is called even if the keystroke did not change the line.
+
    request() relies on a number of auxiliary functions and static data. As
    always, we would really need nested functions, but, alas, C can't cope with
    them. */
@@ -267,7 +272,7 @@ static void input_refresh(void) {
 		output_char(get_char(&input_buffer[j], encoding), 0, encoding);
 	}
 	clear_to_eol();
-	fflush(stdout);
+	flush_output();
 }
 
 static void input_autocomplete(void) {
@@ -502,7 +507,7 @@ static void input_paste(void) {
 	}
 }
 
-char *request(const char *prompt, const char * const default_string, const bool alpha_allowed, const int completion_type, const bool prefer_utf8) {
+char *request(const char *prompt, const char * const default_string, const bool alpha_allowed, const int completion_type, const bool prefer_utf8, void (* const update)(const char *)) {
 
 	set_attr(0);
 
@@ -814,6 +819,8 @@ char *request(const char *prompt, const char * const default_string, const bool
 			break;
 		}
 
+		if (update && !selection) update(input_buffer);
+
 		if (selection) {
 			const line_desc * const last = (line_desc *)history_buff->line_desc_list.tail_pred->prev;
 			assert(input_buffer[len] == 0);
@@ -20,10 +20,12 @@
 
 
 #include "ne.h"
+#include "termchar.h"
 #include <time.h>
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
+#include <poll.h>
 
 
 /* Maximum number of key definitions from terminfo plus others
@@ -33,11 +35,16 @@
 
 /* Size of the keyboard input buffer. */
 
-#define KBD_BUF_SIZE 512
+#define KBD_BUF_SIZE 4096
+
+/* Maximum length of a key sequence with a modifier (see modified_key()). */
+
+#define MAX_MODIFIED_KEY_LEN 16
 
 /* This structure describes a key in the terminfo database. These structures
-are ordered with respect to the string field to optimize their scanning. The
-order is *inverted* w.r.t. strcmp(). */
+are ordered with respect to the string field, so that key_may_set() can use
+binary search. The order is *inverted* w.r.t. strcmp(). Key sequences are
+matched by get_key_code() using a trie compiled from this array. */
 
 
 typedef struct {
@@ -49,6 +56,23 @@ typedef struct {
 static term_key key[MAX_TERM_KEY];
 static int num_keys;
 
+/* A node of the trie of key capabilities. Node 0 is the root; the children
+   of a node are linked through the sibling field in increasing character
+   order. */
+
+typedef struct {
+	int child;           /* The first child, or 0. */
+	int sibling;         /* The next sibling, or 0. */
+	int code;            /* The key code of the capability ending here, or -1. */
+	unsigned char c;     /* The character leading to this node. */
+} trie_node;
+
+static trie_node *trie;
+
+/* If true, the key capabilities have changed, and the trie must be rebuilt. */
+
+static bool trie_stale = true;
+
 /* Function to pass to qsort for sorting the key capabilities array. */
 
 static int keycmp(const void *t1, const void *t2) {
@@ -105,7 +129,7 @@ static void key_set(const char * const cap_string, const int code) {
 	key[num_keys].string = cap_string;
 	key[num_keys].code = code;
 	num_keys++;
-
+	trie_stale = true;
 }
 
 
@@ -129,8 +153,10 @@ int key_may_set(const char * const cap_string, int code) {
 
 	if (num_keys >= MAX_TERM_KEY - 1) return 0;
 	if (!cap_string || (pos = binsearch(cap_string)) < 0) {
-		if (code < 0)
+		if (code < 0) {
 			key[-pos-1].code = -code - 1;
+			trie_stale = true;
+		}
 		return pos;
 	}
    if (code < 0) code = -code - 1;
@@ -138,12 +164,34 @@ int key_may_set(const char * const cap_string, int code) {
 	key[pos].string = cap_string;
 	key[pos].code = code;
 	num_keys++;
+	trie_stale = true;
 	assert(num_keys < MAX_TERM_KEY);
 	return pos+1;
 }
 
 
 
+/* The startup cache (see startup.c) uses these functions to save and
+   restore the key capabilities defined in the key bindings files, which are
+   read before those of the terminal. get_key_capability() returns the code
+   of the i-th capability, storing its string in *cap_string, or -1 if there
+   are fewer capabilities. add_key_capability() appends a capability, which
+   must come after the existing ones in the array order; it returns false
+   if this is not the case, or if the array is full. */
+
+int get_key_capability(const int i, const char ** const cap_string) {
+	if (i < 0 || i >= num_keys) return -1;
+	*cap_string = key[i].string;
+	return key[i].code;
+}
+
+bool add_key_capability(const char * const cap_string, const int code) {
+	if (num_keys >= MAX_TERM_KEY - 1 || num_keys && strcmp(key[num_keys - 1].string, cap_string) <= 0) return false;
+	key_set(cap_string, code);
+	return true;
+}
+
+
 /* Here we scan the terminfo database and build a term_key structure for
 each key available. num_keys records the number of entries. The array is
 sorted in reverse order with respect to string field (this optimizes the
@@ -276,6 +324,14 @@ void read_key_capabilities(void) {
 
 	qsort(key, num_keys, sizeof(term_key), keycmp);
 
+	/* The start of a bracketed paste is returned as a special key code; the
+		end, which is normally consumed by read_paste(), is ignored. */
+
+	if (ne_enable_bracketed_paste) {
+		key_may_set(ne_paste_start, NE_KEY_PASTE);
+		key_may_set(ne_paste_end, NE_KEY_IGNORE);
+	}
+
 	/* A nice hack for common cursor movements borrowed from pico.
 
 		Unfortunately, quite a few terminfo and termcap entries out there have
@@ -397,19 +453,217 @@ void set_escape_time(const int new_escape_time) {
 }
 
 
-/* Sets the current timeout in the termios structure relative to stdin. If the
-   timeout value (in tenth of a second) is positive, VMIN is set to 0,
-   otherwise to 1. */
+/* Builds the trie of key capabilities. If we run out of memory, the trie
+   is left empty, and no key sequence will be recognized. */
+
+static void build_trie(void) {
+	static trie_node empty = { 0, 0, -1, 0 };
+
+	int size = 1;
+	for(int i = 0; i < num_keys; i++) size += strlen(key[i].string);
+
+	if (trie != &empty) free(trie);
+	trie_stale = false;
+	if (!(trie = malloc(size * sizeof *trie))) {
+		trie = &empty;
+		return;
+	}
+
+	trie[0] = empty;
+	int nodes = 1;
+	for(int i = 0; i < num_keys; i++) {
+		int n = 0;
+		for(const unsigned char *p = (const unsigned char *)key[i].string; *p; p++) {
+			int prev = 0, m = trie[n].child;
+			while(m && trie[m].c < *p) {
+				prev = m;
+				m = trie[m].sibling;
+			}
+			if (!m || trie[m].c != *p) {
+				trie[nodes] = (trie_node){ 0, m, -1, *p };
+				if (prev) trie[prev].sibling = nodes;
+				else trie[n].child = nodes;
+				m = nodes++;
+			}
+			n = m;
+		}
+		if (trie[n].code < 0) trie[n].code = key[i].code;
+	}
+}
+
+
+/* Returns the child of trie node n reached through the character c, or 0. */
+
+static int trie_child(const int n, const unsigned char c) {
+	int m;
+	for(m = trie[n].child; m && trie[m].c < c; m = trie[m].sibling);
+	return m && trie[m].c == c ? m : 0;
+}
+
+
+/* Returns the key code of the capability s, or -1. */
+
+static int trie_code(const char * const s) {
+	int n = 0;
+	for(const unsigned char *p = (const unsigned char *)s; *p; p++)
+		if (!(n = trie_child(n, *p))) return -1;
+	return trie[n].code;
+}
+
+
+/* Modern terminals (e.g., xterm) report keys pressed together with Shift,
+   Alt or Control by adding a modifier parameter to the key sequence: for
+   instance, ESC[1;5A or ESC[3;2~. Since ne does not distinguish modified
+   keys, we remove the modifier and look for the resulting sequence: ESC[A
+   (or ESC O A) and ESC[3~, respectively. If the len characters at s start with
+   such a sequence whose unmodified version is a key capability, we return its
+   key code and store its length in *seq_len. If they could be the prefix of
+   such a sequence, we return -2; otherwise, -1. */
+
+static int modified_key(const char * const s, const int len, int * const seq_len) {
+	if (len < 2) return len == 1 && s[0] == '\x1b' ? -2 : -1;
+	if (s[0] != '\x1b' || s[1] != '[') return -1;
+
+	int i = 2, param_len = 0, semicolons = 0;
+	for(; i < len && i < MAX_MODIFIED_KEY_LEN && (isdigit((unsigned char)s[i]) || s[i] == ';'); i++)
+		if (s[i] == ';' && semicolons++ == 0) param_len = i - 2;
+	if (i == len) return i < MAX_MODIFIED_KEY_LEN ? -2 : -1;
+	if (semicolons != 1 || s[i] < 0x40 || s[i] > 0x7E) return -1;
+
+	char unmodified[MAX_MODIFIED_KEY_LEN + 1];
+	int code = -1;
+	if (s[i] == '~') {
+		sprintf(unmodified, "\x1b[%.*s~", param_len, s + 2);
+		code = trie_code(unmodified);
+	}
+	else if (param_len == 0 || param_len == 1 && s[2] == '1') {
+		sprintf(unmodified, "\x1b[%c", s[i]);
+		if ((code = trie_code(unmodified)) < 0) {
+			sprintf(unmodified, "\x1bO%c", s[i]);
+			code = trie_code(unmodified);
+		}
+	}
+
+	*seq_len = i + 1;
+	return code;
+}
+
+
+/* The keyboard buffer used by get_key_code(). It contains cur_len
+   characters, starting at kbd_start, that have been read, but not returned
+   yet. */
+
+static int kbd_start, cur_len;
+static char kbd_buffer[KBD_BUF_SIZE];
+
+/* The characters following a bracketed paste that did not fit into the
+   keyboard buffer (see read_paste()), starting at kbd_pending_pos, or NULL.
+   They are returned before any other input. */
+
+static char_stream *kbd_pending;
+static int64_t kbd_pending_pos;
+
+
+/* Reads into the keyboard buffer the characters available on stdin, with a
+   single read(), or the pending characters, if any. If timeout is
+   nonnegative, we wait for input at most timeout milliseconds using poll();
+   otherwise, we block (the terminal is in noncanonical mode with VMIN=1).
+   Returns the number of characters read, 0 on timeout or if the buffer is
+   full, and -1 on end of file (with errno set to zero) or on error. */
+
+static int fill_kbd_buffer(const int timeout) {
+	if (kbd_start > 0) {
+		memmove(kbd_buffer, kbd_buffer + kbd_start, cur_len);
+		kbd_start = 0;
+	}
+	if (cur_len == KBD_BUF_SIZE) return 0;
+
+	if (kbd_pending) {
+		const int n = min(KBD_BUF_SIZE - cur_len, kbd_pending->len - kbd_pending_pos);
+		memcpy(kbd_buffer + cur_len, kbd_pending->stream + kbd_pending_pos, n);
+		cur_len += n;
+		if ((kbd_pending_pos += n) == kbd_pending->len) {
+			free_char_stream(kbd_pending);
+			kbd_pending = NULL;
+		}
+		return n;
+	}
+
+	if (timeout >= 0) {
+		struct pollfd pfd = { 0, POLLIN, 0 };
+		const int ready = poll(&pfd, 1, timeout);
+		if (ready <= 0) return ready;
+	}
+
+	errno = 0;
+	const ssize_t n = read(0, kbd_buffer + cur_len, KBD_BUF_SIZE - cur_len);
+	if (n <= 0) return -1;
+	cur_len += n;
+	return n;
+}
+
+
+/* Removes the first n characters from the keyboard buffer. */
+
+static void consume_kbd_buffer(const int n) {
+	kbd_start += n;
+	if (!(cur_len -= n)) kbd_start = 0;
+}
 
-static void set_termios_timeout(const int timeout) {
-	struct termios termios;
 
-	tcgetattr(0, &termios);
+/* Tries to decode the characters in the keyboard buffer. Returns the number
+   of characters decoded, storing in *c their value as returned by
+   get_key_code(), or 0 if more characters are necessary. If timed_out is
+   true, no more characters are coming, and some characters are always
+   decoded. A result of -1 means that a character must be discarded. */
 
-	termios.c_cc[VTIME] = timeout;
-	termios.c_cc[VMIN] = timeout ? 0 : 1;
+static int match_key(int * const c, const bool timed_out) {
+	const char * const s = kbd_buffer + kbd_start;
 
-	tcsetattr(0, TCSANOW, &termios);
+	if (io_utf8 && (unsigned char)s[0] >= 0x80) {
+		const int len = utf8len(s[0]);
+		if (len < 0) return -1;
+		for(int i = 1; i < len; i++) {
+			/* If the sequence is incomplete, after the escape time we discard it. */
+			if (i == cur_len) return timed_out ? -cur_len : 0;
+			/* On a UTF-8 error, we discard the first character and try again. */
+			if ((s[i] & 0xC0) != 0x80) return -1;
+		}
+		*c = utf8char(s);
+		if (*c == -1) *c = INVALID_CHAR;
+		return len;
+	}
+
+	/* We look for the longest key capability prefixing the buffer. */
+	int n = 0, code = -1, code_len = 0, i;
+	for(i = 0; i < cur_len && (n = trie_child(n, s[i])); i++)
+		if (trie[n].code >= 0) {
+			code = trie[n].code;
+			code_len = i + 1;
+			if (!trie[n].child) break;
+		}
+
+	if (i == cur_len && !timed_out) return 0;
+
+	if (code_len <= i) {
+		/* We did not match a whole capability: it might be a key with a modifier. */
+		int seq_len;
+		const int modified_code = modified_key(s, cur_len, &seq_len);
+		if (modified_code == -2 && !timed_out) return 0;
+		if (modified_code >= 0) {
+			*c = -modified_code - 1;
+			return seq_len;
+		}
+	}
+
+	if (code >= 0) {
+		assert(code < NUM_KEYS);
+		*c = -code - 1;
+		return code_len;
+	}
+
+	*c = s[0];
+	return 1;
 }
 
 
@@ -418,137 +672,163 @@ static void set_termios_timeout(const int timeout) {
    a character (possibly INVALID_CHAR), or a negative number denoting a key
    code (if x is the key code, -x-1 will be returned).
 
-   This function tries to be highly optimized and efficient by employing a
-   sorted array of strings for the terminal keys. An index keeps track of the
-   key which has a partial match with the current contents of the keyboard
-   buffer. As each character is input, a match is tried with the rest of the
-   string. If a new character does not match, we can just increment the key
-   counter (because the array is sorted). When we get out of the array, we give
-   back the first char in the keyboard buffer (the next call will retry a match
-   on the following chars). */
+   Characters are read in blocks, so a burst of input (e.g., a paste, or fast
+   typing) usually costs a single system call. Key sequences are matched
+   against a trie compiled from the key capabilities, returning the longest
+   match; if the characters read so far are a proper prefix of some key
+   sequence, we wait for more characters using poll() for at most escape_time
+   tenths of second. If nothing arrives, we return what we got. */
 
+static int decode_key(void) {
+	bool timed_out = false;
+	if (trie_stale) build_trie();
+
+	while(true) {
+		if (cur_len) {
+			int c;
+			const int n = match_key(&c, timed_out);
+			if (n > 0) {
+				consume_kbd_buffer(n);
+				return c;
+			}
+			if (n < 0) {
+				consume_kbd_buffer(-n);
+				timed_out = false;
+				continue;
+			}
+		}
+
+		flush_output();
+		stats_frame();
+
+		const int r = fill_kbd_buffer(cur_len ? escape_time * 100 : -1);
+		const int e = errno;
+		timed_out = false;
+
+		if (r < 0) {
+			if (e != EINTR) kill(getpid(), SIGTERM);
+			/* A signal (e.g., a window size change) or a termination request. */
+			if (!cur_len) return INVALID_CHAR;
+			timed_out = true;
+		}
+		else if (r == 0) timed_out = true;
+	}
+}
+
+
+/* Returns the next key (see decode_key()), recording its arrival time for
+   latency statistics. */
 
 int get_key_code(void) {
-	static int cur_len = 0;
-	static char kbd_buffer[KBD_BUF_SIZE];
+	const int c = decode_key();
+	if (c != INVALID_CHAR) stats_key();
+	return c;
+}
 
-	int c, e, last_match = 0, cur_key = 0;
-	bool partial_match = false, partial_is_utf8 = false;
 
-	while(true) {
+/* Returns true if there is some keyboard input waiting to be processed by
+   get_key_code(). It never blocks, and it is used to interrupt long
+   computations (e.g., incremental searches) when the user keeps typing. */
 
-		if (cur_len) {
+bool key_pending(void) {
+	if (cur_len || kbd_pending) return true;
+	struct pollfd pfd = { 0, POLLIN, 0 };
+	return poll(&pfd, 1, 0) > 0;
+}
 
-			/* Something is already in the buffer. last_match is the position
-			we have to check. */
-
-			while(last_match < cur_len) {
-				if (last_match == 0 && io_utf8 && (unsigned char)kbd_buffer[0] >= 0x80) {
-					partial_is_utf8 = true;
-					last_match++;
-				}
-				else if (partial_is_utf8) { 	/* Our partial match is an UTF-8 sequence. */
-					if ((kbd_buffer[last_match] & 0xC0) == 0x80) {
-						if (utf8len(kbd_buffer[0]) == ++last_match) {
-							c = utf8char(kbd_buffer);
-							if (cur_len -= last_match) memmove(kbd_buffer, kbd_buffer + last_match, cur_len);
-							return c == -1 ? INVALID_CHAR : c;
-						}
-					}
-					else {
-						/* A UTF-8 error. We discard the first character and try again. */
-						if (--cur_len) memmove(kbd_buffer, kbd_buffer + 1, cur_len);
-						partial_is_utf8 = false;
-						last_match = 0;
-					}
-				}
-				else {
-					/* First easy case. We felt off the array. We return the first character
-						in the buffer and restart the match. */
-
-					if (!key[cur_key].string) {
-						c = kbd_buffer[0];
-						if (--cur_len) memmove(kbd_buffer, kbd_buffer + 1, cur_len);
-						return c;
-					}
-
-					/* Second case. We have a partial match on the first last_match
-						characters. If another character matches, either the string is terminated,
-						and we return the key code, or we increment the match count. */
-
-
-					else if (key[cur_key].string[last_match] == kbd_buffer[last_match]) {
-						if (key[cur_key].string[last_match + 1] == 0) {
-							if (cur_len -= last_match + 1) memmove(kbd_buffer, kbd_buffer + last_match + 1, cur_len);
-
-							assert(key[cur_key].code < NUM_KEYS);
-
-							return -key[cur_key].code - 1;
-						}
-						else last_match++;
-					}
-
-					/* The tricky part. If there is a failed match, the order guarantees that
-						no match if possible if the code of the keyboard char is greater than the code of
-						the capability char. Otherwise, we check for the first capability starting
-						with the current keyboard characters. */
-
-					else {
-						if (kbd_buffer[last_match] > key[cur_key].string[last_match]) {
-							c = kbd_buffer[0];
-							if (--cur_len) memmove(kbd_buffer, kbd_buffer + 1, cur_len);
-							return c;
-						}
-						else {
-							last_match = 0;
-							cur_key++;
-						}
-					}
-				}
-			}
-			/* If we have a partial match, let's look at stdin for escape_time
-				tenths of second. If nothing arrives, it is probably time to return
-				what we got. Note that this won't work properly if the terminal has
-				a key capability which is a prefix of another key capability. */
 
-			partial_match = true;
-		}
+/* If no input arrives for this number of milliseconds during a bracketed
+   paste, we assume that the end sequence got lost. */
 
-		fflush(stdout);
+#define PASTE_TIMEOUT 1000
 
-		if (partial_match) set_termios_timeout(escape_time);
+/* Reads the text of a bracketed paste, whose start sequence has just been
+   returned by get_key_code(), up to the end sequence, and returns it in a
+   newly allocated char stream (or NULL if we run out of memory). Line
+   terminators (CR, LF or CR/LF) are converted to NULs, as in load_stream(). */
 
-		errno = 0;
-		c = getchar();
-		e = errno;
+char_stream *read_paste(void) {
+	const int end_len = strlen(ne_paste_end);
+	char_stream * const cs = alloc_char_stream(KBD_BUF_SIZE);
+	if (!cs) return NULL;
 
-		if (partial_match) set_termios_timeout(0);
+	/* We start from whatever follows the start sequence in the keyboard buffer. */
 
-		/* This is necessary to circumvent the slightly different behaviour of getc() in Linux and BSD. */
-		clearerr(stdin);
+	memcpy(cs->stream, kbd_buffer + kbd_start, cur_len);
+	cs->len = cur_len;
+	cur_len = kbd_start = 0;
 
-		if (c == EOF && (!partial_match || e) && e != EINTR) kill(getpid(), SIGTERM);
+	if (kbd_pending) {
+		const int64_t len = kbd_pending->len - kbd_pending_pos;
+		if (cs->len + len > cs->size && !realloc_char_stream(cs, cs->len + len)) {
+			/* We give up, but we leave the input where it was. */
+			memcpy(kbd_buffer, cs->stream, cs->len);
+			cur_len = cs->len;
+			free_char_stream(cs);
+			return NULL;
+		}
+		memcpy(cs->stream + cs->len, kbd_pending->stream + kbd_pending_pos, len);
+		cs->len += len;
+		free_char_stream(kbd_pending);
+		kbd_pending = NULL;
+	}
 
-		partial_match = false;
+	int64_t scanned = 0, end = -1;
+	while(true) {
+		for(; scanned + end_len <= cs->len; scanned++)
+			if (cs->stream[scanned] == *ne_paste_end && !memcmp(cs->stream + scanned, ne_paste_end, end_len)) {
+				end = scanned;
+				break;
+			}
+		if (end >= 0) break;
 
-		if (c != EOF) {
-			if (cur_len < KBD_BUF_SIZE) kbd_buffer[cur_len++] = c;
+		if (cs->len == cs->size && !realloc_char_stream(cs, cs->size * 2)) {
+			free_char_stream(cs);
+			return NULL;
+		}
+
+		struct pollfd pfd = { 0, POLLIN, 0 };
+		const int ready = poll(&pfd, 1, PASTE_TIMEOUT);
+		if (ready < 0 && errno == EINTR) continue;
+		if (ready <= 0) break;
+
+		const ssize_t n = read(0, cs->stream + cs->len, cs->size - cs->len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		cs->len += n;
+	}
+
+	if (end >= 0) {
+		/* What follows the end sequence goes back into the keyboard buffer,
+			or, if it does not fit, into the pending characters. */
+		const int64_t rest = cs->len - end - end_len;
+		if (rest <= KBD_BUF_SIZE) {
+			memcpy(kbd_buffer, cs->stream + end + end_len, rest);
+			cur_len = rest;
 		}
 		else {
-			if (cur_len) {
-
-				/* We ran out of time. If our match was UTF-8, we discard the
-					partially received UTF-8 sequence. Otherwise, we return the
-					first character of the keyboard buffer.  */
-
-				if (partial_is_utf8) cur_len = last_match = partial_is_utf8 = 0;
-				else {
-					c = kbd_buffer[0];
-					if (--cur_len) memmove(kbd_buffer, kbd_buffer + 1, cur_len);
-					return c;
-				}
+			if (!(kbd_pending = alloc_char_stream(rest))) {
+				/* We lose the paste, but not the characters following it. */
+				memmove(cs->stream, cs->stream + end + end_len, rest);
+				cs->len = rest;
+				kbd_pending = cs;
+				kbd_pending_pos = 0;
+				return NULL;
 			}
-			else return INVALID_CHAR;
+			memcpy(kbd_pending->stream, cs->stream + end + end_len, rest);
+			kbd_pending->len = rest;
+			kbd_pending_pos = 0;
 		}
+		cs->len = end;
 	}
+
+	int64_t j = 0;
+	for(int64_t i = 0; i < cs->len; i++, j++) {
+		if (i < cs->len - 1 && cs->stream[i] == '\r' && cs->stream[i + 1] == '\n') i++;
+		cs->stream[j] = cs->stream[i] == '\r' || cs->stream[i] == '\n' ? 0 : cs->stream[i];
+	}
+	cs->len = j;
+
+	set_stream_encoding(cs, io_utf8 ? ENC_UTF8 : ENC_8_BIT);
+	return cs;
 }
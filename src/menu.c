@@ -43,15 +43,6 @@
 
 #define MAX_MESSAGE_LENGTH 1024
 
-/* The name of the menu configuration file. */
-
-#define MENU_CONF_NAME ".menus"
-
-/* The name of the key bindings file. */
-
-#define KEY_BINDINGS_NAME ".keys"
-
-
 /* The keywords used in the configuration files. */
 
 #define MENU_KEYWORD "MENU"
@@ -137,6 +128,7 @@ static const menu_item search_item[] =
 	{
 		{ "Find...        ^F", FIND_ABBREV },
 		{ "Find RegExp... ^_", FINDREGEXP_ABBREV },
+		{ "Find All         ", FINDALL_ABBREV },
 		{ "Replace...     ^R", REPLACE_ABBREV },
 		{ "Replace Once...  ", REPLACEONCE_ABBREV },
 		{ "Replace All...   ", REPLACEALL_ABBREV },
@@ -405,8 +397,8 @@ static void undraw_menu(const int n) {
 		if (i >= ne_lines - 1) break;
 		if (ld->ld_node.next->next) {
 			ld = (line_desc *)ld->ld_node.next;
-			if (cur_buffer->syn) parse(cur_buffer->syn, ld, ld->highlight_state, cur_buffer->encoding == ENC_UTF8);
-			output_line_desc(i, menus[n].xpos - 1, ld, cur_buffer->win_x + menus[n].xpos - 1, menus[n].width + (standout_ok ? MENU_EXTRA : MENU_NOSTANDOUT_EXTRA), cur_buffer->opt.tab_size, false, cur_buffer->encoding == ENC_UTF8, cur_buffer->syn ? attr_buf : NULL, NULL, 0);
+			if (cur_buffer->syn) parse_visible(cur_buffer, ld);
+			output_line_desc(i, menus[n].xpos - 1, ld, cur_buffer->win_x + menus[n].xpos - 1, menus[n].width + (standout_ok ? MENU_EXTRA : MENU_NOSTANDOUT_EXTRA), cur_buffer->opt.tab_size, false, cur_buffer->encoding == ENC_UTF8, cur_buffer->syn ? attr_buf : NULL, attr_start, NULL, 0);
 		}
 		else {
 			move_cursor(i, menus[n].xpos - 1);
@@ -612,18 +604,47 @@ char *gen_flag_string(const buffer * const b) {
 
 
 
+/* The variable part of the status bar is made of fields (line, column,
+   percentage and flags) displayed at fixed columns. We keep the last text
+   emitted for each field, so that when the bar is not gone we send just the
+   characters of the fields that actually changed. */
+
+enum { LINE_FIELD, COLUMN_FIELD, PERCENT_FIELD, FLAGS_FIELD, NUM_STATUS_FIELDS };
+
+static char status_field[NUM_STATUS_FIELDS][MAX_FLAG_STRING_SIZE];
+
+/* Generates the text of the fields for the current buffer. */
+
+static void gen_status_fields(char field[NUM_STATUS_FIELDS][MAX_FLAG_STRING_SIZE]) {
+	sprintf(field[LINE_FIELD], "%11" PRId64, cur_buffer->cur_line + 1);
+	sprintf(field[COLUMN_FIELD], "%11" PRId64, cur_buffer->win_x + cur_buffer->cur_x + 1);
+	sprintf(field[PERCENT_FIELD], "%3d", (int)floor(((cur_buffer->cur_line + 1) * 100.0) / cur_buffer->num_lines));
+	strcpy(field[FLAGS_FIELD], gen_flag_string(cur_buffer));
+}
+
+/* Sends the characters of a field which differ from the last emitted text,
+   which must have the same length, and records the new text. */
+
+static void update_status_field(const int field, const int col, const char * const s) {
+	char * const old = status_field[field];
+	int i, j = strlen(s);
+	for(i = 0; s[i] == old[i] && i < j; i++);
+	while(j > i && s[j - 1] == old[j - 1]) j--;
+	if (i == j) return;
+
+	move_cursor(ne_lines - 1, col + i);
+	output_chars(s + i, NULL, j - i, true);
+	strcpy(old, s);
+}
+
+
 /* Draws the status bar. If showing_msg is true, it is set to false, bar_gone
    is set to true and the update is deferred to the next call. If the bar is
-   not completely gone, we try to just update the line and column numbers, and
-   the flags. The function keeps track internally of their last values, so that
-   unnecessary printing is avoided. */
+   not completely gone, we just update the fields that changed. */
 
 
 void draw_status_bar(void) {
 	static char bar_buffer[MAX_BAR_BUFFER_SIZE];
-	static char flag_string[MAX_FLAG_STRING_SIZE];
-	static int64_t x = -1, y = -1;
-	static int percent = -1;
 
 	if (showing_msg) {
 		showing_msg = false;
@@ -635,66 +656,35 @@ void draw_status_bar(void) {
 	int len;
 
 	if (!bar_gone && status_bar) {
-		const int new_percent = (int)floor(((cur_buffer->cur_line + 1) * 100.0) / cur_buffer->num_lines);
-		/* This is the space occupied up to "L:", included. */
-		const int offset = fast_gui || !standout_ok ? 5: 3;
-		const bool update_x = x != cur_buffer->win_x + cur_buffer->cur_x;
-		const bool update_y = y != cur_buffer->cur_line;
-		const bool update_percent = percent != new_percent;
-		char *p;
-		const bool update_flags = strcmp(flag_string, p = gen_flag_string(cur_buffer));
-		const bool update_filename = strlen(flag_string) != strlen(p);
-		const bool update = update_x || update_y || update_percent || update_flags;
-
-		if (!update) return;
-
-		if (!fast_gui && standout_ok) standout_on();
-
-		x = cur_buffer->win_x + cur_buffer->cur_x;
-		y = cur_buffer->cur_line;
-		percent = new_percent;
-
-		if (update_y) {
-			move_cursor(ne_lines - 1, offset);
-			len = sprintf(bar_buffer, "%11" PRId64, y + 1);
-			output_chars(bar_buffer, NULL, len, true);
-		}
-
-		if (update_x) {
-			move_cursor(ne_lines - 1, offset + 14);
-			len = sprintf(bar_buffer, "%11" PRId64, x + 1);
-			output_chars(bar_buffer, NULL, len, true);
-		}
-
-		if (update_percent) {
-			move_cursor(ne_lines - 1, offset + 26);
-			len = sprintf(bar_buffer, "%3d", percent);
-			output_chars(bar_buffer, NULL, len, true);
-		}
-
-		if (update_flags) {
-			strcpy(flag_string, p);
-			move_cursor(ne_lines - 1, offset + 31);
-			output_string(flag_string, true);
+		char field[NUM_STATUS_FIELDS][MAX_FLAG_STRING_SIZE];
+		gen_status_fields(field);
+
+		/* If the length of the flags changes, the file name moves. */
+		if (strlen(field[FLAGS_FIELD]) == strlen(status_field[FLAGS_FIELD])) {
+			bool update = false;
+			for(int i = 0; i < NUM_STATUS_FIELDS; i++) update |= strcmp(field[i], status_field[i]) != 0;
+			if (!update) return;
+
+			/* This is the space occupied up to "L:", included. */
+			const int offset = fast_gui || !standout_ok ? 5: 3;
+			if (!fast_gui && standout_ok) standout_on();
+			update_status_field(LINE_FIELD, offset, field[LINE_FIELD]);
+			update_status_field(COLUMN_FIELD, offset + 14, field[COLUMN_FIELD]);
+			update_status_field(PERCENT_FIELD, offset + 26, field[PERCENT_FIELD]);
+			update_status_field(FLAGS_FIELD, offset + 31, field[FLAGS_FIELD]);
+			if (!fast_gui && standout_ok) standout_off();
+			return;
 		}
-
-		if (!fast_gui && standout_ok) standout_off();
-
-		if (!update_filename) return;
 	}
 
 
 	if (status_bar) {
-		percent = (int)floor(((cur_buffer->cur_line + 1) * 100.0) / cur_buffer->num_lines);
 		move_cursor(ne_lines - 1, 0);
 		if (!fast_gui && standout_ok) standout_on();
 
-		strcpy(flag_string, gen_flag_string(cur_buffer));
-
-		x = cur_buffer->win_x + cur_buffer->cur_x;
-		y = cur_buffer->cur_line;
+		gen_status_fields(status_field);
 
-		len = sprintf(bar_buffer, fast_gui || !standout_ok ? ">> L:%11" PRId64 " C:%11" PRId64 " %3d%% %s " : " L:%11" PRId64 " C:%11" PRId64 " %3d%% %s ", y + 1, x + 1, percent, flag_string);
+		len = sprintf(bar_buffer, fast_gui || !standout_ok ? ">> L:%s C:%s %s%% %s " : " L:%s C:%s %s%% %s ", status_field[LINE_FIELD], status_field[COLUMN_FIELD], status_field[PERCENT_FIELD], status_field[FLAGS_FIELD]);
 
 		move_cursor(ne_lines - 1, 0);
 		output_chars(bar_buffer, NULL, len, true);
@@ -762,7 +752,7 @@ void print_message(const char * const message) {
 			standout_off();
 		}
 
-		fflush(stdout);
+		flush_output();
 
 		showing_msg = true;
 	}
@@ -1094,3 +1084,70 @@ void get_key_bindings(const char * key_bindings_name) {
 }
 
 
+
+
+/* Saves the menu configuration in a startup cache (see startup.c): the
+   number of menus (zero if the default menus are in use) and, for each
+   menu, its name, position, width and items. */
+
+void save_menu_configuration(struct cache_out * const o) {
+	if (menus == def_menus) {
+		cache_put_u32(o, 0);
+		return;
+	}
+
+	cache_put_u32(o, menu_num);
+	for(int i = 0; i < menu_num; i++) {
+		cache_put_str(o, (const unsigned char *)menus[i].text);
+		cache_put_u32(o, menus[i].xpos);
+		cache_put_u32(o, menus[i].width);
+		cache_put_u32(o, menus[i].item_num);
+		for(int j = 0; j < menus[i].item_num; j++) {
+			cache_put_str(o, (const unsigned char *)menus[i].items[j].text);
+			cache_put_str(o, (const unsigned char *)menus[i].items[j].command_line);
+		}
+	}
+}
+
+
+/* Restores the menu configuration from a startup cache. Strings are not
+   copied, so the cache must stay mapped. Returns false on error, leaving
+   the current menus untouched. */
+
+bool load_menu_configuration(struct cache_in * const in) {
+	const uint32_t n = cache_get_u32(in);
+	if (in->error || n > (uint32_t)(in->end - in->p)) return false;
+	if (n == 0) return true;
+
+	menu * const new_menus = calloc(n, sizeof *new_menus);
+	if (!new_menus) return false;
+
+	uint32_t i;
+	for(i = 0; i < n && !in->error; i++) {
+		new_menus[i].text = (const char *)cache_get_str(in);
+		new_menus[i].xpos = cache_get_u32(in);
+		new_menus[i].width = cache_get_u32(in);
+		const uint32_t item_num = cache_get_u32(in);
+		menu_item *items;
+		if (in->error || item_num == 0 || item_num > (uint32_t)(in->end - in->p) || !(items = calloc(item_num, sizeof *items))) {
+			in->error = true;
+			break;
+		}
+		new_menus[i].item_num = item_num;
+		new_menus[i].items = items;
+		for(uint32_t j = 0; j < item_num; j++) {
+			items[j].text = (const char *)cache_get_str(in);
+			items[j].command_line = (const char *)cache_get_str(in);
+		}
+	}
+
+	if (in->error) {
+		while(i-- > 0) free((void *)new_menus[i].items);
+		free(new_menus);
+		return false;
+	}
+
+	menu_num = n;
+	menus = new_menus;
+	return true;
+}
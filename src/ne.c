@@ -29,6 +29,7 @@
 #include <signal.h>
 #include <limits.h>
 #include <locale.h>
+#include <time.h>
 
 /* This is the array containing the "NO WARRANTY" message, which is displayed
    when ne is called without any specific file name or macro to execute. The
@@ -77,7 +78,8 @@ char ARG_HELP[] = ABOUT_MSG "\n"
 						"--no-syntax   disable syntax-highlighting support.\n"
 						"--keys FILE   use this file for keyboard configuration.\n"
 						"--menus FILE  use this file for menu configuration.\n"
-						"--macro FILE  exec this macro after start.\n\n"
+						"--macro FILE  exec this macro after start.\n"
+						"--startup-profile  print the time spent in each startup phase at exit.\n\n"
 						"             *These options may appear multiple times.\n";
 
 
@@ -107,6 +109,7 @@ bool verbose_macros = true;
 
 buffer *cur_buffer;
 int turbo;
+int frame_interval = 100;
 bool do_syntax = true;
 
 /* Whether we are currently displaying an about message. */
@@ -181,6 +184,8 @@ void about() {
 
 int main(int argc, char **argv) {
 
+	startup_phase(NULL);
+
 	char *locale = setlocale(LC_ALL, "");
 	for(int i = 0; i < 256; i++) localised_up_case[i] = toupper(i);
 
@@ -266,6 +271,10 @@ int main(int argc, char **argv) {
 					skiplist[i] = skiplist[i+1] = 1; /* argv[i] = argv[i+1] = NULL; */
 				}
 			}
+			else if (!strcmp(&argv[i][2], "startup-profile")) {
+				startup_profile = true;
+				skiplist[i] = 1; /* argv[i] = NULL; */
+			}
 		}
 	}
 
@@ -276,13 +285,14 @@ int main(int argc, char **argv) {
 	dump_config();
 #endif
 
-	/* Unless --noconfig was specified, we try to configure the
-		menus and the keyboard. Note that these functions can exit() on error. */
+	if (startup_profile) atexit(print_startup_profile);
+	startup_phase("locale and arguments");
 
-	if (!no_config) {
-		get_menu_configuration(menu_conf_name);
-		get_key_bindings(key_bindings_name);
-	}
+	/* Unless --noconfig was specified, we try to configure the menus and the
+		keyboard, possibly using the startup cache. Note that this function can
+		exit() on error. */
+
+	if (!no_config) get_configuration(menu_conf_name, key_bindings_name, startup_prefs_name);
 
 	/* If we cannot even create a buffer, better go... */
 
@@ -296,11 +306,13 @@ int main(int argc, char **argv) {
 	if (!cd) exit(1);
 
 	add_head(&clips, &cd->cd_node);
+	startup_phase("buffers");
 
 	/* General terminfo and cursor motion initalization. From here onwards,
 	   we cannot exit() lightly. */
 
 	term_init();
+	startup_phase("term_init");
 
 	/* We will be always using the last line for the status bar. */
 
@@ -309,6 +321,7 @@ int main(int argc, char **argv) {
 	/* We read in all the key capabilities. */
 
 	read_key_capabilities();
+	startup_phase("key capabilities");
 
 	/* Some initializations of other modules... */
 
@@ -321,7 +334,7 @@ int main(int argc, char **argv) {
 
 	bool first_file = true;
 
-	load_auto_prefs(cur_buffer, startup_prefs_name);
+	load_default_prefs(cur_buffer, startup_prefs_name);
 
 	if (!isatty(fileno(stdin))) {
 		first_file = false;
@@ -332,6 +345,7 @@ int main(int argc, char **argv) {
 			fprintf(stderr, "Cannot reopen input tty\n");
 			abort();
 		}
+		startup_phase("standard input");
 	}
 
 	/* The terminal is prepared for interactive I/O. */
@@ -339,6 +353,7 @@ int main(int argc, char **argv) {
 	set_interactive_mode();
 
 	clear_entire_screen();
+	startup_phase("interactive mode");
 
 	/* This function sets fatal_code() as signal interrupt handler
 	   for all the dangerous signals (SIGILL, SIGSEGV etc.). */
@@ -413,6 +428,8 @@ int main(int argc, char **argv) {
 
 	}
 
+	startup_phase("files");
+
 	/* We delay updates. In this way the macro activity does not cause display activity. */
 
 	reset_window();
@@ -425,18 +442,35 @@ int main(int argc, char **argv) {
 		about();
 	}
 
+	struct timespec last_frame = { 0 }, now;
+
 	while(true) {
 
-		/* If we are displaying the "NO WARRANTY" info, we should not refresh the
-		   window now */
+		/* If other keystrokes are already waiting, we process them before
+		   updating the screen, so that the display never falls behind the input
+		   (e.g., when a key is held down on a slow connection). Nonetheless, we
+		   update the screen at least every frame_interval milliseconds. */
 
-		if (!displaying_info) {
-			refresh_window(cur_buffer);
-			if (cur_buffer->opt.automatch) automatch_bracket(cur_buffer, true);
+		bool update = true;
+		if (frame_interval > 0 && key_pending()) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			update = (now.tv_sec - last_frame.tv_sec) * 1000 + (now.tv_nsec - last_frame.tv_nsec) / 1000000 >= frame_interval;
 		}
 
-		draw_status_bar();
-		move_cursor(cur_buffer->cur_y, cur_buffer->cur_x);
+		if (update) {
+			/* If we are displaying the "NO WARRANTY" info, we should not refresh the
+				window now */
+
+			if (!displaying_info) {
+				refresh_window(cur_buffer);
+				if (cur_buffer->opt.automatch) automatch_bracket(cur_buffer, true);
+			}
+
+			draw_status_bar();
+			move_cursor(cur_buffer->cur_y, cur_buffer->cur_x);
+			if (frame_interval > 0) clock_gettime(CLOCK_MONOTONIC, &last_frame);
+		}
+		else delay_update();
 
 		int c = get_key_code();
 
@@ -474,7 +508,16 @@ int main(int argc, char **argv) {
 
 		case COMMAND:
 			if (c < 0) c = -c - 1;
-			if (key_binding[c]) print_error(execute_command_line(cur_buffer, key_binding[c]));
+			if (c == NE_KEY_PASTE) {
+				/* A bracketed paste: the text is inserted all at once. */
+				char_stream * const cs = read_paste();
+				if (cs) {
+					print_error(paste_stream_to_buffer(cur_buffer, cs));
+					free_char_stream(cs);
+				}
+				else print_error(OUT_OF_MEMORY);
+			}
+			else if (key_binding[c]) print_error(execute_command_line(cur_buffer, key_binding[c]));
 			break;
 
 		default:
@@ -82,6 +82,21 @@ extern const char *input_class_names[];
 
 #define DEF_PREFS_NAME     ".default"
 
+/* This string is appended to the filename extension to get the name of
+   an autoprefs file. It tries to be enough strange to avoid clashes with
+   macros. */
+
+#define PREF_FILE_SUFFIX   "#ap"
+
+/* The names of the menu configuration and of the key bindings files. */
+
+#define MENU_CONF_NAME     ".menus"
+#define KEY_BINDINGS_NAME  ".keys"
+
+/* The name of the local file caching the startup configuration. */
+
+#define STARTUP_CACHE_NAME ".startup-cache"
+
 /* The name of the syntax subdirectory (global and local). */
 
 #define SYNTAX_DIR         "syntax"
@@ -90,13 +105,25 @@ extern const char *input_class_names[];
 
 #define SYNTAX_EXT         ".jsf"
 
+/* The name of the local subdirectory containing the cache of compiled
+   syntax definitions, and the extension of the cache files. */
+
+#define SYNTAX_CACHE_DIR   ".syntax-cache"
+#define SYNTAX_CACHE_EXT   ".jsc"
+
 /* The name of the file containing the mappings from extensions to syntax names. */
 
 #define EXT_2_SYN          "ext2syn"
 
-/* Files with more than this number of characters will not have syntax highlighting enabled automatically. */
+/* Files with more than this number of characters for each thread used for
+   parsing (see parse_threads()) are highlighted in window mode: no initial
+   state is kept for their lines, and states are computed when lines are
+   displayed, parsing at most WINDOW_SYNTAX_LINES lines or WINDOW_SYNTAX_SIZE
+   characters above them (see line_state()). */
 
 #define MAX_SYNTAX_SIZE		(10000000)
+#define WINDOW_SYNTAX_LINES	(1000)
+#define WINDOW_SYNTAX_SIZE	(1000000)
 
 /* This is the name taken by unnamed documents. */
 
@@ -210,6 +237,21 @@ typedef struct {
 } char_stream;
 
 
+/* These structures are used to write and read the binary cache files in
+   ~/.ne (see syn_cache.c): an output buffer, and an input cursor on a
+   mapped file. Reading beyond the end of the input sets the error flag. */
+
+struct cache_out {
+	unsigned char *p;
+	size_t len, size;
+};
+
+struct cache_in {
+	const unsigned char *p, *end;
+	bool error;
+};
+
+
 #ifndef NDEBUG
 #define assert_char_stream(cs) {if ((cs)) {\
 	assert((cs)->len<=(cs)->size);\
@@ -402,6 +444,47 @@ typedef struct {
 #define assert_undo_buffer(ub) ;
 #endif
 
+/* A match is given by a line, a position and a length (the last two in
+   bytes). */
+
+typedef struct {
+	int64_t line;
+	int64_t pos;
+	int64_t len;
+} match_pos;
+
+
+/* This structure defines a match index, that is, the list of all the
+   occurrences of a pattern in a buffer, as built by FindAll. match points to
+   an array of size match_pos items, used up to count and sorted by line and
+   position. The pattern, its kind, the case sensitivity and the upcasing
+   table in effect when the index was built are recorded, so that lines
+   modified afterwards can be rescanned in the same way; d is the Boyer-Moore
+   skip table for non-regular-expression patterns. cur is the index of the
+   match we last moved to, or -1. */
+
+typedef struct {
+	char *pattern;
+	const unsigned char *up_case;
+	match_pos *match;
+	int64_t size;
+	int64_t count;
+	int64_t cur;
+	unsigned int d[256];
+	bool regexp;
+	bool case_search;
+} match_index;
+
+#ifndef NDEBUG
+#define assert_match_index(mi) {if ((mi)) {\
+	assert((mi)->count <= (mi)->size);\
+	assert((mi)->cur < (mi)->count);\
+	assert((mi)->pattern != NULL);\
+}}
+#else
+#define assert_match_index(mi) ;
+#endif
+
 /* This structure defines all the per document options which can be
    used with PushPrefs and PopPrefs. */
 
@@ -422,6 +505,7 @@ typedef struct {
 		read_only:1,       /* Read-only mode */
 		search_back:1,     /* Last search was backwards */
 		case_search:1,     /* Look at case matching in searches */
+		highlight_matches:1, /* Highlight the visible occurrences of the find string */
 		tabs:1,            /* TAB inserts TABs(1) vs. spaces(0) */
 		del_tabs:1,        /* DEL/BS deletes tab's worth of space. */
 		shift_tabs:1,      /* Shift may insert tabs, but only if tabs is also true */
@@ -463,6 +547,7 @@ typedef struct {
 	char *find_string;
 	char *replace_string;
 	char *command_line;
+	match_index *matches;     /* The match index built by FindAll, or NULL. */
 	unsigned long mtime;      /* mod time of on-disk file when it was last loaded/saved, or 0 */
 	int64_t win_x, win_y;     /* line and pos of upper left-most visible character. */
 	int cur_x, cur_y;         /* position of cursor within the window */
@@ -495,7 +580,9 @@ typedef struct {
 	uint32_t *attr_buf;              /* If attr_len >= 0, a pointer to the list of *current* attributes of the *current* line. */ 
 	int64_t attr_size;              /* attr_buf size. */
 	int64_t attr_len;               /* attr_buf valid number of characters, or -1 to denote that attr_buf is not valid. */
+	int64_t attr_start;             /* If attr_len >= 0, the index of the character whose attributes are in attr_buf[0] (see parse()). */
 	HIGHLIGHT_STATE next_state; /* If attr_len >= 0, the state after the *current* line. */
+	struct line_state_cache *state_cache; /* In window mode, the initial states of recently displayed lines. */
 
 	int link_undos;             /* Link the undo steps. Multilevel. */
 
@@ -515,6 +602,7 @@ typedef struct {
 		atomic_undo:1,           /* subsequent commands undo as a block */
 		executing_macro:1,       /* We are currently executing a macro. */
 		executing_internal_macro:1,  /* We are currently executing the internal macro of the current buffer */
+		window_syntax:1,         /* Line descriptors keep no syntax state (see MAX_SYNTAX_SIZE) */
 		is_CRLF:1;               /* Buffer should be saved with CR/LF terminators */
 
 	options_t opt;              /* These get pushed/popped on the prefs stack */
@@ -536,6 +624,7 @@ typedef struct {
 	assert((b)->cur_line == (b)->win_y + (b)->cur_y);\
 	assert((b)->cur_pos >= (b)->cur_line_desc->line_len || b->encoding != ENC_UTF8 || utf8len((b)->cur_line_desc->line[(b)->cur_pos] > 0));\
 	assert_undo_buffer(&(b)->undo);\
+	assert_match_index((b)->matches);\
 }}
 
 #define assert_buffer_content(b) {if ((b)) {\
@@ -543,10 +632,10 @@ typedef struct {
 	ld = (line_desc *)b->line_desc_list.head;\
 	while(ld->ld_node.next) {\
 		assert_line_desc(ld, (b)->encoding);\
-		if ((b)->syn) assert(ld->highlight_state.state != -1);\
+		if ((b)->syn && !(b)->window_syntax) assert(ld->highlight_state.state != -1);\
 		ld = (line_desc *)ld->ld_node.next;\
 	}\
-	if ((b)->syn) assert(b->attr_len < 0 || b->attr_len == calc_char_len(b->cur_line_desc, b->encoding));\
+	if ((b)->syn) assert(b->attr_len < 0 || b->attr_start + b->attr_len <= calc_char_len(b->cur_line_desc, b->encoding));\
 }}
 #else
 #define assert_buffer(b) ;
@@ -567,6 +656,17 @@ extern list buffers, clips, macros;
 
 extern int turbo;
 
+/* The maximum interval, in milliseconds, between screen updates when
+   keystrokes are waiting to be processed (0 means update after each
+   keystroke). */
+
+extern int frame_interval;
+
+
+/* The number of lines parsed by the syntax highlighter. */
+
+extern uint64_t lines_parsed;
+
 
 /* If true, the current line has changed and care must be taken
    to update the initial state of the following lines. */
@@ -604,6 +704,12 @@ extern bool verbose_macros;
 extern bool do_syntax;
 
 
+/* If true, the time spent in each startup phase is printed at exit
+   (see startup.c). */
+
+extern bool startup_profile;
+
+
 /* This flag can be set anywhere to false, and will become true if the user
    hits the interrupt key (usually CTRL-'\'). It is handled through SIGQUIT and
    SIGINT. */
@@ -26,11 +26,6 @@
 
 #define PREFS_DIR ".ne"
 
-/* This string is appended to the filename extension. It tries to
-be enough strange to avoid clashes with macros. */
-
-#define PREF_FILE_SUFFIX	"#ap"
-
 /* This string is appended to the filename extension. */
 
 #define SYNTAX_FILE_SUFFIX ".jsf"
@@ -166,6 +161,7 @@ int save_prefs(buffer * const b, const char * const name) {
 	   /* Skip read_only */
 	   /* Skip search_back */
 		record_action(cs, CASESEARCH_A,       b->opt.case_search,    NULL, verbose_macros);
+		record_action(cs, HIGHLIGHTMATCHES_A, b->opt.highlight_matches, NULL, verbose_macros);
 		record_action(cs, TABS_A,             b->opt.tabs,           NULL, verbose_macros);
 		record_action(cs, DELTABS_A,          b->opt.del_tabs,       NULL, verbose_macros);
 		record_action(cs, SHIFTTABS_A,        b->opt.shift_tabs,     NULL, verbose_macros);
@@ -206,16 +202,26 @@ int load_prefs(buffer * const b, const char * const name) {
 
 	assert_buffer(b);
 
-	b->exec_only_options = 1;
-
 	int error = OK;
 	char_stream * const cs = load_stream(NULL, name, false, false);
 	if (cs) {
-		error = play_macro(b, cs);
+		error = play_prefs(b, cs);
 		free_char_stream(cs);
 	}
 	else error = ERROR;
 
+	return error;
+}
+
+
+/* Plays a stream of preferences, with the exec_only_options flag set. This
+   is used directly by the startup cache (see startup.c). */
+
+int play_prefs(buffer * const b, char_stream * const cs) {
+	assert_buffer(b);
+
+	b->exec_only_options = 1;
+	const int error = play_macro(b, cs);
 	b->exec_only_options = 0;
 
 	return error;
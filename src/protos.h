@@ -32,7 +32,7 @@ encoding_type detect_buffer_encoding(const buffer *b);
 char_pool *alloc_char_pool(int64_t size);
 void free_char_pool(char_pool *cp);
 char_pool *get_char_pool(buffer *b, char * const p);
-line_desc_pool *alloc_line_desc_pool(int64_t pool_size);
+line_desc_pool *alloc_line_desc_pool(int64_t pool_size, const bool states);
 void free_line_desc_pool(line_desc_pool *ldp);
 buffer *alloc_buffer(const buffer *cur_b);
 void free_buffer_contents(buffer *b);
@@ -74,6 +74,7 @@ clip_desc *get_nth_clip(int n);
 int copy_to_clip(buffer *b, int n, bool cut);
 int erase_block(buffer *b);
 int paste_to_buffer(buffer *b, int n);
+int paste_stream_to_buffer(buffer *b, const char_stream *cs);
 int copy_vert_to_clip(buffer *b, int n, bool cut);
 int erase_vert_block(buffer *b);
 int paste_vert_to_buffer(buffer *b, int n);
@@ -101,8 +102,8 @@ void optimize_macro(char_stream *cs, bool verbose);
 void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld);
 int highlight_cmp(HIGHLIGHT_STATE *x, HIGHLIGHT_STATE *y);
 void delay_update();
-void output_line_desc(int row, int col, line_desc *ld, int64_t start, int64_t len, int tab_size, bool cleared_at_end, bool utf8, const uint32_t * const attr, const uint32_t * const diff, const int64_t diff_size);
-line_desc *update_partial_line(buffer *b, int n, int64_t start_x, bool cleared_at_end, const bool differential);
+void output_line_desc(int row, int col, line_desc *ld, int64_t start, int64_t len, int tab_size, bool cleared_at_end, bool utf8, const uint32_t * const attr, const int64_t attr_start, const uint32_t * const diff, const int64_t diff_size);
+line_desc *update_partial_line(buffer *b, int n, int64_t start_x, bool cleared_at_end, bool differential);
 void update_line(buffer *b, int n, const bool cleared_at_end, const bool differential);
 void update_window_lines(buffer *b, int start_line, int end_line, bool doit);
 void update_syntax_and_lines(buffer *b, line_desc *start_ld, line_desc *end_ld);
@@ -114,13 +115,23 @@ void reset_window(void);
 void refresh_window(buffer *b);
 void scroll_window(buffer *b, int line, int n);
 HIGHLIGHT_STATE freeze_attributes(buffer *b, line_desc *ld);
+HIGHLIGHT_STATE parse_visible(buffer *b, line_desc *ld);
+HIGHLIGHT_STATE line_state(buffer *b, line_desc *ld);
+void set_line_state(buffer *b, line_desc *ld, HIGHLIGHT_STATE state);
+HIGHLIGHT_STATE *cached_line_state(const buffer *b, const line_desc *ld);
+void forget_line_state(buffer *b, const line_desc *ld);
+void clear_line_states(buffer *b);
+void free_line_states(buffer *b);
 void automatch_bracket(buffer * const b, const bool show);
+void invalidate_line_matches(const line_desc *ld);
+void invalidate_line_brackets(const line_desc *ld);
 
 /* edit.c */
 int to_upper(buffer *b);
 int to_lower(buffer *b);
 int capitalize(buffer *b);
 int match_bracket(buffer *b);
+int bracket_kind(const int c);
 int find_matching_bracket(buffer *b, const int64_t min_line, const int64_t max_line, int64_t *match_line, int64_t *match_pos, int *c, line_desc ** ld);
 int word_wrap(buffer *b);
 int paragraph(buffer *b);
@@ -151,7 +162,11 @@ const char *ext2syntax(const char * const ext);
 void read_key_capabilities(void);
 void set_escape_time(int new_escape_time);
 int get_key_code(void);
+bool key_pending(void);
+char_stream *read_paste(void);
 int key_may_set(const char * const cap_string, int code);
+int get_key_capability(const int i, const char ** const cap_string);
+bool add_key_capability(const char * const cap_string, const int code);
 
 /* menu.c */
 void print_message(const char *message);
@@ -166,6 +181,8 @@ void alert(void);
 void handle_menus(void);
 void get_menu_configuration(const char *);
 void get_key_bindings(const char *);
+void save_menu_configuration(struct cache_out * const o);
+bool load_menu_configuration(struct cache_in * const in);
 
 /* names.c */
 
@@ -210,6 +227,7 @@ char *exists_prefs_dir(void);
 char *exists_gprefs_dir(void);
 int   save_prefs(buffer *b, const char *name);
 int   load_prefs(buffer *b, const char *name);
+int   play_prefs(buffer *b, char_stream *cs);
 int   load_syntax_by_name(buffer *b, const char *name);
 int   load_auto_prefs(buffer *b, const char *name);
 int   save_auto_prefs(buffer *b, const char *name);
@@ -222,7 +240,7 @@ bool  request_response(const buffer *b, const char *prompt, bool default_value);
 char  request_char(const buffer *b, const char *prompt, const char default_value);
 int64_t request_number(const char *prompt, int64_t default_value);
 char *request_string(const char *prompt, const char *default_string, bool accept_null_string, int completion_type, bool prefer_utf8);
-char *request(const char *prompt, const char *default_string, bool alpha_allowed, int completion_type, bool prefer_utf8);
+char *request(const char *prompt, const char *default_string, bool alpha_allowed, int completion_type, bool prefer_utf8, void (*update)(const char *));
 
 /* request.c */
 int   request_strings(req_list * const rl, int default_entry);
@@ -242,7 +260,15 @@ void  req_list_finalize(req_list * const rl);
 int  find(buffer *b, const char *pattern, const bool skip_first);
 int  replace(buffer *b, int n, const char *string);
 int  find_regexp(buffer *b, const char *regex, const bool skip_first);
+int  find_any(buffer *b, const char *patterns);
 int  replace_regexp(buffer *b, const char *string);
+void free_match_index(buffer *b);
+int  build_match_index(buffer *b);
+void update_match_index(buffer *b, const line_desc *ld, int64_t line, int64_t old_lines, int64_t new_lines);
+int  goto_match(buffer *b, const bool next);
+bool set_highlight_pattern(const buffer *b);
+int64_t find_line_matches(const buffer *b, const line_desc *ld, int64_t from, int64_t to, match_pos **m);
+int  incremental_find(buffer *b);
 
 /* signals.c */
 void stop_ne(void);
@@ -268,6 +294,18 @@ int save_stream_to_fh(const char_stream *cs, int fh, bool CRLF, bool binary);
 int delete_from_stream(char_stream *cs, int64_t p, int64_t len);
 int insert_in_stream(char_stream *cs, const char *s, int64_t p, int64_t len);
 
+/* startup.c */
+void get_configuration(const char * const menu_conf_name, const char * const key_bindings_name, const char * const prefs_name);
+int load_default_prefs(buffer * const b, const char * const prefs_name);
+void startup_phase(const char * const name);
+void print_startup_profile(void);
+
+/* stats.c */
+void stats_key(void);
+void stats_frame(void);
+void stats_message(char *msg, size_t size);
+int save_stats(const char *name);
+
 /* support.c */
 bool same_str(const char *p, const char *q);
 char *ne_getcwd(const int bufsize);
@@ -286,10 +324,13 @@ int filenamecmpp(const void *a, const void *b);
 int filenamecmp(const char *a, const char *b);
 void set_interactive_mode(void);
 void unset_interactive_mode(void);
+void invalidate_column_index(const line_desc *ld, int64_t pos);
+int64_t find_column_checkpoint(const line_desc *ld, int64_t col, int tab_size, encoding_type encoding, int64_t *width, int64_t *chars);
 int64_t calc_width(const line_desc *ld, int64_t n, int tab_size, encoding_type encoding);
 int64_t calc_width_hint(const line_desc * const ld, const int64_t n, const int tab_size, const encoding_type encoding, const int64_t cur_pos, const int64_t cur_width);
 int64_t calc_char_len(const line_desc *ld, encoding_type encoding);
 int64_t calc_pos(const line_desc *ld, int64_t n, int tab_size, encoding_type encoding);
+int64_t calc_char_index(const line_desc *ld, int64_t pos, int tab_size, encoding_type encoding);
 int get_string_width(const char * const s, const int64_t len, const encoding_type encoding);
 int max_prefix(const char *s, const char *t);
 bool is_prefix(const char *p, const char *s);
@@ -314,6 +355,22 @@ int context_prefix(const buffer *b, char **p, int64_t *prefix_pos);
 line_desc *nth_line_desc(const buffer *b, const int64_t n);
 const char *cur_bookmarks_string(const buffer *b);
 
+/* syn_cache.c */
+uint64_t cache_fnv(const unsigned char * const p, const size_t len);
+unsigned char *cache_map_file(const char * const name, size_t * const len, struct stat * const st);
+void cache_put(struct cache_out * const o, const void * const v, const size_t len);
+void cache_put_u32(struct cache_out * const o, const uint32_t v);
+void cache_put_u64(struct cache_out * const o, const uint64_t v);
+void cache_put_str(struct cache_out * const o, const unsigned char * const s);
+uint32_t cache_get_u32(struct cache_in * const i);
+uint64_t cache_get_u64(struct cache_in * const i);
+unsigned char *cache_get_str(struct cache_in * const i);
+int cache_write(const char * const name, const char * const magic, const uint32_t version, const struct cache_out * const o);
+unsigned char *cache_map(const char * const name, const char * const magic, const uint32_t version, struct cache_in * const in, size_t * const len);
+
+/* syn_prof.c */
+int syntax_stats(buffer *b, const char *name, char *msg, size_t size);
+
 /* undo.c */
 void start_undo_chain(buffer *b);
 void end_undo_chain(buffer *b);
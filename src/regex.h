@@ -564,6 +564,13 @@ extern regoff_t re_search (struct re_pattern_buffer *__buffer,
 			   __re_idx_t __start, regoff_t __range,
 			   struct re_registers *__regs);
 
+/* ne: like re_search with REGS null, but stops matching at the first
+   accepting state, so the cost of a call does not depend on the length
+   of the match.  */
+extern regoff_t re_search_first (struct re_pattern_buffer *__buffer,
+				 const char *__string, __re_idx_t __length,
+				 __re_idx_t __start, regoff_t __range);
+
 
 /* Like 're_search', but search in the concatenation of STRING1 and
    STRING2.  Also, stop searching at index START + STOP.  */
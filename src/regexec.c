@@ -250,7 +250,7 @@ regexec (preg, string, nmatch, pmatch, eflags)
 			      length, 0, NULL, eflags);
   else
     err = re_search_internal (preg, string, length, start, length,
-			      length, nmatch, pmatch, eflags);
+			      length, nmatch, nmatch ? pmatch : NULL, eflags);
   lock_unlock (dfa->lock);
   return err != REG_NOERROR;
 }
@@ -332,6 +332,45 @@ re_search (bufp, string, length, start, range, regs)
 weak_alias (__re_search, re_search)
 #endif
 
+/* ne: like re_search() with REGS null, but the matcher stops at the first
+   accepting state rather than looking for the longest match, as only the
+   starting position of the match is returned.  */
+
+regoff_t
+re_search_first (struct re_pattern_buffer *bufp, const char *string,
+		 Idx length, Idx start, regoff_t range)
+{
+  reg_errcode_t result;
+  regmatch_t pmatch[1];
+  int eflags = 0;
+  re_dfa_t *dfa = bufp->buffer;
+  Idx last_start = start + range;
+
+  if (BE (start < 0 || start > length, 0))
+    return -1;
+  if (BE (length < last_start || (0 <= range && last_start < start), 0))
+    last_start = length;
+  else if (BE (last_start < 0 || (range < 0 && start <= last_start), 0))
+    last_start = 0;
+
+  lock_lock (dfa->lock);
+
+  eflags |= (bufp->not_bol) ? REG_NOTBOL : 0;
+  eflags |= (bufp->not_eol) ? REG_NOTEOL : 0;
+
+  if (start < last_start && bufp->fastmap != NULL && !bufp->fastmap_accurate)
+    re_compile_fastmap (bufp);
+
+  result = re_search_internal (bufp, string, length, start, last_start,
+			       length, 0, pmatch, eflags);
+
+  lock_unlock (dfa->lock);
+
+  if (result != REG_NOERROR)
+    return result == REG_NOMATCH ? -1 : -2;
+  return pmatch[0].rm_so;
+}
+
 regoff_t
 re_match_2 (bufp, string1, length1, string2, length2, start, regs, stop)
     struct re_pattern_buffer *bufp;
@@ -954,6 +993,10 @@ re_search_internal (const regex_t *preg,
 		= pmatch[dfa->subexp_map[reg_idx] + 1].rm_eo;
 	    }
     }
+  else if (pmatch != NULL)
+    /* ne: no registers were requested (see re_search_first()), but we
+       report where the match starts.  */
+    pmatch[0].rm_so = match_first;
 
  free_return:
   re_free (mctx.state_log);
@@ -21,20 +21,18 @@
 
 #include "ne.h"
 #include "regex.h"
+#include <time.h>
 
 
-/* This is the initial allocation size for regex.library. */
-
-#define START_BUFFER_SIZE 4096
-
 /* A boolean recording whether the last replace was for an empty string 
    (of course, this can happen only with regular expressions). */
 
 bool last_replace_empty_match;
 
-/* This array is used both by the Boyer-Moore algorithm and by the regex
-library. It is updated if b->find_string_changed is true (it should always
-be the first time the string is searched for). */
+/* This array is used by the Boyer-Moore algorithm. It is updated if
+b->find_string_changed is true (it should always be the first time the string
+is searched for). Compiled regular expressions have their own fastmaps (see
+regex_cache_entry). */
 
 static unsigned int d[256];
 
@@ -220,10 +218,9 @@ int replace(buffer * const b, const int n, const char * const string) {
 
 
 
-/* The following variables are used by regex. In particular, re_reg holds
-the stard/end of the extended replacement registers. */
+/* re_reg holds the start/end of the extended replacement registers. It is
+shared by all compiled regular expressions. */
 
-static struct re_pattern_buffer re_pb;
 static struct re_registers re_reg;
 
 /* This string is used to replace the dot in UTF-8 searches. It will match only
@@ -244,162 +241,260 @@ static struct re_registers re_reg;
 
 #define UTF8NONWORD "([\x01-\x1E\x20-\x2F\x3A-\x40\x5B-\x60\x7B-\x7F]|[\xC0-\xFF][\x80-\xBF]+)"
 
-/* In UTF-8 text, the numbering of a parenthesised group may differ from the
+/* The number of compiled regular expressions kept in the cache. */
+
+#define REGEX_CACHE_SIZE 8
+
+/* A compiled regular expression. The key is given by the source pattern, by
+   the translation table (which encodes case sensitivity and the localised
+   upper casing) and by whether the pattern was rewritten for UTF-8 text. Each
+   entry owns its fastmap.
+
+   In UTF-8 text, the numbering of a parenthesised group may differ from the
    "official" one, due to the usage of parenthesis in UTF8DOT, UT8COMP and
-   UTF8NONWORD. This array records for each user-invoked group the
+   UTF8NONWORD. map_group records for each user-invoked group the
    corresponding (usually larger) regex group. The group may be larger than
    RE_NREGS, in which case there is no way to recover it. */
 
-static int map_group[RE_NREGS];
+typedef struct {
+	char *regex;
+	const unsigned char *translate;
+	bool utf8;
+	struct re_pattern_buffer re_pb;
+	char fastmap[256];
+	int map_group[RE_NREGS];
+} regex_cache_entry;
 
-/* Works exactly like find(), but uses the regex library instead. */
+/* The cache of compiled regular expressions, in LRU order (the most recently
+   used entry comes first). Unused entries are NULL. */
 
-int find_regexp(buffer * const b, const char *regex, const bool skip_first) {
+static regex_cache_entry *regex_cache[REGEX_CACHE_SIZE];
 
-	const unsigned char * const up_case = b->encoding == ENC_UTF8 ? ascii_up_case : localised_up_case;
-	bool recompile_string;
+/* The entry used by the last call to find_regexp(). replace_regexp() needs it
+   to remap groups in UTF-8 text. */
 
-	if (!regex) {
-		regex = b->find_string;
-		recompile_string = b->find_string_changed || !b->last_was_regexp;
-	}
-	else recompile_string = true;
+static regex_cache_entry *cur_regex;
 
-	if (!regex || !strlen(regex)) return ERROR;
 
-	if (re_pb.buffer == NULL) {
-		if (re_pb.buffer = malloc(START_BUFFER_SIZE)) re_pb.allocated = START_BUFFER_SIZE;
-		else return OUT_OF_MEMORY;
-	}
+/* Frees a cache entry. The translation table is static and the fastmap is
+   embedded in the entry, so we must hide them from regfree(). */
 
-	re_pb.fastmap = (void *)d;
+static void free_regex_cache_entry(regex_cache_entry * const e) {
+	if (!e) return;
+	e->re_pb.translate = NULL;
+	e->re_pb.fastmap = NULL;
+	regfree(&e->re_pb);
+	free(e->regex);
+	free(e);
+}
 
-	/* We have to be careful: even if the search string has not changed, it
-	is possible that case sensitivity has. In this case, we force recompilation. */
 
-	if (b->opt.case_search) {
-		if (re_pb.translate != 0) recompile_string = true;
-		re_pb.translate = 0;
-	}
-	else {
-		if (re_pb.translate != up_case) recompile_string = true;
-		re_pb.translate = (unsigned char *)up_case;
-	}
+/* Compiles regex into e->re_pb, using e->translate and e->utf8. Returns an
+   error code; regex errors are printed directly. */
 
-	if (recompile_string) {
-		const char *actual_regex = regex;
+static int compile_regexp(regex_cache_entry * const e, const char * const regex) {
 
-		/* If the buffer encoding is UTF-8, we need to replace dots with UTF8DOT,
-			non-word-constituents (\W) with UTF8NONWORD, and embed complemented
-			character classes in UTF8COMP, so that they do not match UTF-8
-			subsequences. Moreover, we must compute the remapping from the virtual
-			to the actual groups caused by the new groups thus introduced. */
+	const char *actual_regex = regex;
 
-		if (b->encoding == ENC_UTF8) {
-			const char *s;
-			char *q;
-			bool escape = false;
-			int virtual_group = 0, real_group = 0, dots = 0, comps = 0, nonwords = 0;
+	/* If the buffer encoding is UTF-8, we need to replace dots with UTF8DOT,
+		non-word-constituents (\W) with UTF8NONWORD, and embed complemented
+		character classes in UTF8COMP, so that they do not match UTF-8
+		subsequences. Moreover, we must compute the remapping from the virtual
+		to the actual groups caused by the new groups thus introduced. */
 
-			s = regex;
+	if (e->utf8) {
+		const char *s;
+		char *q;
+		bool escape = false;
+		int virtual_group = 0, real_group = 0, dots = 0, comps = 0, nonwords = 0;
 
-			/* We first scan regex to compute the exact number of characters of
-				the actual (i.e., after substitutions) regex. */
+		s = regex;
 
-			do {
-				if (!escape) {
-					if (*s == '.') dots++;
-					else if (*s == '[') {
-						if (*(s+1) == '^') {
-							comps++;
-							s++;
-						}
+		/* We first scan regex to compute the exact number of characters of
+			the actual (i.e., after substitutions) regex. */
 
-						if (*(s+1) == ']') s++; /* A literal ]. */
-
-						/* We scan the list up to ] and check that no non-US-ASCII characters appear. */
-						do if (utf8len(*(++s)) != 1) return UTF8_REGEXP_CHARACTER_CLASS_NOT_SUPPORTED; while(*s && *s != ']');
-					}
-					else if (*s == '\\') {
-						escape = true;
-						continue;
+		do {
+			if (!escape) {
+				if (*s == '.') dots++;
+				else if (*s == '[') {
+					if (*(s+1) == '^') {
+						comps++;
+						s++;
 					}
-				}
-				else if (*s == 'W') nonwords++;
-				escape = false;
-			} while(*(++s));
 
-			actual_regex = q = malloc(strlen(regex) + 1 + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
-			if (!actual_regex) return OUT_OF_MEMORY;
-			s = regex;
-			escape = false;
+					if (*(s+1) == ']') s++; /* A literal ]. */
 
-			do {
-				if (escape || *s != '.' && *s != '(' && *s != '[' && *s != '\\') {
-					if (escape && *s == 'W') {
-						q--;
-						strcpy(q, UTF8NONWORD);
-						q += strlen(UTF8NONWORD);
-						real_group++;
-					}
-					else *(q++) = *s;
+					/* We scan the list up to ] and check that no non-US-ASCII characters appear. */
+					do if (utf8len(*(++s)) != 1) return UTF8_REGEXP_CHARACTER_CLASS_NOT_SUPPORTED; while(*s && *s != ']');
+				}
+				else if (*s == '\\') {
+					escape = true;
+					continue;
+				}
+			}
+			else if (*s == 'W') nonwords++;
+			escape = false;
+		} while(*(++s));
+
+		actual_regex = q = malloc(strlen(regex) + 1 + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
+		if (!actual_regex) return OUT_OF_MEMORY;
+		s = regex;
+		escape = false;
+
+		do {
+			if (escape || *s != '.' && *s != '(' && *s != '[' && *s != '\\') {
+				if (escape && *s == 'W') {
+					q--;
+					strcpy(q, UTF8NONWORD);
+					q += strlen(UTF8NONWORD);
+					real_group++;
+				}
+				else *(q++) = *s;
+			}
+			else {
+				if (*s == '\\') {
+					escape = true;
+					*(q++) = '\\';
+					continue;
 				}
-				else {
-					if (*s == '\\') {
-						escape = true;
-						*(q++) = '\\';
-						continue;
-					}
 
-					if (*s == '.') {
-						strcpy(q, UTF8DOT);
-						q += strlen(UTF8DOT);
+				if (*s == '.') {
+					strcpy(q, UTF8DOT);
+					q += strlen(UTF8DOT);
+					real_group++;
+				}
+				else if (*s == '(') {
+					*(q++) = '(';
+					if (virtual_group < RE_NREGS - 1) e->map_group[++virtual_group] = ++real_group;
+				}
+				else if (*s == '[') {
+					if (*(s+1) == '^') {
+						strcpy(q, UTF8COMP);
+						q += strlen(UTF8COMP);
+						s++;
+						if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
+						do	*(q++) = *(++s); while (*s && *s != ']');
+						if (*s) *(q++) = ')';
 						real_group++;
 					}
-					else if (*s == '(') {
-						*(q++) = '(';
-						if (virtual_group < RE_NREGS - 1) map_group[++virtual_group] = ++real_group;
-					}
-					else if (*s == '[') {
-						if (*(s+1) == '^') {
-							strcpy(q, UTF8COMP);
-							q += strlen(UTF8COMP);
-							s++;
-							if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
-							do	*(q++) = *(++s); while (*s && *s != ']');
-							if (*s) *(q++) = ')';
-							real_group++;
-						}
-						else {
-							*(q++) = '[';
-							if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
-							do	*(q++) = *(++s); while (*s && *s != ']');
-						}
+					else {
+						*(q++) = '[';
+						if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
+						do	*(q++) = *(++s); while (*s && *s != ']');
 					}
 				}
+			}
 
-				escape = false;
-			} while(*(s++));
+			escape = false;
+		} while(*(s++));
 
-			/* This assert may be false if a [ is not closed. */
-			assert(strlen(actual_regex) == strlen(regex) + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
-		}
+		/* This assert may be false if a [ is not closed. */
+		assert(strlen(actual_regex) == strlen(regex) + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
+	}
 
-		const char * p = re_compile_pattern(actual_regex, strlen(actual_regex), &re_pb);
+	e->re_pb.translate = (unsigned char *)e->translate;
+	e->re_pb.fastmap = e->fastmap;
 
-		if (b->encoding == ENC_UTF8) free((void*)actual_regex);
+	const char * p = re_compile_pattern(actual_regex, strlen(actual_regex), &e->re_pb);
 
-		if (p) {
-			/* Here we have a very dirty hack: since we cannot return the error of
-				regex, we print it here. Which means that we access term.c's
-				functions. 8^( */
-			print_message(p);
-			alert();
-			return ERROR;
+	if (e->utf8) free((void*)actual_regex);
+
+	if (p) {
+		/* Here we have a very dirty hack: since we cannot return the error of
+			regex, we print it here. Which means that we access term.c's
+			functions. 8^( */
+		print_message(p);
+		alert();
+		return ERROR;
+	}
+
+	return OK;
+}
+
+
+/* Returns (in *e) a compiled version of regex with the given case
+   sensitivity and encoding, compiling it only if it is not already in the
+   cache. The entry is moved to the front of the cache; if the cache is full,
+   the least recently used entry is evicted. */
+
+static int get_regexp(const char * const regex, const bool case_search, const bool utf8, regex_cache_entry ** const e) {
+
+	const unsigned char * const translate = case_search ? NULL : utf8 ? ascii_up_case : localised_up_case;
+	int i;
+
+	for(i = 0; i < REGEX_CACHE_SIZE && regex_cache[i]; i++)
+		if (regex_cache[i]->translate == translate && regex_cache[i]->utf8 == utf8 && !strcmp(regex_cache[i]->regex, regex)) break;
+
+	if (i == REGEX_CACHE_SIZE || !regex_cache[i]) {
+		regex_cache_entry * const n = calloc(1, sizeof *n);
+		if (!n || !(n->regex = str_dup(regex))) {
+			free(n);
+			return OUT_OF_MEMORY;
+		}
+		n->translate = translate;
+		n->utf8 = utf8;
+
+		const int error = compile_regexp(n, regex);
+		if (error) {
+			free_regex_cache_entry(n);
+			return error;
 		}
 
+		if (i == REGEX_CACHE_SIZE) free_regex_cache_entry(regex_cache[--i]);
+		regex_cache[i] = n;
 	}
 
+	*e = regex_cache[i];
+	memmove(regex_cache + 1, regex_cache, i * sizeof *regex_cache);
+	regex_cache[0] = *e;
+	return OK;
+}
+
+
+/* Returns the last position not greater than start at which the given
+   compiled regular expression matches in the given line, or -1 if there is no
+   such position; re_reg is set to the match found. Rather than calling
+   re_search() with a negative range, which tries every starting position
+   from start down to the beginning of the line and is thus quadratic on long
+   lines, we search forward from the beginning of the line, restarting after
+   each match found. The probes use re_search_first(), which stops at the
+   first accepting state, so a probe costs about as much as scanning (using
+   the fastmap) to the next starting position and recognising the shortest
+   match there; only patterns whose shortest match is long and overlaps many
+   starting positions (e.g., "a.*b") still require more. The full match, and
+   the registers, are computed only for the last starting position. */
+
+static int64_t re_search_back(struct re_pattern_buffer * const re_pb, const line_desc * const ld, const int64_t start) {
+	const char * const line = ld->line ? ld->line : "";
+	int64_t last = -1, pos;
+
+	for(int64_t p = 0; p <= start && (pos = re_search_first(re_pb, line, ld->line_len, p, start - p)) >= 0; p = pos + 1) last = pos;
+
+	if (last >= 0) re_search(re_pb, line, ld->line_len, last, 0, &re_reg);
+	return last;
+}
+
+
+/* Works exactly like find(), but uses the regex library instead. */
+
+int find_regexp(buffer * const b, const char *regex, const bool skip_first) {
+
+	if (!regex) regex = b->find_string;
+	if (!regex || !strlen(regex)) return ERROR;
+
+	/* The compiled pattern is looked up in the cache, keyed by pattern, case
+		sensitivity and encoding, so b->find_string_changed is irrelevant here. */
+
+	const int error = get_regexp(regex, b->opt.case_search, b->encoding == ENC_UTF8, &cur_regex);
+	if (error) return error;
+
+	struct re_pattern_buffer * const re_pb = &cur_regex->re_pb;
+
+	/* re_reg is shared by all entries: once allocated, it must be reallocated,
+		not allocated anew. */
+
+	re_pb->regs_allocated = re_reg.num_regs ? REGS_REALLOCATE : REGS_UNALLOCATED;
+
 	b->find_string_changed = 0;
 
 	line_desc *ld = b->cur_line_desc;
@@ -415,7 +510,7 @@ int find_regexp(buffer * const b, const char *regex, const bool skip_first) {
 
 			int64_t pos;
 			if (start_pos <= ld->line_len &&
-				 (pos = re_search(&re_pb, ld->line ? ld->line : "", ld->line_len, start_pos, ld->line_len - start_pos, &re_reg)) >= 0) {
+				 (pos = re_search(re_pb, ld->line ? ld->line : "", ld->line_len, start_pos, ld->line_len - start_pos, &re_reg)) >= 0) {
 				goto_line(b, y);
 				goto_pos(b, pos);
 				return OK;
@@ -435,8 +530,7 @@ int find_regexp(buffer * const b, const char *regex, const bool skip_first) {
 			assert(ld->ld_node.prev != NULL);
 
 			int64_t pos;
-			if (start_pos >= 0 &&
-				 (pos = re_search(&re_pb, ld->line ? ld->line : "", ld->line_len, start_pos, -start_pos - 1, &re_reg)) >= 0) {
+			if (start_pos >= 0 && (pos = re_search_back(re_pb, ld, min(start_pos, ld->line_len))) >= 0) {
 				goto_line(b, y);
 				goto_pos(b, pos);
 				return OK;
@@ -482,7 +576,7 @@ int replace_regexp(buffer * const b, const char * const string) {
 				if (b->encoding == ENC_UTF8) {
 					/* In the UTF-8 case, the replacement group index must be
 						mapped through map_group to recover the real group. */
-					if ((i = map_group[i]) >= RE_NREGS) {
+					if ((i = cur_regex->map_group[i]) >= RE_NREGS) {
 						free(p);
 						return GROUP_NOT_AVAILABLE;
 					}
@@ -559,3 +653,852 @@ int replace_regexp(buffer * const b, const char * const string) {
 	last_replace_empty_match = re_reg.start[0] == re_reg.end[0];
 	return OK;
 }
+
+
+
+/* The following functions implement FindAny, which searches for the first
+   occurrence of any of a list of literal patterns using an Aho-Corasick
+   automaton. Characters are grouped into classes: each character appearing
+   in some pattern has its own class, and all other characters share class 0.
+   The automaton is stored as a complete transition table (one entry per state
+   and class), so that every character of the text costs two lookups,
+   independently of the number of patterns. Since the number of states is
+   bounded by the length of the pattern list, the table is limited to
+   ANY_MAX_ENTRIES entries, and longer lists are rejected. Characters are translated
+   through up_case[] before building and searching when the search is not case
+   sensitive. The last automaton built is kept, together with the (translated)
+   pattern list, the case sensitivity and the translation table used to build
+   it, and it is rebuilt only if one of them changes. */
+
+typedef struct {
+	char *patterns;           /* The translated, NUL-separated pattern list. */
+	int64_t patterns_len;     /* The length of patterns. */
+	int32_t *delta;           /* The transition table (num_states x nclasses entries). */
+	int32_t *term;            /* For each state, the length of the pattern it recognises, or 0. */
+	int32_t *dict;            /* For each state, the nearest proper suffix state with nonzero term, or 0. */
+	int num_states;
+	int nclasses;             /* The number of character classes. */
+	unsigned char cls[256];   /* The class of each (translated) character. */
+	int max_len;              /* The length of the longest pattern. */
+	int num_first;            /* The number of distinct characters in first[]. */
+	unsigned char first_char; /* If num_first is 1, the only character in first[]. */
+	bool first[256];          /* The characters starting some pattern. */
+	bool case_search;
+	const unsigned char *up_case;
+} any_automaton;
+
+#define ANY_MAX_ENTRIES (1 << 24)
+
+static any_automaton any;
+
+/* The position of the last FindAny match, so that invoking FindAny again
+   moves to the next match. */
+
+static const buffer *any_b;
+static int64_t any_line, any_pos;
+
+
+/* Splits the given pattern list and translates it into a sequence of
+   NUL-terminated patterns, putting the result in *p and its length in *len.
+   If clip is true, pattern is a clip stream of length stream_len, and patterns
+   are its lines; otherwise, they are separated by spaces or tabs. Empty
+   patterns are discarded. */
+
+static int translate_patterns(const char * const pattern, const int64_t stream_len, const bool clip, const bool sense_case, const unsigned char * const up_case, char ** const p, int64_t * const len) {
+	char * const t = malloc(stream_len + 1);
+	if (!t) return OUT_OF_MEMORY;
+
+	int64_t n = 0;
+	for(int64_t i = 0; i < stream_len; i++) {
+		const unsigned char c = pattern[i];
+		if (c == 0 || !clip && (c == ' ' || c == '\t')) {
+			if (n > 0 && t[n - 1]) t[n++] = 0;
+		}
+		else t[n++] = CONV(c);
+	}
+	if (n > 0 && t[n - 1]) t[n++] = 0;
+
+	if (n == 0) {
+		free(t);
+		return STRING_IS_EMPTY;
+	}
+
+	*p = t;
+	*len = n;
+	return OK;
+}
+
+
+static void free_any_automaton(void) {
+	free(any.patterns);
+	free(any.delta);
+	free(any.term);
+	free(any.dict);
+	any.patterns = NULL;
+	any.delta = any.term = any.dict = NULL;
+}
+
+
+/* Builds the automaton for the given translated pattern list, which is
+   consumed. The trie is built first, with 0 marking missing transitions (the
+   initial state is never a target); then a breadth-first visit computes the
+   failure links, fills in the missing transitions and sets up the dictionary
+   links. */
+
+static int build_any_automaton(char * const patterns, const int64_t patterns_len, const bool case_search, const unsigned char * const up_case) {
+	free_any_automaton();
+
+	memset(any.cls, 0, sizeof any.cls);
+	int nclasses = 1;
+	for(int64_t i = 0; i < patterns_len; i++)
+		if (patterns[i] && !any.cls[(unsigned char)patterns[i]]) any.cls[(unsigned char)patterns[i]] = nclasses++;
+
+	/* Each pattern is followed by a NUL, so patterns_len bounds the number of
+		non-initial states. */
+
+	const int64_t max_states = patterns_len + 1;
+	if (max_states > ANY_MAX_ENTRIES / nclasses) {
+		free(patterns);
+		return PATTERN_LIST_TOO_LARGE;
+	}
+
+	int32_t * const fail = malloc(max_states * sizeof *fail);
+	int32_t * const queue = malloc(max_states * sizeof *queue);
+	any.delta = calloc(max_states * nclasses, sizeof *any.delta);
+	any.term = calloc(max_states, sizeof *any.term);
+	any.dict = calloc(max_states, sizeof *any.dict);
+
+	if (!fail || !queue || !any.delta || !any.term || !any.dict) {
+		free(fail);
+		free(queue);
+		free(patterns);
+		free_any_automaton();
+		return OUT_OF_MEMORY;
+	}
+
+	any.patterns = patterns;
+	any.patterns_len = patterns_len;
+	any.case_search = case_search;
+	any.up_case = up_case;
+	any.num_states = 1;
+	any.nclasses = nclasses;
+	any.max_len = any.num_first = 0;
+	memset(any.first, 0, sizeof any.first);
+
+	for(const char *p = patterns; p - patterns < patterns_len; p += strlen(p) + 1) {
+		int32_t s = 0;
+		int depth = 0;
+		if (!any.first[(unsigned char)*p]) {
+			any.first[(unsigned char)*p] = true;
+			any.first_char = *p;
+			any.num_first++;
+		}
+		for(const unsigned char *q = (const unsigned char *)p; *q; q++, depth++) {
+			int32_t * const t = &any.delta[s * nclasses + any.cls[*q]];
+			if (!*t) *t = any.num_states++;
+			s = *t;
+		}
+		any.term[s] = depth;
+		if (depth > any.max_len) any.max_len = depth;
+	}
+
+	int head = 0, tail = 0;
+	fail[0] = 0;
+	queue[tail++] = 0;
+
+	while(head < tail) {
+		const int32_t s = queue[head++];
+		for(int c = 0; c < nclasses; c++) {
+			const int32_t t = any.delta[s * nclasses + c];
+			if (t) {
+				fail[t] = s ? any.delta[fail[s] * nclasses + c] : 0;
+				any.dict[t] = any.term[fail[t]] ? fail[t] : any.dict[fail[t]];
+				queue[tail++] = t;
+			}
+			else if (s) any.delta[s * nclasses + c] = any.delta[fail[s] * nclasses + c];
+		}
+	}
+
+	free(fail);
+	free(queue);
+	return OK;
+}
+
+
+/* Returns the position of the leftmost occurrence in the given line, starting
+   at position start or later, of any pattern of the automaton, or -1 if there
+   is no such occurrence. In the initial state, characters that cannot start a
+   pattern are skipped without running the automaton (using memchr() when the
+   patterns have all the same first character and the search is case
+   sensitive). Since an occurrence starting earlier might end later than the
+   first one found, the scan goes on until no better occurrence is possible. */
+
+static int64_t any_search_line(const line_desc * const ld, const int64_t start) {
+	const unsigned char * const up_case = any.up_case;
+	const bool sense_case = any.case_search;
+	const unsigned char * const line = (const unsigned char *)ld->line;
+	int64_t best = -1, end = ld->line_len;
+	int32_t s = 0;
+
+	for(int64_t i = start; i < end; i++) {
+		if (s == 0) {
+			if (any.num_first == 1 && sense_case) {
+				const unsigned char * const q = memchr(line + i, any.first_char, end - i);
+				if (!q) break;
+				i = q - line;
+			}
+			else {
+				while(i < end && !any.first[CONV(line[i])]) i++;
+				if (i == end) break;
+			}
+		}
+
+		s = any.delta[s * any.nclasses + any.cls[CONV(line[i])]];
+
+		const int32_t len = any.term[s] ? any.term[s] : any.term[any.dict[s]];
+		if (len && (best < 0 || i - len + 1 < best)) {
+			best = i - len + 1;
+			if (best + any.max_len < end) end = best + any.max_len;
+		}
+	}
+
+	return best;
+}
+
+
+/* Returns the position of the rightmost occurrence in the given line,
+   starting at position limit or before, of any pattern of the automaton, or -1
+   if there is no such occurrence. The line is scanned forward, following the
+   dictionary links to enumerate all occurrences, and only up to the last
+   position at which an occurrence starting at limit might end. */
+
+static int64_t any_search_line_back(const line_desc * const ld, const int64_t limit) {
+	const unsigned char * const up_case = any.up_case;
+	const bool sense_case = any.case_search;
+	const unsigned char * const line = (const unsigned char *)ld->line;
+	const int64_t end = min(ld->line_len, limit + any.max_len);
+	int64_t best = -1;
+	int32_t s = 0;
+
+	for(int64_t i = 0; i < end; i++) {
+		s = any.delta[s * any.nclasses + any.cls[CONV(line[i])]];
+		for(int32_t t = any.term[s] ? s : any.dict[s]; t; t = any.dict[t]) {
+			const int64_t pos = i - any.term[t] + 1;
+			if (pos <= limit && pos > best) best = pos;
+		}
+	}
+
+	return best;
+}
+
+
+/* Searches for the first occurrence of any of the given patterns, in the
+   direction given by b->opt.search_back, and moves the cursor on it. Patterns
+   are separated by spaces or tabs; if patterns is empty, the lines of the
+   current clip are used instead. Invoking the function again with the cursor
+   on the last match found skips it. */
+
+int find_any(buffer * const b, const char * const patterns) {
+	const unsigned char * const up_case = b->encoding == ENC_UTF8 ? ascii_up_case : localised_up_case;
+	const bool sense_case = b->opt.case_search != 0;
+	char *t;
+	int64_t len;
+	int error;
+
+	if (*patterns) error = translate_patterns(patterns, strlen(patterns), false, sense_case, up_case, &t, &len);
+	else {
+		const clip_desc * const cd = get_nth_clip(b->opt.cur_clip);
+		if (!cd) return CLIP_DOESNT_EXIST;
+		if (cd->cs->encoding != ENC_ASCII && b->encoding != ENC_ASCII && cd->cs->encoding != b->encoding) return INCOMPATIBLE_CLIP_ENCODING;
+		error = translate_patterns(cd->cs->stream, cd->cs->len, true, sense_case, up_case, &t, &len);
+	}
+	if (error) return error;
+
+	bool skip_first = any_b == b && any_line == b->cur_line && any_pos == b->cur_pos;
+
+	if (any.patterns && any.patterns_len == len && !memcmp(any.patterns, t, len) && any.case_search == sense_case && any.up_case == up_case) free(t);
+	else {
+		if (error = build_any_automaton(t, len, sense_case, up_case)) return error;
+		skip_first = false;
+	}
+
+	line_desc *ld = b->cur_line_desc;
+	int64_t y = b->cur_line;
+	stop = false;
+
+	if (! b->opt.search_back) {
+
+		int64_t start_pos = b->cur_pos + (skip_first ? 1 : 0);
+
+		while(y < b->num_lines && !stop) {
+			assert(ld->ld_node.next != NULL);
+
+			int64_t pos;
+			if (start_pos < ld->line_len && (pos = any_search_line(ld, start_pos)) >= 0) {
+				goto_line(b, y);
+				goto_pos(b, pos);
+				any_b = b;
+				any_line = y;
+				any_pos = pos;
+				return OK;
+			}
+
+			ld = (line_desc *)ld->ld_node.next;
+			start_pos = 0;
+			y++;
+		}
+	}
+	else {
+
+		int64_t start_pos = b->cur_pos + (skip_first ? -1 : 0);
+
+		while(y >= 0 && !stop) {
+			assert(ld->ld_node.prev != NULL);
+
+			int64_t pos;
+			if (start_pos >= 0 && (pos = any_search_line_back(ld, start_pos)) >= 0) {
+				goto_line(b, y);
+				goto_pos(b, pos);
+				any_b = b;
+				any_line = y;
+				any_pos = pos;
+				return OK;
+			}
+
+			ld = (line_desc *)ld->ld_node.prev;
+			if (ld->ld_node.prev) start_pos = ld->line_len;
+			y--;
+		}
+	}
+
+	return stop ? STOPPED : NOT_FOUND;
+}
+
+
+
+/* The following functions manage the match index built by FindAll. The index
+   records the pattern, its kind and the case sensitivity in effect when it was
+   built, so that lines modified later can be rescanned consistently. Matches
+   never overlap: after a match, scanning restarts at its end (or, for empty
+   regular expression matches, at the following character). */
+
+/* The registers used when scanning lines for the match index. They are
+   distinct from re_reg, as scanning happens while replace_regexp() is
+   modifying the buffer. */
+
+static struct re_registers index_reg;
+
+
+/* Sets up the Boyer-Moore skip table of a match index that does not use
+   regular expressions. */
+
+static void set_skip_table(match_index * const mi) {
+	const int m = strlen(mi->pattern);
+	const unsigned char * const up_case = mi->up_case;
+	const bool sense_case = mi->case_search;
+	for(int i = 0; i < sizeof mi->d / sizeof *mi->d; i++) mi->d[i] = m;
+	for(int i = 0; i < m - 1; i++) mi->d[CONV((unsigned char)mi->pattern[i])] = m - i - 1;
+}
+
+
+/* Returns the position of the first occurrence in the given line, starting
+   at position start or later and ending before position end, of the pattern
+   of a match index that does not use regular expressions, or -1 if there is
+   no such occurrence. The search uses the same simplified Boyer-Moore
+   algorithm used by find(). */
+
+static int64_t bm_search_line(const match_index * const mi, const line_desc * const ld, const int64_t start, const int64_t end) {
+	const int64_t len = strlen(mi->pattern);
+	if (end - start < len) return -1;
+
+	const unsigned char * const up_case = mi->up_case;
+	const bool sense_case = mi->case_search;
+	const unsigned char last_char = CONV((unsigned char)mi->pattern[len - 1]);
+	const char *p = ld->line + start + len - 1;
+
+	while(p - ld->line < end) {
+		const unsigned char c = CONV((unsigned char)*p);
+		if (c == last_char) {
+			int i;
+			for (i = 1; i < len; i++)
+				if (CONV((unsigned char)*(p - i)) != CONV((unsigned char)mi->pattern[len - i - 1])) break;
+			if (i == len) return (p - ld->line) - len + 1;
+		}
+		p += mi->d[c];
+	}
+	return -1;
+}
+
+
+/* Appends to *m (whose allocated size is *size, and whose current number of
+   matches is *n) the matches of the index pattern in the given line that
+   overlap the span [from, to). A plain pattern is searched for only in the
+   span, extended on both sides by the length of the pattern. A regular
+   expression is searched for only at positions in the span (but it is
+   matched against the whole line, so anchors work as usual); thus, on a long
+   line, matches of a regular expression starting before the span are
+   missed. */
+
+static int scan_line(const buffer * const b, const match_index * const mi, const line_desc * const ld, const int64_t line, const int64_t from, const int64_t to, match_pos ** const m, int64_t * const n, int64_t * const size) {
+
+	const int64_t len = mi->regexp ? 0 : strlen(mi->pattern);
+	const int64_t end = to + len < ld->line_len ? to + len : ld->line_len;
+	regex_cache_entry *e = NULL;
+
+	if (mi->regexp) {
+		const int error = get_regexp(mi->pattern, mi->case_search, b->encoding == ENC_UTF8, &e);
+		if (error) return error;
+		e->re_pb.regs_allocated = index_reg.num_regs ? REGS_REALLOCATE : REGS_UNALLOCATED;
+	}
+	else if (ld->line_len < len) return OK;
+
+	int64_t start = from > len ? from - len : 0;
+	if (b->encoding == ENC_UTF8) while(start > 0 && (ld->line[start] & 0xC0) == 0x80) start--;
+
+	while(start <= end) {
+		int64_t pos, match_len;
+
+		if (mi->regexp) {
+			if (start > to || (pos = re_search(&e->re_pb, ld->line ? ld->line : "", ld->line_len, start, to - start, &index_reg)) < 0) break;
+			match_len = index_reg.end[0] - index_reg.start[0];
+		}
+		else {
+			if ((pos = bm_search_line(mi, ld, start, end)) < 0) break;
+			match_len = len;
+		}
+
+		if (pos > to || pos == to && to < ld->line_len) break;
+
+		if (pos >= from || pos + match_len > from) {
+			if (*n == *size) {
+				const int64_t new_size = *size ? *size * 2 : 64;
+				match_pos * const new_m = realloc(*m, new_size * sizeof **m);
+				if (!new_m) return OUT_OF_MEMORY;
+				*m = new_m;
+				*size = new_size;
+			}
+
+			(*m)[*n].line = line;
+			(*m)[*n].pos = pos;
+			(*m)[(*n)++].len = match_len;
+		}
+
+		if (match_len) start = pos + match_len;
+		else if (pos < end) start = next_pos(ld->line, pos, b->encoding);
+		else break;
+	}
+
+	return OK;
+}
+
+
+/* Returns the index of the first match in the match index that does not
+   precede the given line and position. */
+
+static int64_t lower_bound(const match_index * const mi, const int64_t line, const int64_t pos) {
+	int64_t lo = 0, hi = mi->count;
+	while(lo < hi) {
+		const int64_t mid = lo + (hi - lo) / 2;
+		if (mi->match[mid].line < line || mi->match[mid].line == line && mi->match[mid].pos < pos) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+
+/* Frees the match index of a buffer, if any. */
+
+void free_match_index(buffer * const b) {
+	if (!b->matches) return;
+	free(b->matches->pattern);
+	free(b->matches->match);
+	free(b->matches);
+	b->matches = NULL;
+}
+
+
+/* Builds the match index of the current search string of the given buffer,
+   using regular expressions if the last search did. A previous index, if any,
+   is discarded. */
+
+int build_match_index(buffer * const b) {
+
+	if (!b->find_string || !*b->find_string) return NO_SEARCH_STRING;
+
+	free_match_index(b);
+
+	match_index * const mi = calloc(1, sizeof *mi);
+	if (!mi || !(mi->pattern = str_dup(b->find_string))) {
+		free(mi);
+		return OUT_OF_MEMORY;
+	}
+
+	mi->regexp = b->last_was_regexp;
+	mi->case_search = b->opt.case_search;
+	mi->up_case = b->encoding == ENC_UTF8 ? ascii_up_case : localised_up_case;
+	mi->cur = -1;
+
+	if (!mi->regexp) set_skip_table(mi);
+
+	int error = OK;
+	int64_t line = 0;
+	stop = false;
+
+	for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next && !stop; ld = (line_desc *)ld->ld_node.next, line++)
+		if (error = scan_line(b, mi, ld, line, 0, ld->line_len, &mi->match, &mi->count, &mi->size)) break;
+
+	if (!error && stop) error = STOPPED;
+
+	if (error) {
+		free(mi->pattern);
+		free(mi->match);
+		free(mi);
+		return error;
+	}
+
+	b->matches = mi;
+	return OK;
+}
+
+
+/* Updates the match index of the given buffer after an edit which replaced
+   old_lines lines starting at the given line with new_lines lines, the first
+   of which is described by ld. Matches on the modified lines are recomputed,
+   and matches on the following lines are renumbered. This function is called
+   by insert_stream() and delete_stream(). */
+
+void update_match_index(buffer * const b, const line_desc *ld, const int64_t line, const int64_t old_lines, const int64_t new_lines) {
+
+	match_index * const mi = b->matches;
+	if (!mi) return;
+
+	static match_pos *scratch;
+	static int64_t scratch_size;
+	int64_t n = 0;
+
+	for(int64_t i = 0; i < new_lines; i++, ld = (const line_desc *)ld->ld_node.next)
+		if (scan_line(b, mi, ld, line + i, 0, ld->line_len, &scratch, &n, &scratch_size)) {
+			free_match_index(b);
+			return;
+		}
+
+	const int64_t first = lower_bound(mi, line, 0), last = lower_bound(mi, line + old_lines, 0);
+	const int64_t count = mi->count - (last - first) + n;
+
+	if (count > mi->size) {
+		match_pos * const new_match = realloc(mi->match, count * sizeof *mi->match);
+		if (!new_match) {
+			free_match_index(b);
+			return;
+		}
+		mi->match = new_match;
+		mi->size = count;
+	}
+
+	if (n != last - first) memmove(mi->match + first + n, mi->match + last, (mi->count - last) * sizeof *mi->match);
+	memcpy(mi->match + first, scratch, n * sizeof *mi->match);
+
+	if (new_lines != old_lines)
+		for(int64_t i = first + n; i < count; i++) mi->match[i].line += new_lines - old_lines;
+
+	if (mi->cur >= last) mi->cur += n - (last - first);
+	else if (mi->cur >= first) mi->cur = -1;
+
+	mi->count = count;
+}
+
+
+/* Moves the cursor to the next (or previous) match in the match index of the
+   given buffer. If the cursor is on the last match we moved to, this takes
+   constant time; otherwise, the nearest match is located by binary search. */
+
+int goto_match(buffer * const b, const bool next) {
+
+	match_index * const mi = b->matches;
+	if (!mi) return NO_MATCH_INDEX;
+
+	int64_t i;
+
+	if (mi->cur >= 0 && mi->cur < mi->count && mi->match[mi->cur].line == b->cur_line && mi->match[mi->cur].pos == b->cur_pos) i = mi->cur + (next ? 1 : -1);
+	else {
+		i = lower_bound(mi, b->cur_line, b->cur_pos);
+		if (next) {
+			if (i < mi->count && mi->match[i].line == b->cur_line && mi->match[i].pos == b->cur_pos) i++;
+		}
+		else i--;
+	}
+
+	if (i < 0 || i >= mi->count) return NOT_FOUND;
+
+	goto_line(b, mi->match[i].line);
+	goto_pos(b, mi->match[i].pos);
+	mi->cur = i;
+	return OK;
+}
+
+
+/* The matcher used to highlight the visible occurrences of the find string.
+   It is a match index that never contains matches, and it is kept in sync
+   with the current buffer by set_highlight_pattern(). If the pattern is a
+   regular expression that cannot be compiled, highlight_ok is false. */
+
+static match_index highlight;
+static bool highlight_utf8, highlight_ok;
+
+
+/* Synchronises the highlighting matcher with the find string of the given
+   buffer (which is used only if the highlight_matches flag is set). Returns
+   true if the matcher has changed, in which case highlighted occurrences on
+   the screen are no longer correct. */
+
+bool set_highlight_pattern(const buffer * const b) {
+
+	const char * const pattern = b->opt.highlight_matches && b->find_string && *b->find_string ? b->find_string : NULL;
+	const bool utf8 = b->encoding == ENC_UTF8;
+
+	if (!pattern && !highlight.pattern) return false;
+	if (pattern && highlight.pattern && !strcmp(pattern, highlight.pattern) && highlight.regexp == b->last_was_regexp
+		&& highlight.case_search == b->opt.case_search && highlight_utf8 == utf8) return false;
+
+	free(highlight.pattern);
+	highlight.pattern = NULL;
+	highlight_ok = false;
+
+	if (!pattern || !(highlight.pattern = str_dup(pattern))) return true;
+
+	highlight.regexp = b->last_was_regexp;
+	highlight.case_search = b->opt.case_search;
+	highlight.up_case = utf8 ? ascii_up_case : localised_up_case;
+	highlight_utf8 = utf8;
+
+	if (highlight.regexp) {
+		regex_cache_entry *e;
+		highlight_ok = get_regexp(highlight.pattern, highlight.case_search, utf8, &e) == OK;
+	}
+	else {
+		set_skip_table(&highlight);
+		highlight_ok = true;
+	}
+
+	return true;
+}
+
+
+/* Stores in *m the matches of the highlighting matcher in the given line that
+   overlap the span [from, to) (see scan_line()), and returns their number.
+   The array is static, and it is overwritten by the next call. */
+
+int64_t find_line_matches(const buffer * const b, const line_desc * const ld, const int64_t from, const int64_t to, match_pos ** const m) {
+	static match_pos *match;
+	static int64_t size;
+	int64_t n = 0;
+
+	if (!highlight_ok || scan_line(b, &highlight, ld, 0, from, to, &match, &n, &size)) return 0;
+	*m = match;
+	return n;
+}
+
+
+/* Incremental search. As the pattern is typed, the cursor is moved to its
+   first occurrence starting from the original position (in the direction
+   given by b->opt.search_back). Since every occurrence of an extension of a
+   pattern is also an occurrence of the pattern, when the pattern is extended
+   the search resumes from the last match, or from the line where it was
+   suspended. Searches run in slices of ISEARCH_SLICE milliseconds, at the end
+   of which they are suspended if there is pending input; the next keystroke
+   will resume them. */
+
+#define ISEARCH_SLICE 50
+
+static struct {
+	buffer *b;
+	match_index mi;                 /* The current pattern (NULL if empty). */
+	line_desc *start_ld;            /* The original cursor position. */
+	int64_t start_line, start_pos;
+	line_desc *ld;                  /* Where the search resumes (or the match). */
+	int64_t line, pos;
+	bool done, found;
+	int error;                      /* Why the last pattern was rejected (or OK). */
+} isearch;
+
+
+/* Searches for the current pattern from the resume position. If
+   interruptible is true, the search is suspended at the end of a time slice
+   if there is pending input. */
+
+static void isearch_run(const bool interruptible) {
+	const bool back = isearch.b->opt.search_back;
+	struct timespec slice_start, now;
+	clock_gettime(CLOCK_MONOTONIC, &slice_start);
+
+	for(int64_t n = 1; !isearch.done; n++) {
+		int64_t pos;
+
+		if (back) {
+			/* We look for the last occurrence not starting after isearch.pos. */
+			pos = -1;
+			for(int64_t p; (p = bm_search_line(&isearch.mi, isearch.ld, pos + 1, isearch.ld->line_len)) >= 0 && p <= isearch.pos; ) pos = p;
+		}
+		else pos = bm_search_line(&isearch.mi, isearch.ld, isearch.pos, isearch.ld->line_len);
+
+		if (pos >= 0) {
+			isearch.pos = pos;
+			isearch.done = isearch.found = true;
+		}
+		else if (back ? isearch.line == 0 : isearch.line == isearch.b->num_lines - 1) isearch.done = true;
+		else if (back) {
+			isearch.ld = (line_desc *)isearch.ld->ld_node.prev;
+			isearch.line--;
+			isearch.pos = isearch.ld->line_len;
+		}
+		else {
+			isearch.ld = (line_desc *)isearch.ld->ld_node.next;
+			isearch.line++;
+			isearch.pos = 0;
+		}
+
+		if (interruptible && !isearch.done && n % 256 == 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if ((now.tv_sec - slice_start.tv_sec) * 1000 + (now.tv_nsec - slice_start.tv_nsec) / 1000000 >= ISEARCH_SLICE) {
+				if (key_pending()) return;
+				slice_start = now;
+			}
+		}
+	}
+}
+
+
+/* Moves the cursor to the current match, or to the original position if the
+   pattern is empty, and refreshes the window. */
+
+static void isearch_show(void) {
+	buffer * const b = isearch.b;
+	if (isearch.mi.pattern) {
+		goto_line(b, isearch.line);
+		goto_pos(b, isearch.pos);
+	}
+	else {
+		goto_line(b, isearch.start_line);
+		goto_pos(b, isearch.start_pos);
+	}
+	refresh_window(b);
+}
+
+
+/* Called by request() after each keystroke. */
+
+static void isearch_update(const char * const pattern) {
+	buffer * const b = isearch.b;
+	const char * const old = isearch.mi.pattern;
+
+	isearch.error = OK;
+
+	if (old && !strcmp(pattern, old)) {
+		/* The pattern did not change, but the search might be suspended. */
+		if (isearch.done) return;
+	}
+	else {
+		const encoding_type encoding = detect_encoding(pattern, strlen(pattern));
+		if (encoding != ENC_ASCII && b->encoding != ENC_ASCII && encoding != b->encoding) {
+			isearch.error = INCOMPATIBLE_SEARCH_STRING_ENCODING;
+			alert();
+			return;
+		}
+
+		char * const new_pattern = *pattern ? str_dup(pattern) : NULL;
+		if (*pattern && !new_pattern) {
+			isearch.error = OUT_OF_MEMORY;
+			alert();
+			return;
+		}
+
+		if (!old || strncmp(pattern, old, strlen(old))) {
+			isearch.ld = isearch.start_ld;
+			isearch.line = isearch.start_line;
+			isearch.pos = isearch.start_pos;
+			isearch.done = isearch.found = false;
+		}
+		else if (isearch.found) isearch.done = isearch.found = false;
+		/* Otherwise, the pattern extends one that cannot be found. */
+
+		free(isearch.mi.pattern);
+		isearch.mi.pattern = new_pattern;
+
+		/* The find string is kept in sync, so that matches can be highlighted. */
+		free(b->find_string);
+		b->find_string = new_pattern ? str_dup(new_pattern) : NULL;
+		b->find_string_changed = 1;
+		b->last_was_regexp = false;
+
+		if (!new_pattern) {
+			isearch.done = true;
+			isearch_show();
+			return;
+		}
+
+		set_skip_table(&isearch.mi);
+		if (isearch.done) {
+			alert();
+			return;
+		}
+	}
+
+	isearch_run(true);
+	if (!isearch.done) return;
+	if (isearch.found) isearch_show();
+	else alert();
+}
+
+
+/* Performs an incremental search: the cursor moves to the first occurrence
+   of the pattern as it is typed; RETURN accepts the current match, and the
+   pattern becomes the find string, whereas escaping restores the original
+   position and find string. */
+
+int incremental_find(buffer * const b) {
+	char * const orig_find_string = b->find_string;
+	const bool orig_last_was_regexp = b->last_was_regexp;
+
+	memset(&isearch, 0, sizeof isearch);
+	isearch.b = b;
+	isearch.mi.case_search = b->opt.case_search;
+	isearch.mi.up_case = b->encoding == ENC_UTF8 ? ascii_up_case : localised_up_case;
+	isearch.ld = isearch.start_ld = b->cur_line_desc;
+	isearch.line = isearch.start_line = b->cur_line;
+	isearch.pos = isearch.start_pos = b->cur_pos;
+	isearch.done = true;
+
+	b->find_string = NULL;
+
+	const char * const p = request(b->opt.search_back ? "Incremental Find (back)" : "Incremental Find", NULL, true, COMPLETE_NONE, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto, isearch_update);
+
+	int error = OK;
+
+	if (p && *p && (!isearch.mi.pattern || strcmp(p, isearch.mi.pattern))) {
+		/* The string was not typed, but, for instance, picked from the
+			history, so isearch_update() has not seen it yet. */
+		isearch_update(p);
+		error = isearch.error;
+	}
+
+	if (!error && p && *p) {
+		/* The last search might have been suspended by the RETURN key. */
+		if (!isearch.done) isearch_run(false);
+		if (isearch.found) isearch_show();
+		else error = NOT_FOUND;
+		free(orig_find_string);
+	}
+	else {
+		delay_update();
+		goto_line(b, isearch.start_line);
+		goto_pos(b, isearch.start_pos);
+		free(b->find_string);
+		b->find_string = orig_find_string;
+		b->find_string_changed = 1;
+		b->last_was_regexp = orig_last_was_regexp;
+	}
+
+	free(isearch.mi.pattern);
+	isearch.mi.pattern = NULL;
+	return error;
+}
@@ -0,0 +1,324 @@
+/* Startup cache and startup profiling.
+
+	Copyright (C) 1993-1998 Sebastiano Vigna
+	Copyright (C) 1999-2015 Todd M. Lewis and Sebastiano Vigna
+
+	This file is part of ne, the nice editor.
+
+	This library is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or (at your
+	option) any later version.
+
+	This library is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+#include "version.h"
+#include <sys/mman.h>
+#include <time.h>
+
+
+/* At startup, ne parses the menu configuration and the key bindings, and
+   plays the default preferences. To avoid reading and parsing these files
+   each time, we save the result in ~/.ne/.startup-cache, which is mapped
+   in memory at the next startup and used as long as the files do not
+   change. Menus, key bindings and key sequences are restored directly from
+   the mapped file, which is never unmapped, as its strings are not copied.
+   Preferences can set any option, so they are saved as streams, and played
+   as usual, but without reading any file.
+
+   The cache file has the same header as syntax cache files (see
+   syn_cache.c), followed by the version of ne, by the list of sources
+   (every file the configuration would be read from, whether it exists or
+   not, with its device, inode, modification time and size), by the menus
+   (see save_menu_configuration()), by the key bindings that differ from the
+   built-in ones (key code and command line), by the key sequences
+   (sequence and key code), and by the stream of each preferences source
+   (length and contents).
+
+   The cache is valid only if the list of sources is the same, and no
+   source has changed. Since sources are not read, a change within the
+   second in which the cache has been saved could go unnoticed; thus, we do
+   not save the cache if a source has been modified in the last second. */
+
+#define STARTUP_CACHE_MAGIC "ne-stc"
+#define STARTUP_CACHE_VERSION 1
+#define MAX_SOURCES 8
+#define NUM_PREFS_SOURCES 2
+
+
+/* The sources of the configuration, with their status; the last ones are
+   the preferences. */
+
+static char source[MAX_SOURCES][1024];
+static struct stat source_stat[MAX_SOURCES];
+static bool source_exists[MAX_SOURCES];
+static int num_sources, first_prefs_source;
+
+/* If true, the configuration has been read from the cache, and
+   cached_prefs contains the preference streams (pointing into the cache). */
+
+static bool cache_loaded;
+static char_stream cached_prefs[NUM_PREFS_SOURCES];
+
+/* If true, the configuration has been parsed from the sources, and it is
+   being saved in cache_out, to which the preferences will be added. */
+
+static bool cache_pending;
+static struct cache_out cache_out;
+
+
+/* Adds a source made of a directory, a name and a suffix, and gets its
+   status. Returns false if the name is too long. */
+
+static bool add_source(const char * const dir, const char * const name, const char * const suffix) {
+	if (strlen(dir) + strlen(name) + strlen(suffix) >= sizeof *source) return false;
+	strcat(strcat(strcpy(source[num_sources], dir), name), suffix);
+	source_exists[num_sources] = !stat(tilde_expand(source[num_sources]), &source_stat[num_sources]);
+	num_sources++;
+	return true;
+}
+
+
+/* Computes the list of sources, in the order in which get_menu_configuration(),
+   get_key_bindings() and load_auto_prefs() try them. Returns false if
+   the cache cannot be used. */
+
+static bool get_sources(const char *menu_conf_name, const char *key_bindings_name, const char * const prefs_name) {
+	if (!menu_conf_name) menu_conf_name = MENU_CONF_NAME;
+	if (!key_bindings_name) key_bindings_name = KEY_BINDINGS_NAME;
+
+	const char * const prefs_dir = exists_prefs_dir();
+	if (!prefs_dir) return false;
+
+	num_sources = 0;
+	bool ok = add_source("", menu_conf_name, "") && add_source(prefs_dir, menu_conf_name, "");
+	const char *gprefs_dir = exists_gprefs_dir();
+	if (gprefs_dir) ok = ok && add_source(gprefs_dir, menu_conf_name, "") && add_source(gprefs_dir, key_bindings_name, "");
+	ok = ok && add_source(prefs_dir, key_bindings_name, "") && add_source("./", key_bindings_name, "");
+
+	first_prefs_source = num_sources;
+	if (gprefs_dir = exists_gprefs_dir()) ok = ok && add_source(gprefs_dir, prefs_name, PREF_FILE_SUFFIX);
+	return ok && add_source(prefs_dir, prefs_name, PREF_FILE_SUFFIX);
+}
+
+
+/* Returns true if the sources in a cache file are the current ones. */
+
+static bool valid_sources(struct cache_in * const in) {
+	if (strcmp((const char *)cache_get_str(in), VERSION_STRING) || cache_get_u32(in) != num_sources) return false;
+	for(int i = 0; i < num_sources && !in->error; i++) {
+		const unsigned char * const path = cache_get_str(in);
+		const bool exists = cache_get_u32(in);
+		const uint64_t dev = cache_get_u64(in), ino = cache_get_u64(in), mtime = cache_get_u64(in), size = cache_get_u64(in);
+		if (in->error || strcmp((const char *)path, source[i]) || exists != source_exists[i]) return false;
+		if (exists && (dev != source_stat[i].st_dev || ino != source_stat[i].st_ino || mtime != source_stat[i].st_mtime || size != source_stat[i].st_size)) return false;
+	}
+	return !in->error;
+}
+
+
+/* Restores the configuration from the body of a cache file. On error, the
+   configuration might be partially restored; this is harmless, as parsing
+   the sources again yields the same configuration. */
+
+static bool load_configuration(struct cache_in * const in) {
+	if (!load_menu_configuration(in)) return false;
+
+	for(uint32_t n = cache_get_u32(in); n-- > 0 && !in->error;) {
+		const uint32_t c = cache_get_u32(in);
+		const char * const command_line = (const char *)cache_get_str(in);
+		if (c >= NUM_KEYS) in->error = true;
+		else if (!in->error) key_binding[c] = command_line;
+	}
+
+	for(uint32_t n = cache_get_u32(in); n-- > 0 && !in->error;) {
+		const char * const cap_string = (const char *)cache_get_str(in);
+		const uint32_t code = cache_get_u32(in);
+		if (!in->error && (code >= NUM_KEYS || !add_key_capability(cap_string, code))) in->error = true;
+	}
+
+	for(int i = 0; i < num_sources - first_prefs_source && !in->error; i++) {
+		const uint32_t len = cache_get_u32(in);
+		if (len > (uint32_t)(in->end - in->p)) in->error = true;
+		else {
+			cached_prefs[i].size = cached_prefs[i].len = len;
+			cached_prefs[i].stream = len ? (char *)in->p : NULL;
+			in->p += len;
+		}
+	}
+
+	return !in->error;
+}
+
+
+/* Reads the menu configuration and the key bindings, using the startup
+   cache if possible. Otherwise, the configuration is parsed as usual, and
+   the cache will be saved by load_default_prefs(). Note that this function
+   can exit() on error, like get_menu_configuration() and get_key_bindings(). */
+
+void get_configuration(const char * const menu_conf_name, const char * const key_bindings_name, const char * const prefs_name) {
+	const bool cacheable = get_sources(menu_conf_name, key_bindings_name, prefs_name);
+
+	if (cacheable) {
+		char name[1024];
+		const char * const prefs_dir = exists_prefs_dir();
+		if (strlen(prefs_dir) + strlen(STARTUP_CACHE_NAME) < sizeof name) {
+			strcat(strcpy(name, prefs_dir), STARTUP_CACHE_NAME);
+			struct cache_in in;
+			size_t len;
+			unsigned char * const map = cache_map(name, STARTUP_CACHE_MAGIC, STARTUP_CACHE_VERSION, &in, &len);
+			if (map) {
+				if (valid_sources(&in) && load_configuration(&in)) {
+					cache_loaded = true;
+					startup_phase("startup cache");
+					return;
+				}
+				munmap(map, len);
+			}
+		}
+	}
+
+	const char *def_key_binding[NUM_KEYS];
+	memcpy(def_key_binding, key_binding, sizeof def_key_binding);
+
+	get_menu_configuration(menu_conf_name);
+	startup_phase("menus");
+	get_key_bindings(key_bindings_name);
+	startup_phase("keys");
+
+	if (!cacheable) return;
+
+	/* We do not save the cache if a source is being modified. */
+	const time_t now = time(NULL);
+	for(int i = 0; i < num_sources; i++)
+		if (source_exists[i] && source_stat[i].st_mtime >= now - 1) return;
+
+	struct cache_out * const o = &cache_out;
+	cache_put_str(o, (const unsigned char *)VERSION_STRING);
+	cache_put_u32(o, num_sources);
+	for(int i = 0; i < num_sources; i++) {
+		cache_put_str(o, (const unsigned char *)source[i]);
+		cache_put_u32(o, source_exists[i]);
+		cache_put_u64(o, source_exists[i] ? source_stat[i].st_dev : 0);
+		cache_put_u64(o, source_exists[i] ? source_stat[i].st_ino : 0);
+		cache_put_u64(o, source_exists[i] ? source_stat[i].st_mtime : 0);
+		cache_put_u64(o, source_exists[i] ? source_stat[i].st_size : 0);
+	}
+
+	save_menu_configuration(o);
+
+	uint32_t n = 0;
+	for(int c = 0; c < NUM_KEYS; c++) n += key_binding[c] != def_key_binding[c];
+	cache_put_u32(o, n);
+	for(int c = 0; c < NUM_KEYS; c++)
+		if (key_binding[c] != def_key_binding[c]) {
+			cache_put_u32(o, c);
+			cache_put_str(o, (const unsigned char *)key_binding[c]);
+		}
+
+	const char *cap_string;
+	for(n = 0; get_key_capability(n, &cap_string) >= 0; n++);
+	cache_put_u32(o, n);
+	for(int i = 0, code; (code = get_key_capability(i, &cap_string)) >= 0; i++) {
+		cache_put_str(o, (const unsigned char *)cap_string);
+		cache_put_u32(o, code);
+	}
+
+	cache_pending = true;
+}
+
+
+/* Loads the default preferences (i.e., the autoprefs for the given name)
+   in the given buffer, from the startup cache if it has been loaded by
+   get_configuration(). If the configuration has been parsed instead, the
+   startup cache is saved. */
+
+int load_default_prefs(buffer * const b, const char * const prefs_name) {
+	if (!cache_loaded) {
+		const int error = load_auto_prefs(b, prefs_name);
+		startup_phase("prefs");
+		if (!cache_pending) return error;
+
+		/* The order of the streams is that of the sources. */
+		for(int i = first_prefs_source; i < num_sources; i++) {
+			char_stream * const cs = source_exists[i] ? load_stream(NULL, source[i], false, false) : NULL;
+			cache_put_u32(&cache_out, cs ? cs->len : 0);
+			if (cs) {
+				cache_put(&cache_out, cs->stream, cs->len);
+				free_char_stream(cs);
+			}
+		}
+
+		char name[1024];
+		const char * const prefs_dir = exists_prefs_dir();
+		if (strlen(prefs_dir) + strlen(STARTUP_CACHE_NAME) < sizeof name) {
+			strcat(strcpy(name, prefs_dir), STARTUP_CACHE_NAME);
+			cache_write(name, STARTUP_CACHE_MAGIC, STARTUP_CACHE_VERSION, &cache_out);
+		}
+
+		free(cache_out.p);
+		cache_pending = false;
+		startup_phase("startup cache (save)");
+		return error;
+	}
+
+	int error = OK;
+	for(int i = 0; i < num_sources - first_prefs_source; i++)
+		if (source_exists[first_prefs_source + i]) error = play_prefs(b, &cached_prefs[i]);
+	if (!source_exists[num_sources - 1]) error = ERROR;
+
+	if (do_syntax && !b->syn) load_syntax_by_name(b, prefs_name);
+	startup_phase("prefs");
+	return error;
+}
+
+
+/* Startup profiling: startup_phase() records the time elapsed since its
+   last call, attributing it to the given phase; the first call, with a
+   NULL name, just starts the clock. If --startup-profile has been
+   specified, the phases are printed on the standard error at exit. */
+
+#define MAX_PHASES 16
+
+bool startup_profile;
+
+static struct {
+	const char *name;
+	uint64_t ns;
+} phase[MAX_PHASES];
+
+static int num_phases;
+static uint64_t last_phase_ns;
+
+static uint64_t time_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * (uint64_t)1000000000 + t.tv_nsec;
+}
+
+void startup_phase(const char * const name) {
+	const uint64_t now = time_ns();
+	if (name && num_phases < MAX_PHASES) {
+		phase[num_phases].name = name;
+		phase[num_phases++].ns = now - last_phase_ns;
+	}
+	last_phase_ns = now;
+}
+
+void print_startup_profile(void) {
+	uint64_t total = 0;
+	fprintf(stderr, "Startup profile (ms):\n");
+	for(int i = 0; i < num_phases; i++) {
+		fprintf(stderr, "%-22s %9.3f\n", phase[i].name, phase[i].ns / 1E6);
+		total += phase[i].ns;
+	}
+	fprintf(stderr, "%-22s %9.3f\n", "total", total / 1E6);
+}
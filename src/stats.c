@@ -0,0 +1,171 @@
+/* Latency and frame statistics.
+
+   Copyright (C) 1993-1998 Sebastiano Vigna
+   Copyright (C) 1999-2015 Todd M. Lewis and Sebastiano Vigna
+
+   This file is part of ne, the nice editor.
+
+   This library is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+#include <time.h>
+
+
+/* ne timestamps each key as get_key_code() returns it, and again when the
+   next frame has been sent to the terminal, that is, when get_key_code()
+   flushes the output before waiting for more input: the difference
+   is the latency of the key (if several keys are processed before a frame is
+   sent, the oldest one is used). For each frame we also record the number of
+   bytes sent and the number of lines parsed by the syntax highlighter.
+
+   The values are kept in histograms with logarithmic buckets of linear
+   subbuckets, as in HDR histograms: values smaller than 2^HIST_SUB_BITS
+   have a bucket of their own, and larger values are recorded with a
+   relative error smaller than 2^-HIST_SUB_BITS. */
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+	uint64_t count[HIST_BUCKETS];
+	uint64_t n, sum, max;
+} histogram;
+
+/* The latency of keys in microseconds, the bytes sent and the lines parsed
+   for each frame. */
+
+static histogram latency_hist, bytes_hist, parsed_hist;
+
+/* The number of lines parsed by the syntax highlighter (incremented by
+   parse()). */
+
+uint64_t lines_parsed;
+
+/* Whether a key is waiting for a frame, and when it was returned. */
+
+static bool key_waiting;
+static struct timespec key_time;
+
+/* The values of output_bytes and lines_parsed at the last frame. */
+
+static uint64_t last_bytes, last_parsed;
+
+
+/* Returns the bucket of a value. */
+
+static int bucket(const uint64_t v) {
+	if (v < HIST_SUB) return v;
+	int e = 0;
+	while(v >> e + 1) e++;
+	return (e - HIST_SUB_BITS + 1) * HIST_SUB + (v >> e - HIST_SUB_BITS & HIST_SUB - 1);
+}
+
+
+/* Returns the smallest value of a bucket. */
+
+static uint64_t bucket_min(const int i) {
+	if (i < HIST_SUB) return i;
+	return (uint64_t)(HIST_SUB + i % HIST_SUB) << i / HIST_SUB - 1;
+}
+
+
+static void hist_add(histogram * const h, const uint64_t v) {
+	h->count[bucket(v)]++;
+	h->n++;
+	h->sum += v;
+	if (v > h->max) h->max = v;
+}
+
+
+/* Returns an approximation (the smallest value of the bucket) of the given
+   percentile of a histogram. */
+
+static uint64_t hist_percentile(const histogram * const h, const double p) {
+	if (h->n == 0) return 0;
+	const uint64_t rank = (uint64_t)(p / 100 * (h->n - 1)) + 1;
+	uint64_t c = 0;
+	for(int i = 0; i < HIST_BUCKETS; i++)
+		if ((c += h->count[i]) >= rank) return bucket_min(i);
+	return h->max;
+}
+
+
+/* Records that get_key_code() is returning a key. */
+
+void stats_key(void) {
+	if (key_waiting) return;
+	clock_gettime(CLOCK_MONOTONIC, &key_time);
+	key_waiting = true;
+}
+
+
+/* Records that get_key_code() has sent a frame to the terminal. A flush
+   without output while other keys are pending is not a frame, as the update
+   has just been delayed. */
+
+void stats_frame(void) {
+	const uint64_t bytes = output_bytes - last_bytes;
+	if (bytes == 0 && (!key_waiting || key_pending())) return;
+
+	if (key_waiting) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		hist_add(&latency_hist, (now.tv_sec - key_time.tv_sec) * 1000000 + (now.tv_nsec - key_time.tv_nsec) / 1000);
+		key_waiting = false;
+	}
+
+	hist_add(&bytes_hist, bytes);
+	hist_add(&parsed_hist, lines_parsed - last_parsed);
+	last_bytes = output_bytes;
+	last_parsed = lines_parsed;
+}
+
+
+/* Writes into msg (of the given size) a summary of the statistics suitable
+   for the status bar. */
+
+void stats_message(char * const msg, const size_t size) {
+	snprintf(msg, size, "Latency p50 %.1f p99 %.1f max %.1f ms over %" PRIu64 " keys; %" PRIu64 " bytes (%" PRIu64 " for attributes) in %" PRIu64 " frames, %" PRIu64 " writes; %" PRIu64 " characters already on screen; %" PRIu64 " lines parsed.",
+		hist_percentile(&latency_hist, 50) / 1000., hist_percentile(&latency_hist, 99) / 1000., latency_hist.max / 1000., latency_hist.n,
+		output_bytes, output_attr_bytes, bytes_hist.n, output_writes, output_chars_skipped, lines_parsed);
+}
+
+
+static void save_hist(FILE * const f, const char * const name, const histogram * const h) {
+	fprintf(f, "%s.count %" PRIu64 "\n%s.sum %" PRIu64 "\n%s.max %" PRIu64 "\n", name, h->n, name, h->sum, name, h->max);
+	fprintf(f, "%s.p50 %" PRIu64 "\n%s.p90 %" PRIu64 "\n%s.p99 %" PRIu64 "\n%s.p999 %" PRIu64 "\n", name,
+		hist_percentile(h, 50), name, hist_percentile(h, 90), name, hist_percentile(h, 99), name, hist_percentile(h, 99.9));
+	for(int i = 0; i < HIST_BUCKETS; i++)
+		if (h->count[i]) fprintf(f, "%s.bucket %" PRIu64 " %" PRIu64 "\n", name, bucket_min(i), h->count[i]);
+}
+
+
+/* Saves the statistics in a file, one "name value" pair per line (histogram
+   buckets are given by their smallest value and their count). */
+
+int save_stats(const char * const name) {
+	FILE * const f = fopen(name, "w");
+	if (!f) return CANT_OPEN_FILE;
+
+	fprintf(f, "output.bytes %" PRIu64 "\noutput.attr_bytes %" PRIu64 "\noutput.writes %" PRIu64 "\noutput.chars_skipped %" PRIu64 "\nlines_parsed %" PRIu64 "\n",
+		output_bytes, output_attr_bytes, output_writes, output_chars_skipped, lines_parsed);
+	save_hist(f, "latency_us", &latency_hist);
+	save_hist(f, "frame_bytes", &bytes_hist);
+	save_hist(f, "frame_lines_parsed", &parsed_hist);
+
+	const bool error = ferror(f);
+	return fclose(f) || error ? ERROR_WHILE_WRITING : OK;
+}
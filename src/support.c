@@ -387,7 +387,9 @@ void set_interactive_mode(void) {
 	siginterrupt(SIGWINCH, 1);
 	signal(SIGWINCH, handle_winch);
 #endif
-	/* This ensures that a physical read will be performed at each getchar(). */
+	/* Keyboard input is read with read() (see fill_kbd_buffer()), bypassing
+		stdio; we make stdin unbuffered anyway, so that no stdio buffer can
+		ever hold input that poll() would not see. */
 
 	setbuf(stdin, NULL);
 
@@ -413,13 +415,13 @@ void unset_interactive_mode(void) {
 	clear_to_eol();
 	move_cursor(ne_lines - 1, 0);
 
-	/* Now we disable the keypad, cursor addressing, etc. fflush() guarantees
-		that tcsetattr() won't clip part of the capability strings output by
-		reset_terminal_modes(). */
+	/* Now we disable the keypad, cursor addressing, etc. flush_output()
+		guarantees that tcsetattr() won't clip part of the capability strings
+		output by reset_terminal_modes(). */
 
 	reset_terminal_modes();
-	putchar('\r');
-	fflush(stdout);
+	put_byte('\r');
+	flush_output();
 
 	/* Now we restore all the flags in the termios structure to the state they
 		were before us. */
@@ -435,14 +437,179 @@ void unset_interactive_mode(void) {
 
 
 
+/* Computing widths and positions on a line requires scanning it from the
+   start, expanding TABs and UTF-8 sequences; on very long lines (e.g.,
+   minified files) this would make every cursor movement and every redraw
+   linear in the length of the line. Thus, for the few long lines that were
+   used most recently we keep a column index, that is, a checkpoint every
+   COLUMN_CHECKPOINT_SPACING bytes, recording the position of the first
+   character starting at or after that offset, together with its column and its
+   character index. The checkpoints are computed lazily, as far as needed;
+   when the line descriptor is modified, the checkpoints at or after the
+   modified position are discarded (see invalidate_column_index()), and the
+   whole index is discarded when the line descriptor is freed, or when a
+   different TAB size or encoding is used. Lines shorter than
+   COLUMN_INDEX_MIN_LEN are just scanned. */
+
+#define COLUMN_CHECKPOINT_SPACING (4 * 1024)
+#define COLUMN_INDEX_MIN_LEN (4 * COLUMN_CHECKPOINT_SPACING)
+#define COLUMN_INDEXES 4
+
+typedef struct {
+	int64_t pos, width, chars;
+} column_checkpoint;
+
+typedef struct {
+	const line_desc *ld;        /* The indexed line descriptor, or NULL if the index is free. */
+	int tab_size;
+	bool utf8;
+	bool complete;              /* All checkpoints have been computed. */
+	column_checkpoint *cp;
+	int64_t count, size;        /* The number of checkpoints, and the size of cp. */
+	uint64_t last_used;
+} column_index;
+
+static column_index column_indexes[COLUMN_INDEXES];
+static uint64_t column_index_clock;
+
+
+/* Discards the checkpoints of the column index of the given line descriptor
+   that are at or after the given position (as the checkpoints before an
+   insertion or a deletion are still valid), or all column indexes if ld is
+   NULL. It must be called whenever a line descriptor is modified (with the
+   position of the modification) or freed (with position 0). */
+
+void invalidate_column_index(const line_desc * const ld, const int64_t pos) {
+	for(int i = 0; i < COLUMN_INDEXES; i++) {
+		column_index * const ci = &column_indexes[i];
+		if (!ld) ci->ld = NULL;
+		else if (ci->ld == ld) {
+			if (pos == 0) ci->ld = NULL;
+			else {
+				while(ci->cp[ci->count - 1].pos >= pos) ci->count--;
+				ci->complete = false;
+			}
+		}
+	}
+}
+
+
+/* Returns the column index of the given line descriptor, reusing the least
+   recently used one if necessary, or NULL if the line is short or we run out
+   of memory. */
+
+static column_index *get_column_index(const line_desc * const ld, const int tab_size, const encoding_type encoding) {
+	if (ld->line_len < COLUMN_INDEX_MIN_LEN) return NULL;
+
+	const bool utf8 = encoding == ENC_UTF8;
+	column_index *ci = NULL, *lru = column_indexes;
+	for(int i = 0; i < COLUMN_INDEXES; i++) {
+		if (column_indexes[i].ld == ld) {
+			ci = &column_indexes[i];
+			break;
+		}
+		if (column_indexes[i].last_used < lru->last_used) lru = &column_indexes[i];
+	}
+
+	if (!ci || ci->tab_size != tab_size || ci->utf8 != utf8) {
+		if (!ci) ci = lru;
+		if (!ci->cp) {
+			if (!(ci->cp = malloc(64 * sizeof *ci->cp))) return NULL;
+			ci->size = 64;
+		}
+		ci->ld = ld;
+		ci->tab_size = tab_size;
+		ci->utf8 = utf8;
+		ci->complete = false;
+		ci->cp[0] = (column_checkpoint){ 0, 0, 0 };
+		ci->count = 1;
+	}
+
+	ci->last_used = ++column_index_clock;
+	return ci;
+}
+
+
+/* Computes further checkpoints of the given column index, until a checkpoint
+   beyond the given position or column is available, or the end of the line is
+   reached. */
+
+static void extend_column_index(column_index * const ci, const int64_t max_pos, const int64_t max_width) {
+	const line_desc * const ld = ci->ld;
+	const encoding_type encoding = ci->utf8 ? ENC_UTF8 : ENC_8_BIT;
+	column_checkpoint c = ci->cp[ci->count - 1];
+
+	while(!ci->complete && c.pos <= max_pos && c.width <= max_width) {
+		const int64_t next = ci->count * COLUMN_CHECKPOINT_SPACING;
+		while(c.pos < next && c.pos < ld->line_len) {
+			if (ld->line[c.pos] != '\t') c.width += get_char_width(&ld->line[c.pos], encoding);
+			else c.width += ci->tab_size - c.width % ci->tab_size;
+			c.pos = next_pos(ld->line, c.pos, encoding);
+			c.chars++;
+		}
+
+		if (c.pos >= ld->line_len) ci->complete = true;
+		else {
+			if (ci->count == ci->size) {
+				column_checkpoint * const cp = realloc(ci->cp, ci->size * 2 * sizeof *cp);
+				if (!cp) {
+					/* We just make do with the checkpoints we have. */
+					ci->complete = true;
+					return;
+				}
+				ci->cp = cp;
+				ci->size *= 2;
+			}
+			ci->cp[ci->count++] = c;
+		}
+	}
+}
+
+
+/* Returns the last checkpoint of the column index of the given line
+   descriptor whose position is not greater than pos, or, if pos is negative,
+   whose column is not greater than width. If the line has no column index,
+   the start of the line is returned. */
+
+static column_checkpoint find_checkpoint(const line_desc * const ld, const int tab_size, const encoding_type encoding, const int64_t pos, const int64_t width) {
+	column_index * const ci = get_column_index(ld, tab_size, encoding);
+	if (!ci) return (column_checkpoint){ 0, 0, 0 };
+
+	if (pos >= 0) extend_column_index(ci, pos, INT64_MAX);
+	else extend_column_index(ci, INT64_MAX, width);
+
+	int64_t l = 0, r = ci->count - 1;
+	while(l < r) {
+		const int64_t m = (l + r + 1) / 2;
+		if (pos >= 0 ? ci->cp[m].pos <= pos : ci->cp[m].width <= width) l = m;
+		else r = m - 1;
+	}
+	return ci->cp[l];
+}
+
+
+/* Returns the position of a character of the given line descriptor whose
+   column is not greater than col, storing in *width its column, and in
+   *chars its character index. The character is as close as possible to col,
+   but there is no guarantee that it is the closest one. This is used to avoid
+   scanning long lines from the start. */
+
+int64_t find_column_checkpoint(const line_desc * const ld, const int64_t col, const int tab_size, const encoding_type encoding, int64_t * const width, int64_t * const chars) {
+	const column_checkpoint c = find_checkpoint(ld, tab_size, encoding, -1, col);
+	*width = c.width;
+	*chars = c.chars;
+	return c.pos;
+}
+
+
 /* Computes the TAB-expanded width of a line descriptor up to a certain
    position. The position can be greater than the line length, the usual
    convention of infinite expansion via spaces being in place. */
 
 int64_t calc_width(const line_desc * const ld, const int64_t n, const int tab_size, const encoding_type encoding) {
-
-	int64_t width = 0;
-	for(int64_t pos = 0; pos < n; pos = pos < ld->line_len ? next_pos(ld->line, pos, encoding) : pos + 1) {
+	const column_checkpoint c = find_checkpoint(ld, tab_size, encoding, n, 0);
+	int64_t width = c.width;
+	for(int64_t pos = c.pos; pos < n; pos = pos < ld->line_len ? next_pos(ld->line, pos, encoding) : pos + 1) {
 		if (pos >= ld->line_len) width++;
 		else if (ld->line[pos] != '\t') width += get_char_width(&ld->line[pos], encoding);
 		else width += tab_size - width % tab_size;
@@ -459,8 +626,13 @@ int64_t calc_width(const line_desc * const ld, const int64_t n, const int tab_si
 
 int64_t calc_width_hint(const line_desc * const ld, const int64_t n, const int tab_size, const encoding_type encoding, const int64_t cur_pos, const int64_t cur_width) {
 	if (cur_pos < n) {
-		int64_t width = cur_width;
-		for(int64_t pos = cur_pos; pos < n; pos = pos < ld->line_len ? next_pos(ld->line, pos, encoding) : pos + 1) {
+		int64_t width = cur_width, pos = cur_pos;
+		const column_checkpoint c = find_checkpoint(ld, tab_size, encoding, n, 0);
+		if (c.pos > pos) {
+			pos = c.pos;
+			width = c.width;
+		}
+		for(; pos < n; pos = pos < ld->line_len ? next_pos(ld->line, pos, encoding) : pos + 1) {
 			if (pos >= ld->line_len) width++;
 			else if (ld->line[pos] != '\t') width += get_char_width(&ld->line[pos], encoding);
 			else width += tab_size - width % tab_size;
@@ -485,9 +657,10 @@ int64_t calc_char_len(const line_desc * const ld, const encoding_type encoding)
    line length is returned. */
 
 int64_t calc_pos(const line_desc * const ld, const int64_t col, const int tab_size, const encoding_type encoding) {
+	const column_checkpoint c = find_checkpoint(ld, tab_size, encoding, -1, col);
 	int c_width;
-	int64_t pos = 0;
-	for(int64_t width = 0; pos < ld->line_len && width + (c_width = get_char_width(&ld->line[pos], encoding)) <= col; pos = next_pos(ld->line, pos, encoding)) {
+	int64_t pos = c.pos;
+	for(int64_t width = c.width; pos < ld->line_len && width + (c_width = get_char_width(&ld->line[pos], encoding)) <= col; pos = next_pos(ld->line, pos, encoding)) {
 		if (ld->line[pos] != '\t') width += c_width;
 		else width += tab_size - width % tab_size;
 	}
@@ -495,6 +668,16 @@ int64_t calc_pos(const line_desc * const ld, const int64_t col, const int tab_si
 	return pos;
 }
 
+/* Computes the index of the character at a given position of a line
+   descriptor. */
+
+int64_t calc_char_index(const line_desc * const ld, const int64_t pos, const int tab_size, const encoding_type encoding) {
+	const column_checkpoint c = find_checkpoint(ld, tab_size, encoding, pos, 0);
+	int64_t chars = c.chars;
+	for(int64_t p = c.pos; p < pos && p < ld->line_len; p = next_pos(ld->line, p, encoding)) chars++;
+	return chars;
+}
+
 /* Returns true if the specified character is invariant on the left edge of re-wrapped paragraphs */
 
 bool isparaspot(const int c) {
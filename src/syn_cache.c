@@ -0,0 +1,601 @@
+/* Cache of compiled syntax definitions.
+
+	Copyright (C) 1993-1998 Sebastiano Vigna
+	Copyright (C) 1999-2015 Todd M. Lewis and Sebastiano Vigna
+
+	This file is part of ne, the nice editor.
+
+	This library is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or (at your
+	option) any later version.
+
+	This library is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+#include <sys/mman.h>
+
+/* term.h defines tab as a terminfo capability. */
+#undef tab
+
+
+/* Loading a syntax parses its .jsf file, and the files of all syntaxes it
+   calls as subroutines; syntaxes called with different parameters (e.g.,
+   html from php) are parsed again each time. When a syntax has been loaded,
+   we save it, together with all syntaxes it calls, in a binary file in
+   ~/.ne/.syntax-cache, which is then used instead of the .jsf files as long
+   as they do not change.
+
+   A cache file is made of 32-bit words and of strings (a length and the
+   characters, followed by a NUL), in native byte order. It starts with a
+   header (magic string, version, byte-order check, length and hash of the
+   rest of the file), followed by the list of sources (for each syntax name,
+   the file it was read from, with its modification time, size and hash),
+   by a directory of the syntaxes (name, subroutine and parameters; the first
+   one is the cached syntax), and by the body of each syntax, preceded by its
+   length (its states, its commands, and the command of each state for each
+   character, run-length encoded). Commands are numbered from 1 within each syntax: 0 is the
+   default command, and NO_INDEX denotes a missing command, state or syntax.
+
+   The cache is valid only if each source is still the file that
+   find_syntax_file() would use, and it has the same modification time,
+   size and hash.
+
+   The header and the basic input/output functions are shared with the
+   startup cache (see startup.c). */
+
+#define CACHE_MAGIC "ne-jsc"
+#define CACHE_VERSION 1
+#define CACHE_ORDER 0x01020304
+#define NO_INDEX UINT32_MAX
+
+/* The flags of a command, in the order of the corresponding bits. */
+
+enum { F_NOEAT, F_START_BUFFERING, F_STOP_BUFFERING, F_SAVE_C, F_SAVE_S, F_IGNORE, F_START_MARK, F_STOP_MARK, F_RECOLOR_MARK, F_RTN, F_RESET };
+
+
+/* 64-bit FNV-1a hash. */
+
+uint64_t cache_fnv(const unsigned char * const p, const size_t len) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for(size_t i = 0; i < len; i++) h = (h ^ p[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+
+/* Computes the name of the cache file of a syntax. Returns 0 on success. */
+
+static int cache_file_name(const unsigned char * const name, char * const path, const size_t size) {
+	const char * const p = exists_prefs_dir();
+	if (!p || strchr((const char *)name, '/') || strlen(p) + 2 + strlen(SYNTAX_CACHE_DIR) + strlen((const char *)name) + strlen(SYNTAX_CACHE_EXT) >= size) return -1;
+	strcat(strcat(strcat(strcat(strcpy(path, p), SYNTAX_CACHE_DIR), "/"), (const char *)name), SYNTAX_CACHE_EXT);
+	return 0;
+}
+
+
+/* Maps a file in memory; returns NULL on failure. */
+
+unsigned char *cache_map_file(const char * const name, size_t * const len, struct stat * const st) {
+	const int fd = open(name, O_RDONLY);
+	if (fd < 0) return NULL;
+	unsigned char *p = NULL;
+	if (!fstat(fd, st) && S_ISREG(st->st_mode) && st->st_size > 0) {
+		*len = st->st_size;
+		if ((p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) p = NULL;
+	}
+	close(fd);
+	return p;
+}
+
+
+/* Functions to build a cache file in an output buffer. */
+
+void cache_put(struct cache_out * const o, const void * const v, const size_t len) {
+	if (o->len + len > o->size) {
+		o->size = (o->len + len) * 2;
+		o->p = joe_realloc(o->p, o->size);
+	}
+	memcpy(o->p + o->len, v, len);
+	o->len += len;
+}
+
+void cache_put_u32(struct cache_out * const o, const uint32_t v) {
+	cache_put(o, &v, sizeof v);
+}
+
+void cache_put_str(struct cache_out * const o, const unsigned char * const s) {
+	const uint32_t len = zlen((unsigned char *)s);
+	cache_put_u32(o, len);
+	cache_put(o, s, len + 1);
+}
+
+void cache_put_u64(struct cache_out * const o, const uint64_t v) {
+	cache_put_u32(o, v & 0xFFFFFFFF);
+	cache_put_u32(o, v >> 32);
+}
+
+
+/* Functions to read a cache file. Reading beyond the end sets the error
+   flag of the input cursor and returns zeroes or empty strings. */
+
+uint32_t cache_get_u32(struct cache_in * const i) {
+	uint32_t v = 0;
+	if (i->end - i->p < (ptrdiff_t)sizeof v) i->error = true;
+	else {
+		memcpy(&v, i->p, sizeof v);
+		i->p += sizeof v;
+	}
+	return v;
+}
+
+uint64_t cache_get_u64(struct cache_in * const i) {
+	const uint64_t lo = cache_get_u32(i);
+	return lo | (uint64_t)cache_get_u32(i) << 32;
+}
+
+unsigned char *cache_get_str(struct cache_in * const i) {
+	const uint32_t len = cache_get_u32(i);
+	if (i->error || i->end - i->p <= (ptrdiff_t)len || i->p[len]) {
+		i->error = true;
+		return USTR "";
+	}
+	unsigned char * const s = (unsigned char *)i->p;
+	i->p += len + 1;
+	return s;
+}
+
+
+/* Writes the contents of an output buffer to a cache file with the given
+   magic string and version, preceded by the header. We write to a temporary
+   file, and rename it. Returns 0 on success. */
+
+int cache_write(const char * const name, const char * const magic, const uint32_t version, const struct cache_out * const o) {
+	char tmp[1024 + 32];
+	snprintf(tmp, sizeof tmp, "%s.%d", name, (int)getpid());
+	FILE * const f = fopen(tmp, "w");
+	if (!f) return -1;
+
+	const uint32_t header[] = { version, CACHE_ORDER, o->len };
+	const uint64_t h = cache_fnv(o->p, o->len);
+	const size_t magic_len = strlen(magic) + 1;
+	bool error = fwrite(magic, 1, magic_len, f) != magic_len
+		|| fwrite(header, sizeof header, 1, f) != 1 || fwrite(&h, sizeof h, 1, f) != 1 || fwrite(o->p, 1, o->len, f) != o->len;
+	error |= fclose(f) != 0;
+	if (error || rename(tmp, name)) {
+		remove(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Maps a cache file with the given magic string and version, checks its
+   header, and sets up in to read its contents. Returns the mapped file
+   (to be unmapped by the caller, using the length stored in len), or NULL
+   if the file does not exist or it is not valid. */
+
+unsigned char *cache_map(const char * const name, const char * const magic, const uint32_t version, struct cache_in * const in, size_t * const len) {
+	struct stat st;
+	unsigned char * const map = cache_map_file(name, len, &st);
+	if (!map) return NULL;
+
+	uint32_t header[3];
+	uint64_t hash;
+	const size_t magic_len = strlen(magic) + 1, start = magic_len + sizeof header + sizeof hash;
+	if (*len >= start && !memcmp(map, magic, magic_len)) {
+		memcpy(header, map + magic_len, sizeof header);
+		memcpy(&hash, map + magic_len + sizeof header, sizeof hash);
+		if (header[0] == version && header[1] == CACHE_ORDER && header[2] == *len - start && cache_fnv(map + start, header[2]) == hash) {
+			in->p = map + start;
+			in->end = map + *len;
+			in->error = false;
+			return map;
+		}
+	}
+
+	munmap(map, *len);
+	return NULL;
+}
+
+
+/* A sorted table of the commands of a syntax, used to number them. */
+
+struct cmd_table {
+	struct high_cmd **cmd;
+	int n, size;
+};
+
+static void add_cmd(struct cmd_table * const t, struct high_cmd * const cmd) {
+	if (t->n == t->size) t->cmd = joe_realloc(t->cmd, sizeof *t->cmd * (t->size = t->size * 2 + 64));
+	t->cmd[t->n++] = cmd;
+}
+
+static int cmp_cmd(const void *a, const void *b) {
+	const uintptr_t x = (uintptr_t)*(struct high_cmd * const *)a, y = (uintptr_t)*(struct high_cmd * const *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Returns the number of a command (see above). */
+
+static uint32_t cmd_index(const struct high_syntax * const syntax, const struct cmd_table * const t, const struct high_cmd * const cmd) {
+	if (!cmd) return NO_INDEX;
+	if (cmd == &syntax->default_cmd) return 0;
+	struct high_cmd ** const c = bsearch(&cmd, t->cmd, t->n, sizeof *t->cmd, cmp_cmd);
+	assert(c != NULL);
+	return c - t->cmd + 1;
+}
+
+/* Returns the index of a syntax in the directory, adding it if necessary. */
+
+static uint32_t syntax_index(struct high_syntax *** const syn, int * const n, struct high_syntax * const syntax) {
+	if (!syntax) return NO_INDEX;
+	for(int i = 0; i < *n; i++) if ((*syn)[i] == syntax) return i;
+	*syn = joe_realloc(*syn, sizeof **syn * (*n + 1));
+	(*syn)[*n] = syntax;
+	return (*n)++;
+}
+
+
+/* Writes the body of a syntax, adding the syntaxes it calls to the
+   directory. */
+
+static void put_syntax(struct cache_out * const o, struct high_syntax * const syntax, struct high_syntax *** const syn, int * const nsyn) {
+	struct cmd_table t = { NULL, 0, 0 };
+
+	/* We collect the commands of the states, and then, until there are no new
+		ones, the keyword and delimiter commands of the commands collected. */
+	for(int i = 0; i < syntax->nstates; i++) {
+		for(int c = 0; c < 256; c++)
+			if (syntax->states[i]->cmd[c] != &syntax->default_cmd && (c == 0 || syntax->states[i]->cmd[c] != syntax->states[i]->cmd[c - 1]))
+				add_cmd(&t, syntax->states[i]->cmd[c]);
+		if (syntax->states[i]->delim) add_cmd(&t, syntax->states[i]->delim);
+	}
+
+	for(int n = -1;;) {
+		qsort(t.cmd, t.n, sizeof *t.cmd, cmp_cmd);
+		int m = 0;
+		for(int i = 0; i < t.n; i++) if (m == 0 || t.cmd[i] != t.cmd[m - 1]) t.cmd[m++] = t.cmd[i];
+		t.n = m;
+		if (m == n) break;
+		n = m;
+		for(int i = 0; i < n; i++) {
+			if (t.cmd[i]->delim && t.cmd[i]->delim != &syntax->default_cmd) add_cmd(&t, t.cmd[i]->delim);
+			if (t.cmd[i]->keywords)
+				for(unsigned x = 0; x < t.cmd[i]->keywords->len; x++)
+					for(HENTRY *e = t.cmd[i]->keywords->tab[x]; e; e = e->next)
+						if (e->val != &syntax->default_cmd) add_cmd(&t, e->val);
+		}
+	}
+
+	cache_put_u32(o, syntax->nstates);
+	for(int i = 0; i < syntax->nstates; i++) {
+		cache_put_str(o, syntax->states[i]->name);
+		cache_put_u32(o, syntax->states[i]->color);
+	}
+
+	cache_put_u32(o, t.n);
+	for(int i = 0; i < t.n; i++) {
+		const struct high_cmd * const cmd = t.cmd[i];
+		cache_put_u32(o, cmd->noeat << F_NOEAT | cmd->start_buffering << F_START_BUFFERING | cmd->stop_buffering << F_STOP_BUFFERING
+			| cmd->save_c << F_SAVE_C | cmd->save_s << F_SAVE_S | cmd->ignore << F_IGNORE | cmd->start_mark << F_START_MARK
+			| cmd->stop_mark << F_STOP_MARK | cmd->recolor_mark << F_RECOLOR_MARK | cmd->rtn << F_RTN | cmd->reset << F_RESET);
+		cache_put_u32(o, cmd->recolor);
+		cache_put_u32(o, cmd->new_state ? cmd->new_state->no : NO_INDEX);
+		cache_put_u32(o, cmd_index(syntax, &t, cmd->delim));
+		cache_put_u32(o, syntax_index(syn, nsyn, cmd->call));
+
+		/* Keywords are listed so that adding them in order to a table of the
+			same size yields the same chains. */
+		if (cmd->keywords) {
+			cache_put_u32(o, cmd->keywords->len);
+			cache_put_u32(o, cmd->keywords->nentries);
+			for(unsigned x = 0; x < cmd->keywords->len; x++) {
+				int k = 0;
+				for(HENTRY *e = cmd->keywords->tab[x]; e; e = e->next) k++;
+				while(k-- > 0) {
+					HENTRY *e = cmd->keywords->tab[x];
+					for(int j = 0; j < k; j++) e = e->next;
+					cache_put_str(o, e->name);
+					cache_put_u32(o, cmd_index(syntax, &t, e->val));
+				}
+			}
+		}
+		else cache_put_u32(o, 0);
+	}
+
+	for(int i = 0; i < syntax->nstates; i++) {
+		const struct high_state * const h = syntax->states[i];
+		cache_put_u32(o, cmd_index(syntax, &t, h->delim));
+		for(int c = 0, d; c < 256; c = d) {
+			for(d = c + 1; d < 256 && h->cmd[d] == h->cmd[c]; d++);
+			cache_put_u32(o, d - c);
+			cache_put_u32(o, cmd_index(syntax, &t, h->cmd[c]));
+		}
+	}
+
+	joe_free(t.cmd);
+}
+
+
+/* Writes the description of a syntax in the directory. */
+
+static void put_syntax_name(struct cache_out * const o, const struct high_syntax * const syntax) {
+	cache_put_str(o, syntax->name);
+	cache_put_str(o, syntax->subr ? syntax->subr : USTR "");
+	cache_put_u32(o, syntax->subr != NULL);
+	int n = 0;
+	for(struct high_param *p = syntax->params; p; p = p->next) n++;
+	cache_put_u32(o, n);
+	for(struct high_param *p = syntax->params; p; p = p->next) cache_put_str(o, p->name);
+}
+
+
+/* Saves a syntax that has just been loaded, together with all syntaxes it
+   calls, in the syntax cache. Errors are ignored: the cache is just not
+   written. */
+
+void save_cached_syntax(struct high_syntax *syntax) {
+	char name[1024];
+	if (cache_file_name(syntax->name, name, sizeof name)) return;
+
+	struct high_syntax **syn = NULL;
+	int nsyn = 0;
+	struct cache_out body = { NULL, 0, 0 }, o = { NULL, 0, 0 };
+
+	/* Writing a body might add syntaxes to the directory. */
+	syntax_index(&syn, &nsyn, syntax);
+	for(int i = 0; i < nsyn; i++) {
+		struct cache_out b = { NULL, 0, 0 };
+		put_syntax(&b, syn[i], &syn, &nsyn);
+		cache_put_u32(&body, b.len);
+		cache_put(&body, b.p, b.len);
+		joe_free(b.p);
+	}
+
+	/* The sources: one for each syntax name. */
+	int nsrc = 0;
+	for(int i = 0; i < nsyn; i++) {
+		int j;
+		for(j = 0; j < i && zcmp(syn[j]->name, syn[i]->name); j++);
+		if (j == i) nsrc++;
+	}
+	cache_put_u32(&o, nsrc);
+	for(int i = 0; i < nsyn; i++) {
+		int j;
+		for(j = 0; j < i && zcmp(syn[j]->name, syn[i]->name); j++);
+		if (j < i) continue;
+
+		char path[1024];
+		struct stat st;
+		size_t len;
+		unsigned char *p;
+		if (find_syntax_file(syn[i]->name, path, sizeof path) || !(p = cache_map_file(path, &len, &st))) goto done;
+		cache_put_str(&o, syn[i]->name);
+		cache_put_str(&o, (unsigned char *)path);
+		cache_put_u64(&o, st.st_mtime);
+		cache_put_u64(&o, st.st_size);
+		cache_put_u64(&o, cache_fnv(p, len));
+		munmap(p, len);
+	}
+
+	cache_put_u32(&o, nsyn);
+	for(int i = 0; i < nsyn; i++) put_syntax_name(&o, syn[i]);
+	cache_put(&o, body.p, body.len);
+
+	char dir[1024];
+	strcpy(dir, name);
+	*strrchr(dir, '/') = 0;
+	mkdir(dir, 0700);
+	cache_write(name, CACHE_MAGIC, CACHE_VERSION, &o);
+
+	done:
+	joe_free(syn);
+	joe_free(body.p);
+	joe_free(o.p);
+}
+
+
+/* Returns true if the sources of a cache file have not changed. */
+
+static bool valid_sources(struct cache_in * const in) {
+	for(uint32_t n = cache_get_u32(in); n-- > 0 && !in->error;) {
+		const unsigned char * const name = cache_get_str(in), * const path = cache_get_str(in);
+		const uint64_t mtime = cache_get_u64(in), size = cache_get_u64(in), hash = cache_get_u64(in);
+		if (in->error) return false;
+
+		char cur_path[1024];
+		struct stat st;
+		size_t len;
+		unsigned char *p;
+		if (find_syntax_file(name, cur_path, sizeof cur_path) || strcmp(cur_path, (const char *)path) || !(p = cache_map_file(cur_path, &len, &st))) return false;
+		const bool same = st.st_mtime == mtime && st.st_size == size && cache_fnv(p, len) == hash;
+		munmap(p, len);
+		if (!same) return false;
+	}
+	return !in->error;
+}
+
+
+/* Returns the command with the given number, setting the error flag of in
+   if the number is out of range. */
+
+static struct high_cmd *cmd_at(struct cache_in * const in, struct high_cmd ** const cmd, const uint32_t ncmds, const uint32_t i) {
+	if (i == NO_INDEX) return NULL;
+	if (i <= ncmds) return cmd[i];
+	in->error = true;
+	return NULL;
+}
+
+
+/* Reads the body of a syntax, filling the given (new) syntax; syntaxes
+   contains the syntaxes of the directory, for calls. */
+
+static void get_syntax(struct cache_in * const in, struct high_syntax * const syntax, struct high_syntax ** const syntaxes, const uint32_t nsyntaxes) {
+	const uint32_t nstates = cache_get_u32(in);
+	if (in->error || nstates == 0 || nstates > (uint32_t)(in->end - in->p)) {
+		in->error = true;
+		return;
+	}
+
+	syntax->states = joe_malloc(sizeof(struct high_state *) * (syntax->szstates = syntax->nstates = nstates));
+	syntax->ht_states = htmk(64);
+	for(uint32_t i = 0; i < nstates; i++) {
+		struct high_state * const h = syntax->states[i] = joe_calloc(1, sizeof(struct high_state));
+		h->no = i;
+		h->name = zdup(cache_get_str(in));
+		h->color = cache_get_u32(in);
+		h->delim = NULL;
+		htadd(syntax->ht_states, h->name, h);
+	}
+
+	const uint32_t ncmds = cache_get_u32(in);
+	if (in->error || ncmds > (uint32_t)(in->end - in->p)) {
+		in->error = true;
+		return;
+	}
+
+	/* The first command is the default one. */
+	struct high_cmd ** const cmd = joe_malloc(sizeof *cmd * (ncmds + 1));
+	cmd[0] = &syntax->default_cmd;
+	for(uint32_t i = 1; i <= ncmds; i++) cmd[i] = joe_calloc(1, sizeof(struct high_cmd));
+
+	for(uint32_t i = 1; i <= ncmds && !in->error; i++) {
+		struct high_cmd * const c = cmd[i];
+		const uint32_t flags = cache_get_u32(in);
+		c->noeat = flags >> F_NOEAT & 1;
+		c->start_buffering = flags >> F_START_BUFFERING & 1;
+		c->stop_buffering = flags >> F_STOP_BUFFERING & 1;
+		c->save_c = flags >> F_SAVE_C & 1;
+		c->save_s = flags >> F_SAVE_S & 1;
+		c->ignore = flags >> F_IGNORE & 1;
+		c->start_mark = flags >> F_START_MARK & 1;
+		c->stop_mark = flags >> F_STOP_MARK & 1;
+		c->recolor_mark = flags >> F_RECOLOR_MARK & 1;
+		c->rtn = flags >> F_RTN & 1;
+		c->reset = flags >> F_RESET & 1;
+		c->recolor = (int32_t)cache_get_u32(in);
+		const uint32_t new_state = cache_get_u32(in), delim = cache_get_u32(in), call = cache_get_u32(in);
+		c->new_state = new_state == NO_INDEX ? NULL : new_state < nstates ? syntax->states[new_state] : (in->error = true, NULL);
+		c->delim = cmd_at(in, cmd, ncmds, delim);
+		c->call = call == NO_INDEX ? NULL : call < nsyntaxes ? syntaxes[call] : (in->error = true, NULL);
+
+		const uint32_t len = cache_get_u32(in);
+		if (len) {
+			if (len & len - 1) in->error = true;
+			const uint32_t nkw = cache_get_u32(in);
+			if (in->error || nkw >= (len >> 1) + (len >> 2)) {
+				in->error = true;
+				break;
+			}
+			c->keywords = htmk(len);
+			for(uint32_t k = 0; k < nkw && !in->error; k++) {
+				unsigned char * const kw = zdup(cache_get_str(in));
+				htadd(c->keywords, kw, cmd_at(in, cmd, ncmds, cache_get_u32(in)));
+			}
+		}
+	}
+
+	for(uint32_t i = 0; i < nstates && !in->error; i++) {
+		struct high_state * const h = syntax->states[i];
+		h->delim = cmd_at(in, cmd, ncmds, cache_get_u32(in));
+		for(uint32_t c = 0; c < 256 && !in->error;) {
+			uint32_t run = cache_get_u32(in);
+			const uint32_t k = cache_get_u32(in);
+			if (run == 0 || run > 256 - c || k == NO_INDEX) in->error = true;
+			else for(struct high_cmd * const x = cmd_at(in, cmd, ncmds, k); run-- > 0 && c < 256;) h->cmd[c++] = x;
+		}
+	}
+
+	joe_free(cmd);
+}
+
+
+/* Loads a syntax, and all syntaxes it calls, from the syntax cache. Returns
+   NULL if the cache is missing or invalid. Syntaxes of the cache that have
+   been already loaded are not read again. */
+
+struct high_syntax *load_cached_syntax(unsigned char *name) {
+	char file_name[1024];
+	if (cache_file_name(name, file_name, sizeof file_name)) return NULL;
+
+	struct cache_in in;
+	size_t len;
+	unsigned char * const map = cache_map(file_name, CACHE_MAGIC, CACHE_VERSION, &in, &len);
+	if (!map) return NULL;
+
+	struct high_syntax **syntaxes = NULL, *result = NULL;
+	bool *is_new = NULL;
+	uint32_t nsyntaxes = 0;
+
+	if (!valid_sources(&in)) goto done;
+
+	/* Directory: we reuse syntaxes that have been already loaded. */
+	nsyntaxes = cache_get_u32(&in);
+	if (in.error || nsyntaxes == 0 || nsyntaxes > (uint32_t)(in.end - in.p)) goto done;
+	syntaxes = joe_calloc(nsyntaxes, sizeof *syntaxes);
+	is_new = joe_calloc(nsyntaxes, sizeof *is_new);
+
+	for(uint32_t i = 0; i < nsyntaxes && !in.error; i++) {
+		unsigned char * const s_name = cache_get_str(&in), * const s_subr = cache_get_str(&in);
+		const bool has_subr = cache_get_u32(&in);
+		struct high_param *params = NULL, **param_ptr = &params;
+		for(uint32_t n = cache_get_u32(&in); n-- > 0 && !in.error;) {
+			*param_ptr = joe_malloc(sizeof(struct high_param));
+			(*param_ptr)->name = zdup(cache_get_str(&in));
+			(*param_ptr)->next = NULL;
+			param_ptr = &(*param_ptr)->next;
+		}
+		if (in.error) break;
+
+		struct high_syntax *syntax;
+		for(syntax = syntax_list; syntax; syntax = syntax->next)
+			if (syntax_match(syntax, s_name, has_subr ? s_subr : NULL, params)) break;
+
+		if (syntax) syntaxes[i] = syntax;
+		else {
+			syntax = syntaxes[i] = joe_calloc(1, sizeof(struct high_syntax));
+			syntax->name = zdup(s_name);
+			syntax->subr = has_subr ? zdup(s_subr) : NULL;
+			syntax->params = params;
+			syntax->default_cmd.reset = 1;
+			is_new[i] = true;
+		}
+	}
+
+	/* Bodies, each preceded by its length. Corrupted files are rejected by
+		the hash above, so on error we just give up, leaking the partially
+		built syntaxes. */
+	for(uint32_t i = 0; i < nsyntaxes && !in.error; i++) {
+		const uint32_t body_len = cache_get_u32(&in);
+		if (in.error || body_len > (uint32_t)(in.end - in.p)) in.error = true;
+		else {
+			struct cache_in body = { in.p, in.p + body_len, false };
+			if (is_new[i]) get_syntax(&body, syntaxes[i], syntaxes, nsyntaxes);
+			in.error = body.error;
+			in.p += body_len;
+		}
+	}
+
+	if (!in.error) {
+		for(uint32_t i = 0; i < nsyntaxes; i++)
+			if (is_new[i]) {
+				syntaxes[i]->next = syntax_list;
+				syntax_list = syntaxes[i];
+				compile_dfa(syntaxes[i]);
+			}
+		result = syntaxes[0];
+	}
+
+	done:
+	joe_free(syntaxes);
+	joe_free(is_new);
+	munmap(map, len);
+	return result;
+}
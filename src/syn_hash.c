@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdint.h>
+#include <ctype.h>
 
 #define PARAMS(protos) protos
 #include "syn_types.h"
@@ -141,3 +143,165 @@ void *htfind(HASH *ht, unsigned char *name)
 	}
 	return NULL;
 }
+
+/* Perfect hash tables (hash and displace). Names are hashed once into 64
+ * bits: the lower half selects a bucket, and the upper half, combined with
+ * the displacement of the bucket, selects a slot. The displacements are
+ * chosen bucket by bucket, larger buckets first, so that all names land in
+ * different slots; there are at least twice as many slots as names, so few
+ * displacements have to be tried. Lookups hash the name, and compare it with
+ * the only name that can match. */
+
+#define PH_MAX_DISP (1 << 16)
+#define PH_MAX_SLOTS (1 << 20)
+
+static uint64_t phash(unsigned char *s, int fold, unsigned *len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned char *t;
+
+	for (t = s; *t; ++t)
+		h = (h ^ (fold ? tolower(*t) : *t)) * 0x100000001b3ULL;
+	*len = t - s;
+	h ^= h >> 32;
+	h *= 0xff51afd7ed558ccdULL;
+	return h ^ h >> 29;
+}
+
+static unsigned phslot(PHASH *ph, uint64_t h, unsigned disp)
+{
+	return ((uint32_t)(h >> 32) ^ disp) * 0x9e3779b1U >> ph->shift;
+}
+
+/* Try to place the names with displacements; returns 0 on success */
+static int phplace(PHASH *ph, unsigned n, uint64_t *hval, unsigned *next, unsigned *first, unsigned *size, unsigned max_size)
+{
+	unsigned nslots = 1U << (32 - ph->shift);
+	unsigned char *used = (unsigned char *)joe_calloc(nslots, 1);
+	unsigned s, b, i, j, d;
+
+	for (s = max_size; s > 0; --s)
+		for (b = 0; b != ph->nbuckets; ++b) {
+			if (size[b] != s)
+				continue;
+			for (d = 0; d != PH_MAX_DISP; ++d) {
+				for (i = first[b]; i != n; i = next[i]) {
+					unsigned slot = phslot(ph, hval[i], d);
+					if (used[slot])
+						break;
+					used[slot] = 2;
+				}
+				/* Undo the tentative marks */
+				for (j = first[b]; j != i; j = next[j])
+					used[phslot(ph, hval[j], d)] = 0;
+				if (i == n)
+					break;
+			}
+			if (d == PH_MAX_DISP) {
+				joe_free(used);
+				return -1;
+			}
+			ph->disp[b] = d;
+			for (i = first[b]; i != n; i = next[i])
+				used[phslot(ph, hval[i], d)] = 1;
+		}
+
+	joe_free(used);
+	return 0;
+}
+
+PHASH *phmk(HASH *ht, int fold)
+{
+	PHASH *ph;
+	HENTRY *e, *f;
+	HENTRY **entry;
+	uint64_t *hval;
+	unsigned *len, *bucket, *next, *first, *size;
+	unsigned n = 0, x, i, nslots, max_size;
+
+	/* Collect the names; for duplicates, the first in the chain is the one
+	   htfind() returns */
+	entry = (HENTRY **)joe_malloc(sizeof(HENTRY *) * (ht->nentries + 1));
+	for (x = 0; x != ht->len; ++x)
+		for (e = ht->tab[x]; e; e = e->next) {
+			for (f = ht->tab[x]; f != e && zcmp(f->name, e->name); f = f->next);
+			if (f == e)
+				entry[n++] = e;
+		}
+	if (!n) {
+		joe_free(entry);
+		return NULL;
+	}
+
+	ph = (PHASH *)joe_malloc(sizeof(PHASH));
+	ph->fold = fold;
+	for (ph->nbuckets = 1; ph->nbuckets * 4 < n; ph->nbuckets *= 2);
+	ph->disp = (unsigned *)joe_calloc(ph->nbuckets, sizeof(unsigned));
+
+	hval = (uint64_t *)joe_malloc(sizeof(uint64_t) * n);
+	len = (unsigned *)joe_malloc(sizeof(unsigned) * n);
+	bucket = (unsigned *)joe_malloc(sizeof(unsigned) * n);
+	next = (unsigned *)joe_malloc(sizeof(unsigned) * n);
+	first = (unsigned *)joe_malloc(sizeof(unsigned) * ph->nbuckets);
+	size = (unsigned *)joe_calloc(ph->nbuckets, sizeof(unsigned));
+
+	/* Link the names of each bucket (n ends the lists) */
+	for (x = 0; x != ph->nbuckets; ++x)
+		first[x] = n;
+	max_size = 0;
+	for (i = 0; i != n; ++i) {
+		hval[i] = phash(entry[i]->name, fold, &len[i]);
+		bucket[i] = hval[i] & (ph->nbuckets - 1);
+		next[i] = first[bucket[i]];
+		first[bucket[i]] = i;
+		if (++size[bucket[i]] > max_size)
+			max_size = size[bucket[i]];
+	}
+
+	for (nslots = 2; nslots < 2 * n; nslots *= 2);
+	for (;; nslots *= 2) {
+		for (ph->shift = 32; 1U << (32 - ph->shift) < nslots; --ph->shift);
+		if (nslots > PH_MAX_SLOTS || !phplace(ph, n, hval, next, first, size, max_size))
+			break;
+	}
+
+	if (nslots > PH_MAX_SLOTS) {
+		joe_free(ph->disp);
+		joe_free(ph);
+		ph = NULL;
+	} else {
+		ph->tab = (struct phentry *)joe_calloc(nslots, sizeof(struct phentry));
+		for (i = 0; i != n; ++i) {
+			struct phentry *p = &ph->tab[phslot(ph, hval[i], ph->disp[bucket[i]])];
+			p->name = entry[i]->name;
+			p->len = len[i];
+			p->val = entry[i]->val;
+		}
+	}
+
+	joe_free(entry);
+	joe_free(hval);
+	joe_free(len);
+	joe_free(bucket);
+	joe_free(next);
+	joe_free(first);
+	joe_free(size);
+	return ph;
+}
+
+void *phfind(PHASH *ph, unsigned char *name)
+{
+	unsigned len, i;
+	uint64_t h = phash(name, ph->fold, &len);
+	struct phentry *e = &ph->tab[phslot(ph, h, ph->disp[h & (ph->nbuckets - 1)])];
+
+	if (!e->name || e->len != len)
+		return NULL;
+	if (ph->fold) {
+		for (i = 0; i != len; ++i)
+			if (tolower(name[i]) != e->name[i])
+				return NULL;
+	} else if (memcmp(name, e->name, len))
+		return NULL;
+	return e->val;
+}
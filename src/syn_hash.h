@@ -35,6 +35,23 @@ struct hash {
 	unsigned nentries;
 };
 
+/* Perfect hash table: a read-only copy of a hash table in which each name
+   has its own slot, found through the displacement of its bucket. */
+
+struct phentry {
+	unsigned char *name;	/* NULL for empty slots */
+	unsigned len;
+	void *val;
+};
+
+struct phash {
+	unsigned nbuckets;	/* Power of 2 */
+	unsigned shift;		/* 32 - log2 of the number of slots */
+	int fold;		/* Set for case-insensitive lookups */
+	unsigned *disp;		/* Displacement of each bucket */
+	struct phentry *tab;
+};
+
 /* Compute hash code for a string */
 unsigned long hash PARAMS((unsigned char *s));
 
@@ -51,4 +68,11 @@ void *htadd PARAMS((HASH *ht, unsigned char *name, void *val));
 /* Look up an entry in a hash table, returns NULL if not found */
 void *htfind PARAMS((HASH *ht, unsigned char *name));
 
+/* Build a perfect hash table with the entries of a hash table (whose names
+  must be lower case if fold is set), or return NULL if none can be found */
+PHASH *phmk PARAMS((HASH *ht, int fold));
+
+/* Look up an entry in a perfect hash table, returns NULL if not found */
+void *phfind PARAMS((PHASH *ph, unsigned char *name));
+
 #endif
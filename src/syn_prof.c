@@ -0,0 +1,259 @@
+/* Syntax highlighting profiler.
+
+	Copyright (C) 1993-1998 Sebastiano Vigna
+	Copyright (C) 1999-2015 Todd M. Lewis and Sebastiano Vigna
+
+	This file is part of ne, the nice editor.
+
+	This library is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or (at your
+	option) any later version.
+
+	This library is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+#include <time.h>
+
+/* term.h defines tab as a terminfo capability. */
+#undef tab
+
+
+/* SyntaxStats parses the whole buffer twice. The first pass is timed (and
+   repeated for at least PROFILE_MIN_NS nanoseconds) to compute the
+   throughput of the parser. During the second pass syntax_profiling is set,
+   so parse_chars() counts the characters parsed in each state (a character
+   given to another state by noeat is counted again), the keyword lookups of
+   each state and their hits, the number of times each command is taken from
+   each state (see count_transition()), and in syntax_profile the subroutine
+   calls, returns and resets; moreover, each line is timed. The counters of
+   all loaded syntaxes are cleared before the second pass. */
+
+#define PROFILE_MIN_NS (100 * 1000000)
+
+bool syntax_profiling;
+struct syntax_profile syntax_profile;
+
+
+static uint64_t time_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * (uint64_t)1000000000 + t.tv_nsec;
+}
+
+
+/* Commands can be shared by several states (e.g., the default command of a
+   syntax), so the number of times a command is taken is kept for each (state,
+   command) pair, in an open-addressing hash table whose size is a power of
+   two and which is at most half full. */
+
+struct transition {
+	const struct high_state *h;
+	const struct high_cmd *cmd;
+	uint64_t count;
+};
+
+static struct transition *transition;
+static size_t transition_size, transition_count;
+
+
+static size_t transition_slot(const struct transition * const t, const size_t size, const struct high_state * const h, const struct high_cmd * const cmd) {
+	size_t i = (size_t)((((uintptr_t)h * 31) ^ (uintptr_t)cmd) * UINT64_C(0x9E3779B97F4A7C15) >> 32) & (size - 1);
+	while(t[i].h && (t[i].h != h || t[i].cmd != cmd)) i = (i + 1) & (size - 1);
+	return i;
+}
+
+
+/* Records that the given command has been taken from the given state. If we
+   run out of memory, the transition is not counted. */
+
+void count_transition(const struct high_state * const h, const struct high_cmd * const cmd) {
+	if (transition_count * 2 >= transition_size) {
+		const size_t size = transition_size ? transition_size * 2 : 1024;
+		struct transition * const t = calloc(size, sizeof *t);
+		if (!t) return;
+		for(size_t i = 0; i < transition_size; i++)
+			if (transition[i].h) t[transition_slot(t, size, transition[i].h, transition[i].cmd)] = transition[i];
+		free(transition);
+		transition = t;
+		transition_size = size;
+	}
+
+	struct transition * const t = &transition[transition_slot(transition, transition_size, h, cmd)];
+	if (!t->h) {
+		t->h = h;
+		t->cmd = cmd;
+		transition_count++;
+	}
+	t->count++;
+}
+
+
+static void clear_counters(void) {
+	for(struct high_syntax *syntax = syntax_list; syntax; syntax = syntax->next)
+		for(int i = 0; i < syntax->nstates; i++) {
+			struct high_state * const h = syntax->states[i];
+			h->visits = h->keyword_lookups = h->keyword_hits = 0;
+		}
+	free(transition);
+	transition = NULL;
+	transition_size = transition_count = 0;
+	memset(&syntax_profile, 0, sizeof syntax_profile);
+}
+
+
+/* Writes into s (of the given size) the qualified name of a state, in the
+   form syntax[.subroutine]:state. */
+
+static void state_name(char * const s, const size_t size, const struct high_state * const h) {
+	const struct high_syntax * const syntax = h->syntax;
+	snprintf(s, size, "%s%s%s:%s", syntax->name, syntax->subr ? "." : "", syntax->subr ? (char *)syntax->subr : "", h->name);
+}
+
+
+static int cmp_visits(const void *x, const void *y) {
+	const struct high_state * const a = *(struct high_state * const *)x, * const b = *(struct high_state * const *)y;
+	return a->visits > b->visits ? -1 : a->visits < b->visits;
+}
+
+
+/* Returns an array (to be freed) of the states of all loaded syntaxes that
+   have been visited, sorted by decreasing number of visits, and stores its
+   length in *n. */
+
+static struct high_state **visited_states(int * const n) {
+	int count = 0;
+	for(struct high_syntax *syntax = syntax_list; syntax; syntax = syntax->next)
+		for(int i = 0; i < syntax->nstates; i++)
+			if (syntax->states[i]->visits) count++;
+
+	struct high_state ** const state = malloc((count + 1) * sizeof *state);
+	if (!state) return NULL;
+
+	*n = 0;
+	for(struct high_syntax *syntax = syntax_list; syntax; syntax = syntax->next)
+		for(int i = 0; i < syntax->nstates; i++)
+			if (syntax->states[i]->visits) state[(*n)++] = syntax->states[i];
+	qsort(state, *n, sizeof *state, cmp_visits);
+	return state;
+}
+
+
+/* Saves the transitions taken from the given state. */
+
+static void save_transitions(FILE * const f, const struct high_state * const h) {
+	for(size_t i = 0; i < transition_size; i++) {
+		if (transition[i].h != h) continue;
+		const struct high_cmd * const cmd = transition[i].cmd;
+		char from[256], to[256];
+		state_name(from, sizeof from, h);
+		if (cmd->call) snprintf(to, sizeof to, "call:%s%s%s", cmd->call->name, cmd->call->subr ? "." : "", cmd->call->subr ? (char *)cmd->call->subr : "");
+		else if (cmd->rtn) strcpy(to, "return");
+		else if (cmd->reset) strcpy(to, "reset");
+		else state_name(to, sizeof to, cmd->new_state);
+		fprintf(f, "transition %s %s %" PRIu64 "\n", from, to, transition[i].count);
+	}
+}
+
+
+/* Profiles the syntax highlighting of the given buffer. If name is not NULL,
+   the results are saved in the file with the given name, one "name value"
+   pair per line (states are followed by their visits, keyword lookups and
+   hits; transitions by their source, target and count); otherwise, a summary
+   is written into msg (of the given size). */
+
+int syntax_stats(buffer * const b, const char * const name, char * const msg, const size_t size) {
+	if (!do_syntax) return SYNTAX_NOT_ENABLED;
+	if (!b->syn) return NO_SYNTAX;
+
+	const bool utf8 = b->encoding == ENC_UTF8;
+	const HIGHLIGHT_STATE idle = { 0, 0, "" };
+	HIGHLIGHT_STATE h_state;
+	int64_t bytes = 0, passes = 0;
+	uint64_t elapsed = 0;
+
+	for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next; ld = (line_desc *)ld->ld_node.next) bytes += ld->line_len + 1;
+
+	do {
+		const uint64_t start = time_ns();
+		h_state = idle;
+		for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next; ld = (line_desc *)ld->ld_node.next)
+			h_state = parse_line(b->syn, ld, h_state, utf8);
+		elapsed += time_ns() - start;
+		passes++;
+	} while(elapsed < PROFILE_MIN_NS && !stop);
+
+	if (stop) return STOPPED;
+
+	uint64_t max_ns = 0, total_ns = 0;
+	int64_t slowest = 0, line = 0;
+
+	clear_counters();
+	syntax_profiling = true;
+	h_state = idle;
+	for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next; ld = (line_desc *)ld->ld_node.next, line++) {
+		const uint64_t start = time_ns();
+		h_state = parse_line(b->syn, ld, h_state, utf8);
+		const uint64_t t = time_ns() - start;
+		total_ns += t;
+		if (t > max_ns) {
+			max_ns = t;
+			slowest = line;
+		}
+	}
+	syntax_profiling = false;
+
+	const double mb_per_s = elapsed ? bytes * passes * 1e3 / elapsed : 0;
+	uint64_t visits = 0, lookups = 0, hits = 0;
+	int n;
+	struct high_state ** const state = visited_states(&n);
+	if (!state) return OUT_OF_MEMORY;
+
+	for(int i = 0; i < n; i++) {
+		visits += state[i]->visits;
+		lookups += state[i]->keyword_lookups;
+		hits += state[i]->keyword_hits;
+	}
+
+	if (name) {
+		FILE * const f = fopen(name, "w");
+		if (!f) {
+			free(state);
+			return CANT_OPEN_FILE;
+		}
+
+		fprintf(f, "syntax %s\nbytes %" PRId64 "\nlines %" PRId64 "\npasses %" PRId64 "\nns %" PRIu64 "\nmb_per_s %.2f\n", b->syn->name, bytes, b->num_lines, passes, elapsed, mb_per_s);
+		fprintf(f, "line_ns.sum %" PRIu64 "\nline_ns.max %" PRIu64 "\nline_ns.slowest_line %" PRId64 "\n", total_ns, max_ns, slowest + 1);
+		fprintf(f, "visits %" PRIu64 "\nkeyword_lookups %" PRIu64 "\nkeyword_hits %" PRIu64 "\n", visits, lookups, hits);
+		fprintf(f, "calls %" PRIu64 "\nreturns %" PRIu64 "\nresets %" PRIu64 "\nmax_depth %d\nframes %d\n", syntax_profile.calls, syntax_profile.returns, syntax_profile.resets, syntax_profile.max_depth, stack_count);
+		for(int i = 0; i < n; i++) {
+			char s[256];
+			state_name(s, sizeof s, state[i]);
+			fprintf(f, "state %s %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", s, state[i]->visits, state[i]->keyword_lookups, state[i]->keyword_hits);
+		}
+		for(int i = 0; i < n; i++) save_transitions(f, state[i]);
+
+		free(state);
+		const bool error = ferror(f);
+		return fclose(f) || error ? ERROR_WHILE_WRITING : OK;
+	}
+
+	int l = snprintf(msg, size, "%.1f MB/s; hottest states:", mb_per_s);
+	for(int i = 0; i < n && i < 3 && l < size; i++) {
+		char s[256];
+		state_name(s, sizeof s, state[i]);
+		l += snprintf(msg + l, size - l, " %s %.0f%%", s, state[i]->visits * 100. / visits);
+	}
+	if (l < size) snprintf(msg + l, size - l, "; %" PRIu64 " keyword lookups (%.0f%% found); %" PRIu64 " calls, depth %d; slowest line %" PRId64 " (%.2f ms).",
+		lookups, lookups ? hits * 100. / lookups : 0, syntax_profile.calls, syntax_profile.max_depth, slowest + 1, max_ns / 1e6);
+
+	free(state);
+	return OK;
+}
@@ -89,6 +89,7 @@ typedef struct macro MACRO;
 typedef struct cmd CMD;
 typedef struct entry HENTRY;
 typedef struct hash HASH;
+typedef struct phash PHASH;
 typedef struct bw BW;
 typedef struct scrn SCRN;
 typedef struct cap CAP;
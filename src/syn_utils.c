@@ -94,6 +94,13 @@ int zcmp(unsigned char *a, unsigned char *b)
 	return strcmp((char *)a, (char *)b);
 }
 
+int zicmp(unsigned char *a, unsigned char *b)
+{
+	while (*a && tolower(*a) == tolower(*b))
+		++a, ++b;
+	return tolower(*a) - tolower(*b);
+}
+
 int zncmp(unsigned char *a, unsigned char *b, size_t len)
 {
 	return strncmp((char *)a, (char *)b, len);
@@ -0,0 +1,42 @@
+#!/bin/sh
+
+# synbench.sh runs ne with each syntax definition in ../syntax over a corpus,
+# and reports the speed of the parser in megabytes per second, as measured
+# by the SyntaxStats command. Files defining just subroutines, which cannot
+# be used as syntaxes, are skipped. The corpus is made of the files given as
+# arguments or, by default, of ne's own sources, documentation, syntax
+# definitions and macros.
+#
+# Since ne needs a terminal, this script must be run from one. The easiest
+# way to use it is "make benchmark". The binary can be specified using the
+# NE environment variable (by default, ./ne).
+
+NE=${NE:-./ne}
+
+if [ $# -eq 0 ]; then set -- *.c *.h *.pl ../doc/ne.texinfo ../syntax/*.jsf ../macros/*; fi
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+cat "$@" > "$dir/corpus" || exit 1
+
+syntaxes=
+for s in ../syntax/*.jsf; do
+	awk '/^\.subr/ { s = 1 } /^\.end/ { s = 0 } /^:/ && !s { f = 1 } END { exit !f }' "$s" && syntaxes="$syntaxes $(basename "$s" .jsf)"
+done
+
+for n in $syntaxes; do
+	echo "Syntax $n"
+	echo "SyntaxStats $dir/$n.stats"
+done > "$dir/macro"
+echo "Quit" >> "$dir/macro"
+
+NE_GLOBAL_DIR=.. "$NE" --no-config --macro "$dir/macro" "$dir/corpus" || exit 1
+
+echo "Corpus: $(wc -c < "$dir/corpus") bytes"
+for n in $syntaxes; do
+	if [ -f "$dir/$n.stats" ]; then
+		awk -v n="$n" '$1 == "mb_per_s" { s = $2 } $1 == "state" && !h { h = $2 } END { printf "%-16s %8.2f MB/s  (hottest state %s)\n", n, s, h }' "$dir/$n.stats"
+	else
+		printf "%-16s   failed\n" "$n"
+	fi
+done
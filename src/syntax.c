@@ -21,6 +21,10 @@
 
 #include "ne.h"
 #include "termchar.h"
+
+#ifndef NOTHREADS
+#include <pthread.h>
+#endif
 #undef joe_gettext
 #define joe_gettext(a) (a)
 
@@ -166,17 +170,66 @@ unsigned char *lowerize(unsigned char *s) {
 
 /* Parse one line.  Returns new state.
    'syntax' is the loaded syntax definition for this buffer.
-   'line' is advanced to start of next line.
-   Global array 'attr_buf' end up with coloring for each character of line (attr_len characters).
-   'state' is initial parser state for the line (0 is initial state). */
-
-uint32_t *attr_buf = 0;	
-int64_t attr_size = 0;
-int64_t attr_len = 0;
+   Global array 'attr_buf' ends up with coloring for the characters of the
+   line starting at character 'attr_start' (attr_len characters); the
+   character 'attr_start' starts at byte 'attr_start_pos'.
+   'state' is initial parser state for the line (0 is initial state).
+
+   Lines shorter than PARSE_INDEX_MIN_LEN bytes are parsed completely (so
+   attr_start is 0). On longer lines attributes are computed only for the
+   characters from 'from' to 'to' (excluded) plus a margin of
+   PARSE_WINDOW_MARGIN characters on both sides, and attr_start is exactly
+   'from' minus the margin (or 0). In this case parsing resumes from the
+   checkpoints of a parse index (see below), so its cost and the size of
+   attr_buf depend on the size of the window, not on the length of the line.
+   Recoloring caused by characters beyond the margin (e.g., the delimiter
+   ending a very long string) is not reflected in the window. */
+
+PARSE_THREAD_LOCAL uint32_t *attr_buf = 0;
+PARSE_THREAD_LOCAL int64_t attr_size = 0;
+PARSE_THREAD_LOCAL int64_t attr_len = 0;
+PARSE_THREAD_LOCAL int64_t attr_start = 0;
+PARSE_THREAD_LOCAL int64_t attr_start_pos = 0;
 int stack_count = 0;
 
-HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, HIGHLIGHT_STATE h_state, const bool utf8)
+#ifndef NOTHREADS
+/* While parse_lines() runs several threads, frames are searched for and
+   created holding frame_mutex, and parallel_reset records whether the call
+   stack has been reset. */
+
+static bool parsing_in_parallel, parallel_reset;
+static pthread_mutex_t frame_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* The complete state of the parser in the middle of a line: besides the
+   highlight state, the name buffer and the marks used for recoloring. */
+
+struct parse_context {
+	HIGHLIGHT_STATE h_state;
+	unsigned char buf[24];			/* Name buffer (trunc after 23 characters) */
+	int buf_idx;				/* Index into buffer */
+	int buf_en;				/* Set for name buffering */
+	int ofst;				/* record offset after we've stopped buffering */
+	int mark1;  				/* offset to mark start from current pos */
+	int mark2;  				/* offset to mark end from current pos */
+	int mark_en;				/* set if marking */
+};
+
+static void init_context(struct parse_context * const ctx, const HIGHLIGHT_STATE * const h_state) {
+	memset(ctx, 0, sizeof *ctx);
+	ctx->h_state = *h_state;
+	ctx->buf[0] = 0;			/* Forgot this originally... took 5 months to fix! */
+}
+
+/* Parses at most n characters starting at *p and before stop, the character
+   at q being the virtual '\n' ending the line (so stop must not be beyond
+   q + 1). Attributes are appended to attr_buf starting at attr_len;
+   recoloring never touches attributes before attr_floor. *p and attr_len are
+   advanced accordingly, and the number of parsed characters is returned. */
+
+static int64_t parse_chars(struct high_syntax * const syntax, struct parse_context * const ctx, const unsigned char **p_ptr, const unsigned char * const q, const unsigned char * const stop, const int64_t n, const bool utf8, const int64_t attr_floor)
 {
+	HIGHLIGHT_STATE h_state = ctx->h_state;
 	struct high_frame *stack = h_state.stack;
 
 	struct high_state *h = (stack ? stack->syntax : syntax)->states[h_state.state];
@@ -184,37 +237,77 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 			/* Current state */
 
 	unsigned char buf[24];			/* Name buffer (trunc after 23 characters) */
-	unsigned char lbuf[24];			/* Lower case version of name buffer */
-	unsigned char lsaved_s[24];		/* Lower case version of delimiter match buffer */
-	int buf_idx=0;				/* Index into buffer */
+	unsigned char lbuf[24];			/* Lower case version of name buffer (if no perfect hash) */
+	int buf_idx = ctx->buf_idx;		/* Index into buffer */
 	int c;					/* Current character */
 	int c_len;				/* Character length in bytes */
-	uint32_t *attr = attr_buf;
+	uint32_t *attr = attr_buf + attr_len;
 	uint32_t *attr_end = attr_buf+attr_size;
-	int buf_en = 0;				/* Set for name buffering */
-	int ofst = 0;				/* record offset after we've stopped buffering */
-	int mark1 = 0;  			/* offset to mark start from current pos */
-	int mark2 = 0;  			/* offset to mark end from current pos */
-	int mark_en = 0;			/* set if marking */
+	int buf_en = ctx->buf_en;		/* Set for name buffering */
+	int ofst = ctx->ofst;			/* record offset after we've stopped buffering */
+	int mark1 = ctx->mark1;  		/* offset to mark start from current pos */
+	int mark2 = ctx->mark2;  		/* offset to mark end from current pos */
+	int mark_en = ctx->mark_en;		/* set if marking */
 	int recolor_delimiter_or_keyword;
 
-	const unsigned char *p = (const unsigned char *)ld->line;
-	unsigned char *q = (unsigned char *)(ld->line  + ld->line_len);
-
-	buf[0]=0;				/* Forgot this originally... took 5 months to fix! */
+	const unsigned char *p = *p_ptr;
+	int64_t i = 0;
+	const bool profiling = syntax_profiling;
 
+	memcpy(buf, ctx->buf, sizeof buf);
 
 	/* Get next character */
 							/* Una iterazione in più: aggiungo '\n' come ultimo carattere. */
-	while( p <= q ) { /* On the last itteration, process the virtual '\n' character. */
+	while( p < stop && i < n ) { /* On the last itteration, process the virtual '\n' character. */
 		struct high_cmd *cmd, *kw_cmd;
 		int x;
 
+		/* Runs of plain transitions, which just change the state, are taken
+			directly from the flattened table of the syntax of the current state
+			(see compile_dfa()). Buffering and marking are not modified by plain
+			transitions, so they are updated at the end of the run. */
+		const struct high_syntax * const t = h->syntax;
+		const uint32_t * const table = t->table;
+		const int64_t max = min(min((stop < q ? stop : q) - p, n - i), attr_end - attr);
+		uint32_t s = h->no * (t->nclasses + 1), e;
+		int64_t k;
+
+		for(k = 0; k < max && (!utf8 || p[k] < 0x80) && (e = table[s + 1 + t->cls[p[k]]]) != DFA_SLOW; k++) {
+			attr[k] = table[s];
+			s = e;
+		}
+
+		if (k) {
+			if (profiling) {
+				/* We replay the run to count visits and transitions. */
+				uint32_t r = h->no * (t->nclasses + 1);
+				for(int64_t j = 0; j < k; j++) {
+					struct high_state * const v = t->states[r / (t->nclasses + 1)];
+					v->visits++;
+					count_transition(v, v->cmd[p[j]]);
+					r = table[r + 1 + t->cls[p[j]]];
+				}
+			}
+			h = t->states[s / (t->nclasses + 1)];
+			if (buf_en) {
+				for(int j = 0; j < k && buf_idx < 23; j++) buf[buf_idx++] = p[j];
+				buf[buf_idx] = 0;
+			}
+			else ofst += k;
+			mark1 += k;
+			if (!mark_en) mark2 += k;
+			p += k;
+			i += k;
+			attr += k;
+			continue;
+		}
+
 		if (p == q) c = '\n';
 		else c = utf8 ? get_char((const char*)p, ENC_UTF8) : *p;
 
 		c_len = utf8 ? utf8seqlen(c) : 1;
 		p += c_len;	
+		i++;
 
 		/* Hack so we can have UTF-8 characters without crashing */
 		if (c < 0 || c > 255)
@@ -250,29 +343,32 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 			else
 				cmd = h->cmd[c];
 
-			/* Lowerize strings for case-insensitive matching */
-			if (cmd->ignore) {
-				zcpy(lbuf,buf);
-				lowerize(lbuf);
-				if (cmd->delim) {
-					zcpy(lsaved_s,h_state.saved_s);
-					lowerize(lsaved_s);
-				}
-			}
-
-			/* Check for delimiter or keyword matches */
+			/* Check for delimiter or keyword matches (case-insensitive if
+				cmd->ignore is set; perfect hash tables fold case by themselves) */
 			recolor_delimiter_or_keyword = 0;
-			if (cmd->delim && (cmd->ignore ? !zcmp(lsaved_s,lbuf) : !zcmp(h_state.saved_s,buf))) {
+			if (cmd->delim && (cmd->ignore ? !zicmp(h_state.saved_s,buf) : !zcmp(h_state.saved_s,buf))) {
 				cmd = cmd->delim;
 				recolor_delimiter_or_keyword = 1;
-			} else if (cmd->keywords && (cmd->ignore ? (kw_cmd=htfind(cmd->keywords,lbuf)) : (kw_cmd=htfind(cmd->keywords,buf)))) {
-				cmd = kw_cmd;
-				recolor_delimiter_or_keyword = 1;
+			} else if (cmd->keywords) {
+				if (profiling) h->keyword_lookups++;
+				if (kw_cmd = cmd->pkeywords ? phfind(cmd->pkeywords,buf) : htfind(cmd->keywords,cmd->ignore ? lowerize(zcpy(lbuf,buf)) : buf)) {
+					cmd = kw_cmd;
+					recolor_delimiter_or_keyword = 1;
+					if (profiling) h->keyword_hits++;
+				}
+			}
+
+			if (profiling) {
+				h->visits++;
+				count_transition(h, cmd);
 			}
 
 			/* Determine new state */
 			if (cmd->call) {
 				/* Call */
+#ifndef NOTHREADS
+				if (parsing_in_parallel) pthread_mutex_lock(&frame_mutex);
+#endif
 				struct high_frame **frame_ptr = stack ? &stack->child : &syntax->stack_base;
 				/* Search for an existing stack frame for this call */
 				while (*frame_ptr && !((*frame_ptr)->syntax == cmd->call && (*frame_ptr)->return_state == cmd->new_state))
@@ -290,36 +386,59 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 					stack = frame;
 					++stack_count;
 				}
+#ifndef NOTHREADS
+				if (parsing_in_parallel) pthread_mutex_unlock(&frame_mutex);
+#endif
 				h = stack->syntax->states[0];
+				if (profiling) {
+					syntax_profile.calls++;
+					int depth = 0;
+					for(const struct high_frame *f = stack; f; f = f->parent) depth++;
+					if (depth > syntax_profile.max_depth) syntax_profile.max_depth = depth;
+				}
 			} else if (cmd->rtn) {
 				/* Return */
 				if (stack) {
 					h = stack->return_state;
 					stack = stack->parent;
+					if (profiling) syntax_profile.returns++;
 				} else
 					/* Not in a subroutine, so ignore the return */
 					h = cmd->new_state;
 			} else if (cmd->reset) {
 				/* Reset the state and call stack */
 				h = syntax->states[0];
+				if (profiling) syntax_profile.resets++;
+#ifndef NOTHREADS
+				if (parsing_in_parallel) {
+					pthread_mutex_lock(&frame_mutex);
+					stack = syntax->stack_base;
+					parallel_reset = true;
+					pthread_mutex_unlock(&frame_mutex);
+				}
+				else
+#endif
 				stack = syntax->stack_base;
 			} else {
 				/* Normal edge */
 				h = cmd->new_state;
 			}
 
-			/* Recolor if necessary */
+			/* Recolor if necessary (but not before attr_floor) */
+			const int64_t attr_pos = attr - attr_buf;
 			if (recolor_delimiter_or_keyword)
 				for(x= -(buf_idx+1);x<-1;++x)
-					attr[x-ofst] = h->color;
+					if (attr_pos + x - ofst >= attr_floor)
+						attr[x-ofst] = h->color;
 			for(x=cmd->recolor;x<0;++x)
-				if (attr + x >= attr_buf)
+				if (attr_pos + x >= attr_floor)
 					attr[x] = h->color;
 
 			/* Mark recoloring */
 			if (cmd->recolor_mark)
 				for(x= -mark1;x<-mark2;++x)
-					attr[x] = h->color;
+					if (attr_pos + x >= attr_floor)
+						attr[x] = h->color;
 
 			/* Save string? */
 			if (cmd->save_s)
@@ -384,11 +503,445 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 		/*if(c=='\n')
 			break;*/
 	}
-	/* Return new state */
+	/* Save the new state */
 	h_state.stack = stack;
 	h_state.state = h->no;
-	attr_len = attr - attr_buf - 1; /* -1 because of the fake newline. */
-	return h_state;
+	ctx->h_state = h_state;
+	memcpy(ctx->buf, buf, sizeof buf);
+	ctx->buf_idx = buf_idx;
+	ctx->buf_en = buf_en;
+	ctx->ofst = ofst;
+	ctx->mark1 = mark1;
+	ctx->mark2 = mark2;
+	ctx->mark_en = mark_en;
+	*p_ptr = p;
+	attr_len = attr - attr_buf;
+	return i;
+}
+
+/* Returns true if parsing from the two given contexts yields the same
+   attributes and states. The offsets of the name buffer and of the marks are
+   compared only if they can be used for recoloring in the future: after
+   start_buffering ofst is zero, and it is only used when the buffer is not
+   empty; the marks are used only if the marked range is not empty. */
+
+static bool same_state(const HIGHLIGHT_STATE * const x, const HIGHLIGHT_STATE * const y) {
+	return x->state == y->state && x->stack == y->stack && !strcmp((const char *)x->saved_s, (const char *)y->saved_s);
+}
+
+static bool same_context(const struct parse_context * const x, const struct parse_context * const y) {
+	if (!same_state(&x->h_state, &y->h_state) || x->buf_en != y->buf_en || x->buf_idx != y->buf_idx || memcmp(x->buf, y->buf, x->buf_idx)) return false;
+	if (x->buf_idx > 0 && x->ofst != y->ofst) return false;
+	if (x->mark_en != y->mark_en) return false;
+	if (!x->mark_en && x->mark1 == x->mark2 && y->mark1 == y->mark2) return true;
+	return x->mark1 == y->mark1 && x->mark2 == y->mark2;
+}
+
+
+/* To avoid parsing very long lines (e.g., minified files) from the start each
+   time they are displayed, for the few long lines that were parsed most
+   recently we keep a parse index, that is, a checkpoint of the complete
+   parser context every PARSE_CHECKPOINT_SPACING characters, and the state at
+   the end of the line, if known. Checkpoints are computed lazily as parsing
+   proceeds. When the line is modified without splitting or joining it (see
+   shift_parse_index()), the checkpoints before the modification remain
+   valid, and the following ones are shifted and marked as stale: when
+   parsing reaches a stale checkpoint in the same context, the stale
+   checkpoints up to the next modification (and the final state, if there is
+   none) are valid again, so typing on a long line reparses just a few
+   checkpoints. The index is discarded when the syntax,
+   the encoding or the initial state of the line change. */
+
+#define PARSE_CHECKPOINT_SPACING (4 * 1024)
+#define PARSE_INDEX_MIN_LEN (16 * PARSE_CHECKPOINT_SPACING)
+#define PARSE_WINDOW_MARGIN 1024
+#define PARSE_INDEXES 4
+
+struct parse_checkpoint {
+	int64_t pos, chars;			/* Byte position and character index. */
+	struct parse_context ctx;		/* Context before the character at pos. */
+	bool edited;				/* The line was modified after the previous checkpoint. */
+};
+
+struct parse_index {
+	const line_desc *ld;			/* The indexed line descriptor, or NULL if the index is free. */
+	struct high_syntax *syntax;
+	HIGHLIGHT_STATE h_state;		/* The initial state of the line. */
+	bool utf8;
+	bool complete;				/* end_state is the state at the end of the line, if all checkpoints are valid. */
+	HIGHLIGHT_STATE end_state;
+	struct parse_checkpoint *cp;
+	int64_t count, size;			/* The number of checkpoints, and the size of cp. */
+	int64_t valid;				/* Checkpoints from valid on are stale. */
+	uint64_t last_used;
+};
+
+static struct parse_index parse_indexes[PARSE_INDEXES];
+static uint64_t parse_index_clock;
+
+/* Discards the checkpoints of the parse index of the given line descriptor
+   that are at or after the given position, or all parse indexes if ld is
+   NULL. It must be called whenever a line descriptor is split or joined
+   (with the position of the modification) or freed (with position 0). */
+
+void invalidate_parse_index(const line_desc * const ld, const int64_t pos) {
+	for(int i = 0; i < PARSE_INDEXES; i++) {
+		struct parse_index * const pi = &parse_indexes[i];
+		if (!ld) pi->ld = NULL;
+		else if (pi->ld == ld) {
+			if (pos == 0) pi->ld = NULL;
+			else {
+				while(pi->count > 1 && pi->cp[pi->count - 1].pos >= pos) pi->count--;
+				if (pi->valid > pi->count) pi->valid = pi->count;
+				pi->complete = false;
+			}
+		}
+	}
+}
+
+/* Updates the parse index of the given line descriptor after len bytes have
+   been inserted (if len is positive) or deleted (if len is negative) at the
+   given position, without splitting or joining lines. */
+
+void shift_parse_index(const line_desc * const ld, const int64_t pos, const int64_t len) {
+	for(int i = 0; i < PARSE_INDEXES; i++) {
+		struct parse_index * const pi = &parse_indexes[i];
+		if (pi->ld != ld) continue;
+
+		/* Checkpoints not after pos are still valid. */
+		int64_t l = 0, r = pi->count - 1;
+		while(l < r) {
+			const int64_t m = (l + r + 1) / 2;
+			if (pi->cp[m].pos <= pos) l = m;
+			else r = m - 1;
+		}
+		if (pi->valid > l + 1) pi->valid = l + 1;
+
+		/* The others are shifted (or discarded, if they were deleted). */
+		int64_t n = l + 1;
+		for(int64_t j = l + 1; j < pi->count; j++) {
+			if (len < 0 && pi->cp[j].pos < pos - len) continue;
+			pi->cp[n] = pi->cp[j];
+			pi->cp[n++].pos += len;
+		}
+		pi->count = n;
+		/* Without following checkpoints we have no way to validate the final state. */
+		if (l + 1 == pi->count) pi->complete = false;
+		else pi->cp[l + 1].edited = true;
+	}
+}
+
+/* Returns the parse index of the given line descriptor, reusing the least
+   recently used one if necessary, or NULL if the line is short or we run out
+   of memory. */
+
+static struct parse_index *get_parse_index(struct high_syntax * const syntax, const line_desc * const ld, const HIGHLIGHT_STATE * const h_state, const bool utf8) {
+	if (ld->line_len < PARSE_INDEX_MIN_LEN) return NULL;
+
+	struct parse_index *pi = NULL, *lru = parse_indexes;
+	for(int i = 0; i < PARSE_INDEXES; i++) {
+		if (parse_indexes[i].ld == ld) {
+			pi = &parse_indexes[i];
+			break;
+		}
+		if (parse_indexes[i].last_used < lru->last_used) lru = &parse_indexes[i];
+	}
+
+	if (!pi || pi->syntax != syntax || pi->utf8 != utf8 || !same_state(&pi->h_state, h_state)) {
+		if (!pi) pi = lru;
+		if (!pi->cp) {
+			if (!(pi->cp = malloc(64 * sizeof *pi->cp))) return NULL;
+			pi->size = 64;
+		}
+		pi->ld = ld;
+		pi->syntax = syntax;
+		pi->h_state = *h_state;
+		pi->utf8 = utf8;
+		pi->complete = false;
+		pi->cp[0].pos = pi->cp[0].chars = 0;
+		pi->cp[0].edited = false;
+		init_context(&pi->cp[0].ctx, h_state);
+		pi->count = pi->valid = 1;
+	}
+
+	pi->last_used = ++parse_index_clock;
+	return pi;
+}
+
+/* Parses a long line using its parse index (see parse()). */
+
+static HIGHLIGHT_STATE parse_indexed(struct parse_index * const pi, const line_desc * const ld, int64_t from, int64_t to)
+{
+	const unsigned char * const line = (const unsigned char *)ld->line;
+	const unsigned char * const q = line + ld->line_len;
+	const encoding_type encoding = pi->utf8 ? ENC_UTF8 : ENC_8_BIT;
+
+	from = from > PARSE_WINDOW_MARGIN ? from - PARSE_WINDOW_MARGIN : 0;
+	to = to < INT64_MAX - PARSE_WINDOW_MARGIN ? to + PARSE_WINDOW_MARGIN : INT64_MAX;
+
+	/* We start from the last valid checkpoint not after from. */
+	int64_t k = 0, r = pi->valid - 1;
+	while(k < r) {
+		const int64_t m = (k + r + 1) / 2;
+		if (pi->cp[m].chars <= from) k = m;
+		else r = m - 1;
+	}
+
+	struct parse_context ctx = pi->cp[k].ctx;
+	const unsigned char *p = line + pi->cp[k].pos;
+	int64_t chars = pi->cp[k].chars;
+	int64_t window_len = -1;		/* The length of the window, once it has been parsed. */
+	bool eol = false;
+
+	attr_len = 0;
+
+	for(;;) {
+		/* Attributes before from are not needed. */
+		if (window_len < 0 && chars <= from) {
+			attr_start = chars;
+			attr_start_pos = p - line;
+			attr_len = 0;
+		}
+
+		if (window_len < 0 && (eol || chars >= to)) {
+			/* The window is complete: we align it to from. */
+			int64_t skip = from - attr_start;
+			if (skip > attr_len) skip = attr_len;
+			if (skip > 0) {
+				memmove(attr_buf, attr_buf + skip, (attr_len - skip) * sizeof *attr_buf);
+				attr_len -= skip;
+				attr_start += skip;
+				while(skip-- != 0) attr_start_pos = next_pos((const char *)line, attr_start_pos, encoding);
+			}
+			window_len = attr_len;
+		}
+
+		if (window_len >= 0) {
+			/* Further attributes are just scratch, and the state at the end of the line is needed. */
+			attr_len = window_len;
+			if (eol || pi->complete && pi->valid == pi->count) break;
+		}
+
+		const unsigned char * const stop = k + 1 < pi->count ? line + pi->cp[k + 1].pos : q + 1;
+		/* A new checkpoint is not worth it if the next one is just slightly farther than the spacing (e.g., after an insertion). */
+		const bool may_add = k + 1 == pi->count || pi->cp[k + 1].pos - pi->cp[k].pos >= 2 * PARSE_CHECKPOINT_SPACING;
+		int64_t n = INT64_MAX;
+		if (may_add) {
+			n = pi->cp[k].chars + PARSE_CHECKPOINT_SPACING - chars;
+			if (n <= 0) n = PARSE_CHECKPOINT_SPACING;
+		}
+		if (window_len < 0 && to - chars < n) n = to - chars;
+
+		chars += parse_chars(pi->syntax, &ctx, &p, q, stop, n, pi->utf8, window_len < 0 ? 0 : window_len);
+
+		if (p > q) {
+			/* Discard the attribute of the virtual '\n'. */
+			eol = true;
+			chars--;
+			attr_len--;
+			pi->end_state = ctx.h_state;
+			pi->complete = true;
+		}
+		else if (p == stop) {
+			/* We reached the next checkpoint. */
+			struct parse_checkpoint * const c = &pi->cp[++k];
+			if (k >= pi->valid) {
+				if (same_context(&c->ctx, &ctx)) {
+					/* The line is parsed as before up to the next modification: we just fix the character indices. */
+					const int64_t delta = chars - c->chars;
+					int64_t j = k;
+					do pi->cp[j++].chars += delta; while(j < pi->count && !pi->cp[j].edited);
+					pi->valid = j;
+				}
+				else {
+					c->chars = chars;
+					c->ctx = ctx;
+					pi->valid = k + 1;
+				}
+				c->edited = false;
+			}
+		}
+		else if (may_add && chars - pi->cp[k].chars >= PARSE_CHECKPOINT_SPACING) {
+			/* We add a checkpoint. */
+			if (pi->count == pi->size) {
+				struct parse_checkpoint * const cp = realloc(pi->cp, pi->size * 2 * sizeof *cp);
+				if (!cp) continue;	/* We just go on with a larger gap. */
+				pi->cp = cp;
+				pi->size *= 2;
+			}
+			memmove(pi->cp + k + 2, pi->cp + k + 1, (pi->count - k - 1) * sizeof *pi->cp);
+			pi->count++;
+			pi->valid++;
+			k++;
+			pi->cp[k].pos = p - line;
+			pi->cp[k].chars = chars;
+			pi->cp[k].ctx = ctx;
+			pi->cp[k].edited = false;
+		}
+	}
+
+	return pi->end_state;
+}
+
+/* Parses a whole line without using parse indexes (see parse()). */
+
+HIGHLIGHT_STATE parse_line(struct high_syntax * const syntax, const line_desc * const ld, const HIGHLIGHT_STATE h_state, const bool utf8)
+{
+	struct parse_context ctx;
+	const unsigned char *p = (const unsigned char *)ld->line;
+	const unsigned char * const q = p + ld->line_len;
+
+	init_context(&ctx, &h_state);
+	attr_start = attr_start_pos = attr_len = 0;
+	parse_chars(syntax, &ctx, &p, q, q + 1, INT64_MAX, utf8, 0);
+	attr_len--; /* -1 because of the fake newline. */
+	/* Return new state */
+	return ctx.h_state;
+}
+
+HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, HIGHLIGHT_STATE h_state, const bool utf8, const int64_t from, const int64_t to)
+{
+	lines_parsed++;
+	struct parse_index * const pi = get_parse_index(syntax, ld, &h_state, utf8);
+	if (pi) return parse_indexed(pi, ld, from, to);
+
+	return parse_line(syntax, ld, h_state, utf8);
+}
+
+/* Large buffers are parsed speculatively in parallel: the lines are split
+   into chunks of about the same size, one per processor (but no smaller than
+   PARALLEL_PARSE_MIN_CHUNK bytes), and each chunk is parsed by a thread
+   starting from the idle state. Then, for each chunk in turn, if the state at
+   the end of the previous chunk is not the idle state, the chunk is parsed
+   again from the right state until the state at the start of a line is the
+   one computed by the thread: from there on, the states were right. Since
+   most syntaxes go back to the idle state often, usually just a few lines
+   are parsed twice. */
+
+#define PARALLEL_PARSE_MIN_CHUNK (1024 * 1024)
+#define PARALLEL_PARSE_MAX_THREADS 16
+
+/* Returns the number of threads used to parse large buffers. */
+
+int parse_threads(void) {
+#ifdef NOTHREADS
+	return 1;
+#else
+	static int threads;
+	if (!threads) {
+		const long n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = n < 1 ? 1 : n > PARALLEL_PARSE_MAX_THREADS ? PARALLEL_PARSE_MAX_THREADS : n;
+	}
+	return threads;
+#endif
+}
+
+#ifndef NOTHREADS
+struct parse_chunk {
+	struct high_syntax *syntax;
+	line_desc *ld;				/* The first line of the chunk. */
+	int64_t num_lines;
+	bool utf8;
+	HIGHLIGHT_STATE start, end;		/* The (guessed) state at the start, and the state at the end of the chunk. */
+};
+
+static void parse_chunk(struct parse_chunk * const c) {
+	HIGHLIGHT_STATE h_state = c->start;
+	line_desc *ld = c->ld;
+	for(int64_t i = 0; i < c->num_lines; i++, ld = (line_desc *)ld->ld_node.next) {
+		ld->highlight_state = h_state;
+		h_state = parse_line(c->syntax, ld, h_state, c->utf8);
+	}
+	c->end = h_state;
+}
+
+static void *parse_chunk_thread(void *c) {
+	parse_chunk(c);
+	joe_free(attr_buf);
+	return NULL;
+}
+#endif
+
+/* Sets the initial highlight state of num_lines lines, starting from ld, of
+   a buffer containing the given number of characters. */
+
+void parse_lines(struct high_syntax * const syntax, line_desc *ld, int64_t num_lines, int64_t chars, const bool utf8) {
+	HIGHLIGHT_STATE h_state = { 0, 0, "" };
+
+#ifndef NOTHREADS
+	int n = parse_threads();
+	if (n > chars / PARALLEL_PARSE_MIN_CHUNK) n = chars / PARALLEL_PARSE_MIN_CHUNK;
+
+	if (n > 1) {
+		/* Resetting sets the call stack to the first frame created for the
+			syntax, which must thus be created in sequential order: we parse
+			sequentially until it exists (but at most a chunk). */
+		for(const int64_t max = chars / n; num_lines > 0 && !syntax->stack_base && chars > max * (n - 1); num_lines--, ld = (line_desc *)ld->ld_node.next) {
+			ld->highlight_state = h_state;
+			h_state = parse(syntax, ld, h_state, utf8, 0, 0);
+			chars -= ld->line_len + 1;
+		}
+
+		struct parse_chunk c[PARALLEL_PARSE_MAX_THREADS];
+		pthread_t thread[PARALLEL_PARSE_MAX_THREADS];
+		bool started[PARALLEL_PARSE_MAX_THREADS] = { false };
+		struct high_frame * const stack_base = syntax->stack_base;
+
+		/* We split the lines into chunks of about chars / n bytes. */
+		int k = 0;
+		int64_t len = 0;
+		c[0].ld = ld;
+		c[0].num_lines = 0;
+		for(int64_t i = 0; i < num_lines; i++, ld = (line_desc *)ld->ld_node.next) {
+			if (k < n - 1 && len >= (k + 1) * (chars / n)) {
+				c[++k].ld = ld;
+				c[k].num_lines = 0;
+			}
+			c[k].num_lines++;
+			len += ld->line_len + 1;
+		}
+		n = k + 1;
+
+		parsing_in_parallel = true;
+		parallel_reset = false;
+		for(k = 0; k < n; k++) {
+			c[k].syntax = syntax;
+			c[k].utf8 = utf8;
+			c[k].start = k == 0 ? h_state : (HIGHLIGHT_STATE){ 0, 0, "" };
+			if (k > 0) started[k] = !pthread_create(&thread[k], NULL, parse_chunk_thread, &c[k]);
+		}
+		for(k = 0; k < n; k++) if (!started[k]) parse_chunk(&c[k]);
+		for(k = 1; k < n; k++) if (started[k]) pthread_join(thread[k], NULL);
+		parsing_in_parallel = false;
+		lines_parsed += num_lines;
+
+		/* If the first frame has been created by some thread, resets might
+			have used it too early (or too late), so we parse again everything. */
+		const bool redo = !stack_base && syntax->stack_base && parallel_reset;
+
+		/* We fix the chunks starting from a wrong state. */
+		h_state = redo ? c[0].start : c[0].end;
+		for(k = redo ? 0 : 1; k < n; k++) {
+			if (!redo && same_state(&h_state, &c[k].start)) {
+				h_state = c[k].end;
+				continue;
+			}
+			ld = c[k].ld;
+			int64_t i;
+			for(i = 0; i < c[k].num_lines && (redo || !same_state(&h_state, &ld->highlight_state)); i++, ld = (line_desc *)ld->ld_node.next) {
+				ld->highlight_state = h_state;
+				h_state = parse(syntax, ld, h_state, utf8, 0, 0);
+			}
+			if (i < c[k].num_lines) h_state = c[k].end;
+		}
+		return;
+	}
+#endif
+
+	for(int64_t i = 0; i < num_lines; i++, ld = (line_desc *)ld->ld_node.next) {
+		ld->highlight_state = h_state;
+		h_state = parse(syntax, ld, h_state, utf8, 0, 0);
+	}
 }
 
 /* Subroutines for load_dfa() */
@@ -403,7 +956,7 @@ static struct high_state *find_state(struct high_syntax *syntax,unsigned char *n
 	/* It doesn't exist, so create it */
 	if(!state) {
 		int y;
-		state=joe_malloc(sizeof(struct high_state));
+		state=joe_calloc(1,sizeof(struct high_state));
 		state->name=zdup(name);
 		state->no=syntax->nstates;
 		state->color=FG_WHITE;
@@ -431,6 +984,7 @@ static void iz_cmd(struct high_cmd *cmd)
 	cmd->save_s = 0;
 	cmd->new_state = 0;
 	cmd->keywords = 0;
+	cmd->pkeywords = 0;
 	cmd->delim = 0;
 	cmd->ignore = 0;
 	cmd->start_mark = 0;
@@ -571,6 +1125,69 @@ struct high_param *parse_params(struct high_param *current_params,unsigned char
 
 struct high_syntax *load_syntax_subr(unsigned char *name,unsigned char *subr,struct high_param *params);
 
+/* Returns true if a command just moves to a new state in the same syntax,
+   so that parse_chars() can skip interpreting it. */
+
+static bool plain_cmd(const struct high_cmd * const cmd)
+{
+	return !cmd->noeat && !cmd->start_buffering && !cmd->stop_buffering && !cmd->save_c && !cmd->save_s
+		&& !cmd->start_mark && !cmd->stop_mark && !cmd->recolor_mark && !cmd->rtn && !cmd->reset
+		&& cmd->recolor >= 0 && !cmd->keywords && !cmd->delim && !cmd->call && cmd->new_state;
+}
+
+/* Returns true if the characters c and d have the same command in all
+   states of a syntax (states with a matching delimiter do not matter, as
+   their commands are always interpreted). */
+
+static bool same_class(const struct high_syntax * const syntax, const int c, const int d)
+{
+	for(int i = 0; i < syntax->nstates; i++)
+		if (!syntax->states[i]->delim && syntax->states[i]->cmd[c] != syntax->states[i]->cmd[d]) return false;
+	return true;
+}
+
+/* Lowers the character tables of the states of a loaded syntax into a
+   flattened table. Characters are grouped in classes sharing the same
+   command in all states; then, the table contains a row of nclasses + 1
+   entries for each state: the first entry is the color of the state, and
+   the following ones the offset of the row of the next state for each class
+   if the command of the class is plain (see plain_cmd()), or DFA_SLOW. All
+   entries of states with a matching delimiter are DFA_SLOW.
+
+   Keyword tables are also compiled into perfect hash tables (see phmk()). */
+
+void compile_dfa(struct high_syntax * const syntax)
+{
+	int rep[256];
+
+	syntax->nclasses = 0;
+	for(int c = 0; c < 256; c++) {
+		int k;
+		for(k = 0; k < syntax->nclasses && !same_class(syntax, c, rep[k]); k++);
+		if (k == syntax->nclasses) rep[syntax->nclasses++] = c;
+		syntax->cls[c] = k;
+	}
+
+	const int w = syntax->nclasses + 1;
+	syntax->table = joe_malloc(sizeof(uint32_t) * syntax->nstates * w);
+
+	for(int i = 0; i < syntax->nstates; i++) {
+		struct high_state * const h = syntax->states[i];
+		uint32_t * const row = syntax->table + i * w;
+
+		h->syntax = syntax;
+		row[0] = h->color;
+		for(int c = 0; c < 256; c++) {
+			struct high_cmd * const cmd = h->cmd[c];
+			if (cmd->keywords && !cmd->pkeywords) cmd->pkeywords = phmk(cmd->keywords, cmd->ignore);
+		}
+		for(int k = 0; k < syntax->nclasses; k++) {
+			const struct high_cmd * const cmd = h->cmd[rep[k]];
+			row[1 + k] = !h->delim && plain_cmd(cmd) ? cmd->new_state->no * w : DFA_SLOW;
+		}
+	}
+}
+
 /* Parse options */
 
 void parse_options(struct high_syntax *syntax,struct high_cmd *cmd,FILE *f,unsigned char *p,int parsing_strings,unsigned char *name,int line)
@@ -672,6 +1289,27 @@ struct ifstack {
 	int line;
 };
 
+/* Stores in path (of the given size) the name of the file containing the
+   given syntax, looking first in the local and then in the global syntax
+   directory. Returns 0 if the file was found, -1 otherwise. */
+
+int find_syntax_file(const unsigned char *name, char *path, size_t size)
+{
+	const char *p;
+
+	if ((p = exists_prefs_dir()) && strlen(p) + 2 + strlen(SYNTAX_DIR) + strlen(SYNTAX_EXT) + strlen((const char *)name) < size) {
+		strcat(strcat(strcat(strcat(strcpy(path, p), SYNTAX_DIR), "/"), (const char *)name), SYNTAX_EXT);
+		if (!access(path, R_OK)) return 0;
+	}
+
+	if ((p = exists_gprefs_dir()) && strlen(p) + 2 + strlen(SYNTAX_DIR) + strlen(SYNTAX_EXT) + strlen((const char *)name) < size) {
+		strcat(strcat(strcat(strcat(strcpy(path, p), SYNTAX_DIR), "/"), (const char *)name), SYNTAX_EXT);
+		if (!access(path, R_OK)) return 0;
+	}
+
+	return -1;
+}
+
 /* Load dfa */
 
 struct high_state *load_dfa(struct high_syntax *syntax)
@@ -692,17 +1330,7 @@ struct high_state *load_dfa(struct high_syntax *syntax)
 
 	/* Load it */
 
-	if ((p = (unsigned char *)exists_prefs_dir()) && strlen((const char *)p) + 2 + strlen(SYNTAX_DIR) + strlen(SYNTAX_EXT) + strlen((const char *)syntax->name) < sizeof name) {
-		strcat(strcat(strcat(strcat(strcpy((char *)name, (const char *)p), SYNTAX_DIR), "/"), (const char *)syntax->name), SYNTAX_EXT);
-		f = fopen((char *)name,"r");
-	}
-
-	if (!f && (p = (unsigned char*)exists_gprefs_dir()) && strlen((const char *)p) + 2 + strlen(SYNTAX_DIR) + strlen(SYNTAX_EXT) + strlen((const char *)syntax->name) < sizeof name) {
-		strcat(strcat(strcat(strcat(strcpy((char *)name, (const char *)p), SYNTAX_DIR), "/"), (const char *)syntax->name), SYNTAX_EXT);
-		f = fopen((char *)name,"r");
-	}
-
-	if (!f) return 0;
+	if (find_syntax_file(syntax->name, (char *)name, sizeof name) || !(f = fopen((char *)name,"r"))) return 0;
 
 	/* Parse file */
 	while(fgets((char *)buf,1023,f)) {
@@ -917,6 +1545,7 @@ struct high_syntax *load_syntax_subr(unsigned char *name,unsigned char *subr,str
 
 	if (load_dfa(syntax)) {
 		/* dump_syntax(syntax); */
+		compile_dfa(syntax);
 		return syntax;
 	} else {
 		if(syntax_list == syntax)
@@ -934,10 +1563,25 @@ struct high_syntax *load_syntax_subr(unsigned char *name,unsigned char *subr,str
 	}
 }
 
+/* Loads a syntax, using the syntax cache if possible (see syn_cache.c). */
+
 struct high_syntax *load_syntax(unsigned char *name)
 {
+	struct high_syntax *syntax;
+
 	if (!name)
 		return 0;
 
-	return load_syntax_subr(name,0,0);
+	/* Already loaded? */
+	for(syntax=syntax_list;syntax;syntax=syntax->next)
+		if(syntax_match(syntax,name,0,0))
+			return syntax;
+
+	if ((syntax = load_cached_syntax(name)))
+		return syntax;
+
+	if ((syntax = load_syntax_subr(name,0,0)))
+		save_cached_syntax(syntax);
+
+	return syntax;
 }
@@ -38,6 +38,10 @@ struct high_state {
 	unsigned char *name;		/* Highlight state name */
 	struct high_cmd *cmd[256];	/* Character table */
 	struct high_cmd *delim;		/* Matching delimiter */
+	struct high_syntax *syntax;	/* Syntax this state belongs to */
+	uint64_t visits;		/* Profiling: characters parsed in this state */
+	uint64_t keyword_lookups;	/* Profiling: keyword lookups */
+	uint64_t keyword_hits;		/* Profiling: keywords found */
 };
 
 /* Parameter list */
@@ -64,6 +68,7 @@ struct high_cmd {
 	int recolor;			/* No. chars to recolor if <0. */
 	struct high_state *new_state;	/* The new state */
 	HASH *keywords;			/* Hash table of keywords */
+	PHASH *pkeywords;		/* Perfect hash table of keywords, or NULL */
 	struct high_cmd *delim;		/* Matching delimiter */
 	struct high_syntax *call;	/* Syntax subroutine to call */
 };
@@ -92,17 +97,61 @@ struct high_syntax {
 	struct high_color *color;	/* Linked list of color definitions */
 	struct high_cmd default_cmd;	/* Default transition for new states */
 	struct high_frame *stack_base;  /* Root of run-time call tree */
+	unsigned char cls[256];		/* Flattened table: class of each character */
+	int nclasses;			/* Flattened table: no. classes */
+	uint32_t *table;		/* Flattened table: a row for each state */
 };
 
+/* A flattened table entry for a command that must be interpreted. */
+
+#define DFA_SLOW UINT32_MAX
+
 /* Find a syntax.  Load it if necessary. */
 
 struct high_syntax *load_syntax PARAMS((unsigned char *name));
 
-/* Parse a lines.  Returns new state. */
+extern struct high_syntax *syntax_list;
+int syntax_match PARAMS((struct high_syntax *syntax,unsigned char *name,unsigned char *subr,struct high_param *params));
+int find_syntax_file PARAMS((const unsigned char *name, char *path, size_t size));
+void compile_dfa PARAMS((struct high_syntax *syntax));
+
+/* Cache of compiled syntaxes (see syn_cache.c). */
+
+struct high_syntax *load_cached_syntax PARAMS((unsigned char *name));
+void save_cached_syntax PARAMS((struct high_syntax *syntax));
+
+/* Parse a lines.  Returns new state. The attribute buffer is local to each
+   thread, as large buffers are parsed in parallel (see parse_lines()). */
+
+#ifdef NOTHREADS
+#define PARSE_THREAD_LOCAL
+#else
+#define PARSE_THREAD_LOCAL __thread
+#endif
+
+extern PARSE_THREAD_LOCAL uint32_t *attr_buf;
+extern PARSE_THREAD_LOCAL int64_t attr_len, attr_start, attr_start_pos;
+HIGHLIGHT_STATE parse PARAMS((struct high_syntax *syntax, line_desc *ld, HIGHLIGHT_STATE h_state, bool utf8, int64_t from, int64_t to));
+HIGHLIGHT_STATE parse_line PARAMS((struct high_syntax *syntax, const line_desc *ld, HIGHLIGHT_STATE h_state, bool utf8));
+void parse_lines PARAMS((struct high_syntax *syntax, line_desc *ld, int64_t num_lines, int64_t chars, bool utf8));
+int parse_threads PARAMS((void));
+void invalidate_parse_index PARAMS((const line_desc *ld, int64_t pos));
+void shift_parse_index PARAMS((const line_desc *ld, int64_t pos, int64_t len));
+
+/* Profiling of the parser (see syn_prof.c). */
+
+struct syntax_profile {
+	uint64_t calls;			/* Subroutine calls */
+	uint64_t returns;		/* Returns from a subroutine */
+	uint64_t resets;		/* Resets of the call stack */
+	int max_depth;			/* Maximum depth of the call stack */
+};
+
+extern bool syntax_profiling;
+extern int stack_count;		/* Number of call stack frames */
+extern struct syntax_profile syntax_profile;
 
-extern uint32_t *attr_buf;
-extern int64_t attr_len;
-HIGHLIGHT_STATE parse PARAMS((struct high_syntax *syntax, line_desc *ld, HIGHLIGHT_STATE h_state, bool utf8));
+void count_transition PARAMS((const struct high_state *h, const struct high_cmd *cmd));
 
 #define clear_state(s) (((s)->saved_s[0] = 0), ((s)->state = 0), ((s)->stack = 0))
 #define invalidate_state(s) ((s)->state = -1)
@@ -33,6 +33,8 @@
 #include "info2cap.h"
 #endif
 
+#include <errno.h>
+#include <unistd.h>
 #include <termios.h>
 #include <sys/ioctl.h>
 
@@ -155,7 +157,16 @@ char *ne_exit_ca_mode;
 char *ne_exit_attribute_mode;
 char *ne_exit_alt_charset_mode;
 
+char *ne_begin_sync;
+char *ne_end_sync;
+
+char *ne_enable_bracketed_paste;
+char *ne_disable_bracketed_paste;
+char *ne_paste_start;
+char *ne_paste_end;
+
 char *ne_repeat_char;
+char *ne_erase_chars;
 
 bool ne_tilde_glitch;
 bool ne_memory_below;
@@ -218,6 +229,8 @@ bool	color_ok;				/* Terminal supports color */
 
 static int	RPov;		/* Least number of chars to start a TS_repeat.
 								Less wouldn't be worth. */
+static int	ECHov;		/* Least number of chars to erase with erase_chars.
+								Less wouldn't be worth. */
 
 static bool	delete_in_insert_mode;	/* True if delete mode == insert mode */
 static bool	se_is_so;					/* True if same string both enters and leaves standout mode */
@@ -239,6 +252,61 @@ int	specified_window;
 
 bool	io_utf8;
 
+/* The number of bytes sent to the terminal, the number of write() system
+   calls used to send them, the number of characters that were not sent
+   because the shadow screen showed they were already displayed, and the
+   number of bytes used to change attributes. */
+
+uint64_t output_bytes, output_writes, output_chars_skipped, output_attr_bytes;
+
+/* All output is accumulated in a frame buffer, which is sent to the terminal
+   with a single write() by flush_output(). If the terminal supports
+   synchronized updates, the first frame_prefix bytes of the buffer are
+   reserved for ne_begin_sync, so that a large frame can be wrapped by
+   ne_begin_sync and ne_end_sync without moving it around; the terminal will
+   then display the whole frame at once. frame_len is zero when the frame is
+   empty, and at least frame_prefix otherwise. A frame larger than
+   MAX_FRAME_SIZE is written out immediately. */
+
+#define MIN_FRAME_SIZE (16 * 1024)
+#define MAX_FRAME_SIZE (1024 * 1024)
+
+static char *frame;
+static size_t frame_size, frame_len, frame_prefix;
+
+#define PUTCHAR(c) put_byte(c)
+
+/* The shadow screen records, for each position of the terminal, the
+   character displayed and its attributes (SHADOW_STANDOUT denotes standout
+   mode). SHADOW_UNKNOWN means that we do not know what is displayed at the
+   position, and SHADOW_WIDE marks the right half of a double-width character.
+
+   The output functions compare what they are asked to display with the
+   shadow screen, and skip characters that are already displayed. In this
+   case the physical cursor (curY, curX) lags behind the logical cursor
+   (want_y, want_x), and it is moved only when something must actually be
+   output (see sync_cursor()). In the same way, set_attr() just records in
+   want_attr the attributes to be used by the following output, and the
+   terminal attributes are changed only when a character is output. */
+
+#define SHADOW_UNKNOWN  0
+#define SHADOW_WIDE     UINT32_MAX
+#define SHADOW_STANDOUT (1U << 31)
+
+typedef struct {
+	uint32_t c, attr;
+} shadow_cell;
+
+static shadow_cell *shadow;
+static int shadow_lines, shadow_columns;
+
+static bool lagging;             /* True if the physical cursor is not at the logical position. */
+static int want_y, want_x;       /* The logical position of the cursor, if lagging is true. */
+static uint32_t want_attr;       /* The attributes to be used for output. */
+
+#define LOGICAL_Y (lagging ? want_y : curY)
+#define LOGICAL_X (lagging ? want_x : curX)
+
 /* Returns the output width of the given character. It is maximised with 1
  w.r.t. wcwidth(), so its result is equivalent to the width of the character
  that will be output by out(). */
@@ -305,9 +373,71 @@ static int joe2color(const int joe_color) {
 /* Sets up attributes */
 
 
+/* If the terminal uses the standard ECMA-48 SGR sequences for attributes and
+   colors (see check_sgr()), sgr_ok is true and emit_attr() sends, as a single
+   CSI sequence, just the changes between the current and the new attributes,
+   or a reset followed by the new attributes, whichever is shorter. */
+
+static bool sgr_ok;
+
+/* Returns the attributes that emit_attr() would actually set on the terminal. */
+
+static uint32_t effective_attr(const uint32_t attr) {
+	uint32_t eff = attr & ~AT_MASK;
+	if (!color_ok) eff &= ~(FG_MASK | BG_MASK);
+	if ((attr & INVERSE) && MAY_USE_WITH_COLORS(NC_REVERSE) && ne_enter_reverse_mode) eff |= INVERSE;
+	if ((attr & BOLD) && MAY_USE_WITH_COLORS(NC_BOLD) && ne_enter_bold_mode) eff |= BOLD;
+	if ((attr & UNDERLINE) && MAY_USE_WITH_COLORS(NC_UNDERLINE) && ne_enter_underline_mode) eff |= UNDERLINE;
+	if ((attr & DIM) && MAY_USE_WITH_COLORS(NC_DIM) && ne_enter_dim_mode) eff |= DIM;
+	if ((attr & BLINK) && MAY_USE_WITH_COLORS(NC_BLINK) && ne_enter_blink_mode) eff |= BLINK;
+	return eff;
+}
+
+/* Appends to p the SGR parameters that take the terminal from the (effective)
+   attributes from to the (effective) attributes to, and returns the number
+   of characters appended. */
+
+static int sgr_params(char *p, const uint32_t from, const uint32_t to) {
+	char * const start = p;
+	/* Bold and dim are turned off together. */
+	const bool bold_dim_off = (from & ~to & (BOLD | DIM)) != 0;
+	const uint32_t on = to & ~(bold_dim_off ? from & ~(BOLD | DIM) : from);
+
+	if (bold_dim_off) p += sprintf(p, ";22");
+	if (from & ~to & UNDERLINE) p += sprintf(p, ";24");
+	if (from & ~to & BLINK) p += sprintf(p, ";25");
+	if (from & ~to & INVERSE) p += sprintf(p, ";27");
+	if (on & BOLD) p += sprintf(p, ";1");
+	if (on & DIM) p += sprintf(p, ";2");
+	if (on & UNDERLINE) p += sprintf(p, ";4");
+	if (on & BLINK) p += sprintf(p, ";5");
+	if (on & INVERSE) p += sprintf(p, ";7");
+	if ((from & FG_MASK) != (to & FG_MASK)) p += to & FG_NOT_DEFAULT ? sprintf(p, ";%d", 30 + joe2color(to >> FG_SHIFT)) : sprintf(p, ";39");
+	if ((from & BG_MASK) != (to & BG_MASK)) p += to & BG_NOT_DEFAULT ? sprintf(p, ";%d", 40 + joe2color(to >> BG_SHIFT)) : sprintf(p, ";49");
+	return p - start;
+}
+
+static void emit_sgr(const uint32_t attr) {
+	const uint32_t from = effective_attr(curr_attr), to = effective_attr(attr);
+	/* At most 11 parameters of at most 3 characters. */
+	char delta[48], reset[48] = ";0";
+
+	const int delta_len = sgr_params(delta, from, to);
+	if (delta_len != 0) {
+		const int reset_len = 2 + sgr_params(reset + 2, 0, to);
+		const char * const p = reset_len < delta_len ? reset : delta;
+		/* We skip the leading semicolon. */
+		put_byte('\x1b');
+		put_byte('[');
+		for(int i = 1; p[i]; i++) put_byte(p[i]);
+		put_byte('m');
+	}
+	curr_attr = attr;
+}
+
 #ifdef PLAIN_SET_ATTR
 
-void set_attr(const uint32_t attr) {
+static void emit_termcap_attr(const uint32_t attr) {
 	OUTPUT1(ne_exit_attribute_mode);
 
 	if (attr & INVERSE) OUTPUT1(ne_enter_reverse_mode); 
@@ -326,12 +456,14 @@ void set_attr(const uint32_t attr) {
 			OUTPUT1(buf);
 		}
 	}
+
+	curr_attr = attr;
 } 
 
 #else
 
 
-void set_attr(const uint32_t attr) {
+static void emit_termcap_attr(const uint32_t attr) {
 	bool attr_reset = false;
 
 	/* If we have to set a different subset of attributes, or if we have to
@@ -374,6 +506,41 @@ void set_attr(const uint32_t attr) {
 
 #endif
 
+
+/* Sets the terminal attributes, keeping track of the bytes spent doing so. */
+
+static void emit_attr(const uint32_t attr) {
+	const uint64_t start_bytes = output_bytes;
+	if (sgr_ok) emit_sgr(attr);
+	else emit_termcap_attr(attr);
+	output_attr_bytes += output_bytes - start_bytes;
+}
+
+
+/* Sets sgr_ok if the terminal capabilities used by emit_attr() are the
+   standard ECMA-48 SGR sequences. */
+
+static void check_sgr(void) {
+	sgr_ok = false;
+	if (!ne_exit_attribute_mode || !strstr(ne_exit_attribute_mode, "\x1b[m") && !strstr(ne_exit_attribute_mode, "\x1b[0m")) return;
+
+	static const char * const sgr_mode[] = { "\x1b[7m", "\x1b[1m", "\x1b[4m", "\x1b[2m", "\x1b[5m" };
+	const char * const mode[] = { ne_enter_reverse_mode, ne_enter_bold_mode, ne_enter_underline_mode, ne_enter_dim_mode, ne_enter_blink_mode };
+	for(int i = 0; i < sizeof mode / sizeof *mode; i++) if (mode[i] && strcmp(mode[i], sgr_mode[i])) return;
+
+	if (color_ok) {
+		if (!ne_set_foreground || !ne_set_background) return;
+		for(int c = 0; c < 8; c++) {
+			char sgr[8];
+			sprintf(sgr, "\x1b[%dm", 30 + c);
+			if (strcmp(tparm(ne_set_foreground, c), sgr)) return;
+			sprintf(sgr, "\x1b[%dm", 40 + c);
+			if (strcmp(tparm(ne_set_background, c), sgr)) return;
+		}
+	}
+	sgr_ok = true;
+}
+
 static void turn_off_standout(void) {
 	OUTPUT1(ne_exit_standout_mode);
 	/* We exiting standout mode deletes all attributes, we update curr_attr. */
@@ -403,38 +570,148 @@ void standout_off (void) {
 }
 
 
-/* Depending on the value of io_utf8, this function will do a simple putchar(),
-   or a series of putchar() that expand the given character in UTF-8 encoding. 
-   If attr is -1, no attribute will be set. */
+/* Sets the attributes used by the following output. The terminal is not
+   affected until a character is actually output. */
 
-static void out(int c, const uint32_t attr) {
-	uint32_t add_attr = 0;
+void set_attr(const uint32_t attr) {
+	want_attr = attr;
+}
+
+
+/* Brings the terminal attributes and standout mode in sync with want_attr
+   and standout_wanted. */
+
+static void apply_attr(void) {
+	if (curr_attr != want_attr) {
+		if (standout_mode) turn_off_standout();
+		emit_attr(want_attr);
+	}
+	standout_if_wanted();
+}
+
+
+/* Returns the attributes currently used by the terminal, in the format of
+   the shadow screen. */
+
+static uint32_t shown_attr(void) {
+	return curr_attr | (standout_mode ? SHADOW_STANDOUT : 0);
+}
+
+
+/* Returns the shadow cell at the given position, or NULL if the position is
+   not tracked. If the size of the terminal has changed, the shadow screen is
+   reallocated, and all its positions are unknown. */
+
+static shadow_cell *shadow_at(const int y, const int x) {
+	if (shadow_lines != ne_lines || shadow_columns != ne_columns) {
+		free(shadow);
+		shadow = calloc((size_t)ne_lines * ne_columns, sizeof *shadow);
+		shadow_lines = shadow ? ne_lines : 0;
+		shadow_columns = shadow ? ne_columns : 0;
+	}
+
+	if (y < 0 || y >= shadow_lines || x < 0 || x >= shadow_columns) return NULL;
+	return shadow + (size_t)y * shadow_columns + x;
+}
 
-	/* PORTABILITY PROBLEM: this code is responsible for filtering nonprintable
-		characters. On systems with a wider system character set, it could be
-		redefined, for instance, in order to allow characters between 128 and 160 to
-		be printed. Currently, it returns '?' on all control characters (and
-		non-ISO-8859-1 characters, if io_utf8 is false), space on 160, and the
-		obvious capital letter for control characters below 32. */
 
+/* Marks all positions of the shadow screen as unknown. */
+
+static void invalidate_shadow(void) {
+	if (shadow_at(0, 0)) memset(shadow, 0, (size_t)shadow_lines * shadow_columns * sizeof *shadow);
+}
+
+
+/* Returns what an erased position displays, given the current attributes.
+   Since terminals differ in the way they erase with non-default colors or
+   in standout mode, in this case the result is unknown. */
+
+static shadow_cell blank_cell(void) {
+	const shadow_cell blank = { ' ', 0 }, unknown = { SHADOW_UNKNOWN, 0 };
+	return curr_attr & (BG_NOT_DEFAULT | INVERSE) || standout_mode ? unknown : blank;
+}
+
+
+/* Fixes the double-width characters of a line of the shadow screen after a
+   change: right halves without a left half and left halves without a right
+   half become unknown. */
+
+static void fix_wide_chars(const int y) {
+	shadow_cell * const s = shadow_at(y, 0);
+	if (!s) return;
+	for(int x = 0; x < shadow_columns; x++) {
+		if (s[x].c == SHADOW_WIDE) {
+			if (x == 0 || s[x - 1].c == SHADOW_UNKNOWN || s[x - 1].c == SHADOW_WIDE || output_width(s[x - 1].c) != 2) s[x].c = SHADOW_UNKNOWN;
+		}
+		else if (s[x].c != SHADOW_UNKNOWN && output_width(s[x].c) == 2 && (x == shadow_columns - 1 || s[x + 1].c != SHADOW_WIDE)) s[x].c = SHADOW_UNKNOWN;
+	}
+}
+
+
+/* Sets n positions of the shadow screen, starting at (y, x), to the given
+   cell, and fixes the double-width characters of the line. */
+
+static void set_cells(const int y, const int x, int n, const shadow_cell cell) {
+	shadow_cell * const s = shadow_at(y, x);
+	if (!s) return;
+	if (n > shadow_columns - x) n = shadow_columns - x;
+	for(int i = 0; i < n; i++) s[i] = cell;
+	fix_wide_chars(y);
+}
+
+
+/* Records in the shadow screen that the character c, of the given width, has
+   been output at (y, x) with the current attributes. */
+
+static void record_char(const int y, const int x, const int c, const int width) {
+	shadow_cell * const s = shadow_at(y, x);
+	if (!s) return;
+	const bool fix = s->c == SHADOW_WIDE || x + width < shadow_columns && s[width].c == SHADOW_WIDE;
+	s->c = c;
+	s->attr = shown_attr();
+	if (width == 2 && x + 1 < shadow_columns) s[1] = (shadow_cell){ SHADOW_WIDE, s->attr };
+	if (fix) fix_wide_chars(y);
+}
+
+
+/* Returns true if the shadow screen shows that the character c, of the given
+   width, is displayed at (y, x) with the given attributes. */
+
+static bool is_displayed(const int y, const int x, const int c, const uint32_t attr, const int width) {
+	const shadow_cell * const s = shadow_at(y, x);
+	return s && s->c == c && s->attr == attr && (width == 2) == (x + 1 < shadow_columns && s[1].c == SHADOW_WIDE);
+}
+
+
+/* Returns the printable version of the character c, as it will be output by
+   out(). If the character is not printable, INVERSE is added to *add_attr.
+
+   PORTABILITY PROBLEM: this code is responsible for filtering nonprintable
+   characters. On systems with a wider system character set, it could be
+   redefined, for instance, in order to allow characters between 128 and 160 to
+   be printed. Currently, it returns '?' on all control characters (and
+   non-ISO-8859-1 characters, if io_utf8 is false), space on 160, and the
+   obvious capital letter for control characters below 32. */
+
+static int printable(int c, uint32_t * const add_attr) {
 	if (c >= 127 && c < 160) {
 		c = '?';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	if (c == 160) {
 		c = ' ';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	if (c < ' ') {
 		c += '@';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	if (c > 0xFF && !io_utf8) {
 		c = '?';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	/* If io_utf8 is off, we consider all characters in the range of ISO-8859-x
@@ -442,48 +719,135 @@ static void out(int c, const uint32_t attr) {
 
 	if (io_utf8 && wcwidth(c) <= 0) {
 		c = '?';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
-	if (attr != -1) set_attr(attr | add_attr);
+	return c;
+}
+
 
+/* Writes the given bytes to the terminal. */
+
+static void write_bytes(const char *p, size_t len) {
+	while(len > 0) {
+		const ssize_t n = write(1, p, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return;
+		}
+		p += n;
+		len -= n;
+	}
+	output_writes++;
+}
+
+
+/* Writes the current frame to the terminal, and empties it. Frames spanning
+   more than a line are wrapped in synchronized-update sequences, if they are
+   available (and if we can make room for ne_end_sync). */
+
+static void write_frame(void) {
+	if (frame_len == 0) return;
+
+	size_t start = frame_prefix;
+	if (ne_begin_sync && frame_len - frame_prefix > ne_columns) {
+		const size_t end_len = strlen(ne_end_sync);
+		if (frame_len + end_len <= frame_size) {
+			memcpy(frame, ne_begin_sync, frame_prefix);
+			memcpy(frame + frame_len, ne_end_sync, end_len);
+			frame_len += end_len;
+			output_bytes += frame_prefix + end_len;
+			start = 0;
+		}
+	}
+
+	write_bytes(frame + start, frame_len - start);
+	frame_len = 0;
+}
+
+
+/* Appends a byte to the frame buffer. This function is putchar()-like, so it
+   can be used (through cmputc()) by tputs(). */
+
+int put_byte(const int c) {
+	if (frame_len == frame_size) {
+		const size_t new_size = frame_size ? frame_size * 2 : MIN_FRAME_SIZE;
+		char *p;
+		if (frame_size < MAX_FRAME_SIZE && (p = realloc(frame, new_size))) {
+			frame = p;
+			frame_size = new_size;
+		}
+		else write_frame();
+	}
+
+	if (frame_size == 0) {
+		/* We could not allocate the frame buffer. */
+		const char b = c;
+		write_bytes(&b, 1);
+	}
+	else {
+		if (frame_len == 0) frame_len = frame_prefix;
+		frame[frame_len++] = c;
+	}
+	output_bytes++;
+	return c;
+}
+
+
+/* Depending on the value of io_utf8, this function will output a single
+   byte, or a sequence of bytes that expand the given (printable) character in
+   UTF-8 encoding. */
+
+static void put_char(const int c) {
 	if (io_utf8) {
-		if (c < 0x80) putchar(c); /* ASCII */
+		if (c < 0x80) PUTCHAR(c); /* ASCII */
 		else if (c < 0x800) {
-			putchar(0xC0 | (c >> 6));
-			putchar(0x80 | (c >> 0) & 0x3F);
+			PUTCHAR(0xC0 | (c >> 6));
+			PUTCHAR(0x80 | (c >> 0) & 0x3F);
 		}
 		else if (c < 0x10000) {
-			putchar(0xE0 | (c >> 12));
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
+			PUTCHAR(0xE0 | (c >> 12));
+			PUTCHAR(0x80 | (c >> 6) & 0x3F);
+			PUTCHAR(0x80 | (c >> 0) & 0x3F);
 		}
 		else if (c < 0x200000) {
-			putchar(0xF0 | (c >> 18));
-			putchar(0x80 | (c >> 12) & 0x3F);
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
+			PUTCHAR(0xF0 | (c >> 18));
+			PUTCHAR(0x80 | (c >> 12) & 0x3F);
+			PUTCHAR(0x80 | (c >> 6) & 0x3F);
+			PUTCHAR(0x80 | (c >> 0) & 0x3F);
 		}
 		else if (c < 0x4000000) {
-			putchar(0xF8 | (c >> 24));
-			putchar(0x80 | (c >> 18) & 0x3F);
-			putchar(0x80 | (c >> 12) & 0x3F);
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
+			PUTCHAR(0xF8 | (c >> 24));
+			PUTCHAR(0x80 | (c >> 18) & 0x3F);
+			PUTCHAR(0x80 | (c >> 12) & 0x3F);
+			PUTCHAR(0x80 | (c >> 6) & 0x3F);
+			PUTCHAR(0x80 | (c >> 0) & 0x3F);
 		}
 		else {
-			putchar(0xFC | (c >> 30));
-			putchar(0x80 | (c >> 24) & 0x3F);
-			putchar(0x80 | (c >> 18) & 0x3F);
-			putchar(0x80 | (c >> 12) & 0x3F);
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
+			PUTCHAR(0xFC | (c >> 30));
+			PUTCHAR(0x80 | (c >> 24) & 0x3F);
+			PUTCHAR(0x80 | (c >> 18) & 0x3F);
+			PUTCHAR(0x80 | (c >> 12) & 0x3F);
+			PUTCHAR(0x80 | (c >> 6) & 0x3F);
+			PUTCHAR(0x80 | (c >> 0) & 0x3F);
 		}
 	}
-	else putchar(c);
+	else PUTCHAR(c);
 }
 
 
+/* Outputs the given character, filtered by printable(), setting the given
+   attributes (or want_attr, if attr is -1), and returns the character that
+   was actually output. */
+
+static int out(int c, const uint32_t attr) {
+	uint32_t add_attr = 0;
+	c = printable(c, &add_attr);
+	if (attr != -1) want_attr = attr | add_attr;
+	apply_attr();
+	put_char(c);
+	return c;
+}
 
 
 /* Rings a bell or flashes the screen. If the service is not available, the
@@ -533,6 +897,54 @@ static void turn_off_insert (void) {
 
 
 
+/* Moves the physical cursor to the logical position, if they differ. When
+   the physical cursor lags behind on the same line, and the shadow screen
+   shows what is displayed in between with the current attributes, it might
+   be cheaper to output again those characters than to move the cursor. */
+
+static void sync_cursor(void) {
+	if (!lagging) return;
+	lagging = false;
+	if (curY == want_y && curX == want_x) return;
+
+	if (curY == want_y && curX >= 0 && curX < want_x && !insert_mode) {
+		const shadow_cell * const s = shadow_at(curY, curX);
+		const int n = (want_x < ne_columns ? want_x : ne_columns) - curX;
+
+		if (s && s->c != SHADOW_WIDE && (curX + n == ne_columns || s[n].c != SHADOW_WIDE)) {
+			int i, bytes = 0;
+			for(i = 0; i < n; i++) {
+				if (s[i].c == SHADOW_UNKNOWN || s[i].attr != shown_attr()) break;
+				if (s[i].c != SHADOW_WIDE) bytes += io_utf8 ? utf8seqlen(s[i].c) : 1;
+			}
+
+			if (i == n && (want_x >= ne_columns || bytes <= cmcost(want_y, want_x))) {
+				for(i = 0; i < n; i++) if (s[i].c != SHADOW_WIDE) put_char(s[i].c);
+				cmplus(n);
+				return;
+			}
+		}
+	}
+
+	/* The phantom column after the last one cannot be reached by cursor
+		motion; fortunately, nothing is ever output there. */
+
+	if (!ne_move_standout_mode) turn_off_standout();
+	if (!ne_move_insert_mode) turn_off_insert();
+	cmgoto(want_y, want_x < ne_columns ? want_x : ne_columns - 1);
+}
+
+
+/* Sends the pending output to the terminal, leaving the cursor at its
+   logical position. */
+
+void flush_output(void) {
+	sync_cursor();
+	write_frame();
+}
+
+
+
 /* Prepares the terminal for interactive I/O. It
 initializes the terminal, prepares the cursor address mode, and
 activates the keypad and the meta key. */
@@ -549,10 +961,14 @@ void set_terminal_modes(void) {
 
 	OUTPUT1_IF(ne_enter_ca_mode);
 	OUTPUT1_IF(ne_keypad_xmit);
+	OUTPUT1_IF(ne_enable_bracketed_paste);
 
 	if (ne_has_meta_key) OUTPUT1_IF(ne_meta_on);
 
+	if (ne_exit_attribute_mode) curr_attr = 0;
 	losecursor();
+	lagging = false;
+	invalidate_shadow();
 }
 
 
@@ -563,8 +979,10 @@ void reset_terminal_modes (void) {
 	OUTPUT1_IF(ne_exit_attribute_mode);
 	OUTPUT1_IF(ne_exit_alt_charset_mode);
 	OUTPUT1_IF(ne_exit_standout_mode);
+	OUTPUT1_IF(ne_disable_bracketed_paste);
 	OUTPUT1_IF(ne_keypad_local);
 	OUTPUT1_IF(ne_exit_ca_mode);
+	invalidate_shadow();
 }
 
 
@@ -590,13 +1008,25 @@ void cursor_off (void) {
 }
 
 
-/* Move to absolute position, specified origin 0 */
+/* Move to absolute position, specified origin 0. The physical cursor is
+   actually moved only when something is output (see sync_cursor()). */
 
 void move_cursor (const int row, const int col) {
-	if (curY == row && curX == col) return;
-	if (!ne_move_standout_mode) turn_off_standout();
-	if (!ne_move_insert_mode) turn_off_insert ();
-	cmgoto (row, col);
+	want_y = row;
+	want_x = col;
+	lagging = curY != row || curX != col;
+}
+
+
+/* Returns true if the shadow screen shows that the positions from (y, x) to
+   the end of the line (or of the screen, if to_end is true) are erased. */
+
+static bool is_erased(const int y, const int x, const bool to_end) {
+	const shadow_cell * const s = shadow_at(y, x);
+	if (!s) return false;
+	const shadow_cell * const end = shadow + (size_t)(to_end ? shadow_lines : y + 1) * shadow_columns;
+	for(const shadow_cell *t = s; t < end; t++) if (t->c != ' ' || t->attr != 0) return false;
+	return true;
 }
 
 
@@ -605,15 +1035,26 @@ void move_cursor (const int row, const int col) {
    may be moved, on terminals lacking a `ce' string.  */
 
 void clear_end_of_line(const int first_unused_hpos) {
-	if (curX >= first_unused_hpos) return;
+	const int y = LOGICAL_Y, x = LOGICAL_X;
+	if (x >= first_unused_hpos) return;
+
+	if (want_attr & BG_NOT_DEFAULT) want_attr = 0;
+	if (is_erased(y, x, false)) return;
 
-	if (curr_attr & BG_NOT_DEFAULT) set_attr(0);
-	if (ne_clr_eol) OUTPUT1 (ne_clr_eol);
+	sync_cursor();
+	if (curr_attr & BG_NOT_DEFAULT) emit_attr(want_attr);
+	if (ne_clr_eol) {
+		OUTPUT1 (ne_clr_eol);
+		set_cells(y, x, ne_columns - x, blank_cell());
+	}
 	else {
 		/* We have to do it the hard way. */
 		turn_off_insert ();
-		for (int i = curX; i < first_unused_hpos; i++) putchar (' ');
-		cmplus (first_unused_hpos - curX);
+		for (int i = x; i < first_unused_hpos; i++) {
+			PUTCHAR (' ');
+			record_char(y, i, ' ', 1);
+		}
+		cmplus (first_unused_hpos - x);
 	}
 }
 
@@ -629,24 +1070,35 @@ void clear_to_eol(void) {
 /* Clears from the cursor position to the end of screen */
 
 void clear_to_end (void) {
-
-	if (ne_clr_eos) OUTPUT(ne_clr_eos);
+	const int y = LOGICAL_Y, x = LOGICAL_X;
+
+	if (ne_clr_eos) {
+		if (is_erased(y, x, true)) return;
+		sync_cursor();
+		OUTPUT(ne_clr_eos);
+		set_cells(y, x, ne_columns - x, blank_cell());
+		for (int i = y + 1; i < ne_lines; i++) set_cells(i, 0, ne_columns, blank_cell());
+	}
 	else {
-		for (int i = curY; i < ne_lines; i++) {
-			move_cursor (i, 0);
+		for (int i = y; i < ne_lines; i++) {
+			move_cursor (i, i == y ? x : 0);
 			clear_to_eol();
 		}
 	}
 }
 
 
-/* Clears the entire screen */
+/* Clears the entire screen. Since this function is used to recover from a
+   garbled screen, the shadow screen is invalidated first. */
 
 void clear_entire_screen (void) {
+	invalidate_shadow();
 
 	if (ne_clear_screen) {
 		OUTPUTL(ne_clear_screen, ne_lines);
 		cmat (0, 0);
+		lagging = false;
+		for (int i = 0; i < ne_lines; i++) set_cells(i, 0, ne_columns, blank_cell());
 	}
 	else {
 		move_cursor (0, 0);
@@ -655,18 +1107,84 @@ void clear_entire_screen (void) {
 }
 
 
+extern int cost;		/* In cm.c */
+extern int evalcost(int);
+
+
+/* Returns the cost of sending a string. */
+
+static int string_cost(const char * const s) {
+	cost = 0;
+	tputs(s, 1, evalcost);
+	return cost;
+}
+
+
+/* Tries to output n copies of the ASCII character c starting at (y, x), where
+   the cursor must be, more cheaply than by sending them one by one: a run of
+   spaces without attributes can be erased with clr_eol (if it reaches the end
+   of the line) or erase_chars, and any run can be sent with repeat_char.
+   Only the characters that are not already displayed count as the cost of the
+   plain output, which is given by plain_cost. Returns true if the run has been
+   output. */
+
+static bool output_run(const int y, const int x, const int c, const int n, const int plain_cost) {
+	if (n <= RPov && n <= ECHov) return false;
+
+	if (c == ' ' && want_attr == 0 && !standout_wanted) {
+		if (x + n == ne_columns && ne_clr_eol && string_cost(ne_clr_eol) < plain_cost) {
+			apply_attr();
+			OUTPUT1(ne_clr_eol);
+			set_cells(y, x, n, blank_cell());
+			want_y = y;
+			want_x = x + n;
+			lagging = true;
+			return true;
+		}
+		if (ne_erase_chars && n > ECHov) {
+			const char * const buf = tparm(ne_erase_chars, n);
+			if (string_cost(buf) + cmcost(y, x + n) < plain_cost) {
+				apply_attr();
+				OUTPUT1(buf);
+				set_cells(y, x, n, blank_cell());
+				want_y = y;
+				want_x = x + n;
+				lagging = true;
+				return true;
+			}
+		}
+	}
+
+	if (ne_repeat_char && n > RPov) {
+		const char * const buf = tparm(ne_repeat_char, c, n);
+		if (string_cost(buf) < plain_cost) {
+			apply_attr();
+			OUTPUT1(buf);
+			for(int i = 0; i < n; i++) record_char(y, x + i, c, 1);
+			cmplus(n);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
 /* Outputs raw_len characters pointed at by string, attributed as
    indicated by a corresponding vector of attributes, which can be NULL,
    in which case no attribute will be set. The characters will be
    truncated to the end of the current line. Passing a NULL for string
    results in outputting spaces. A len of 0 causes no action. If utf8 is
-   true, the string is UTF-8 encoded. */
+   true, the string is UTF-8 encoded.
+
+   Characters that the shadow screen shows as already displayed are skipped,
+   leaving the physical cursor behind. */
   
 void output_chars(const char *string, const uint32_t *attr, const int raw_len, const bool utf8) {
 	if (raw_len == 0) return;
 
-	turn_off_insert();
-	standout_if_wanted();
+	const int y = LOGICAL_Y;
+	int x = LOGICAL_X;
 
 	/* If the string is UTF-8 encoded, compute its real length. */
 	int len = utf8 && string != NULL ? utf8strlen(string, raw_len) : raw_len;
@@ -675,37 +1193,20 @@ void output_chars(const char *string, const uint32_t *attr, const int raw_len, c
 		len. Moreover, we don't dare write in last column of bottom line, if
 		AutoWrap, since that would scroll the whole screen on some terminals. */
 
-	cmplus(string_output_width(string, &len, ne_columns - curX - (AutoWrap && curY == ne_lines - 1), utf8));
+	const int width = string_output_width(string, &len, ne_columns - x - (AutoWrap && y == ne_lines - 1), utf8);
 
-	if (string == NULL) {
-		for(int i = 0; i < len; i++) {
-			/* When outputting spaces, it's only the first attribute that's used. */
-			if (attr) set_attr(*attr);
-			putchar(' ');
-		}
-		return;
-	}
+	if (string != NULL && (ne_transparent_underline || ne_tilde_glitch)) {
+		sync_cursor();
+		turn_off_insert();
+		apply_attr();
+		cmplus(width);
 
-	if (!ne_transparent_underline && !ne_tilde_glitch) {
-		for(int i = 0; i < len; i++) {
-			if (utf8) {
-				const int c = utf8char(string);
-				string += utf8len(*string);
-				out(c, attr ? attr[i] : -1);
-			}
-			else {
-				const int c = (unsigned char)*string++;
-				out(c, attr ? attr[i] : -1);
-			}
-		}
-	} 
-	else
 		for(int i = 0; i < len; i++) {
 			if (attr) set_attr(attr[i]);
 			int c = utf8 ? utf8char(string) : (unsigned char)*string;
 
 			if (c == '_' && ne_transparent_underline) {
-				putchar (' ');
+				PUTCHAR (' ');
 				OUTPUT1(Left);
 			}
 
@@ -714,6 +1215,75 @@ void output_chars(const char *string, const uint32_t *attr, const int raw_len, c
 			out(c, attr ? attr[i] : -1);
 			string += utf8 ? utf8len(*string) : 1;
 		}
+
+		set_cells(y, x, width, (shadow_cell){ SHADOW_UNKNOWN, 0 });
+		return;
+	}
+
+	for(int i = 0; i < len; i++) {
+		int c;
+		uint32_t a;
+
+		/* When outputting spaces, it's only the first attribute that's used. */
+		if (string == NULL) {
+			c = ' ';
+			a = attr ? *attr : -1;
+		}
+		else {
+			c = utf8 ? utf8char(string) : (unsigned char)*string;
+			string += utf8 ? utf8len(*string) : 1;
+			a = attr ? attr[i] : -1;
+		}
+
+		uint32_t add_attr = 0;
+		const int p = printable(c, &add_attr), w = output_width(c);
+		if (a != -1) want_attr = a | add_attr;
+
+		if (p == c && c < 0x80) {
+			/* We look for a run of identical ASCII characters with the same attributes. */
+			int n = 1, plain_cost = 0;
+			while(i + n < len && (string == NULL || string[n - 1] == c) && (!attr || string == NULL || attr[i + n] == a)) n++;
+			if (n > 1) {
+				for(int j = 0; j < n; j++) plain_cost += !is_displayed(y, x + j, c, want_attr | (standout_wanted ? SHADOW_STANDOUT : 0), 1);
+				if (plain_cost > RPov || plain_cost > ECHov) {
+					move_cursor(y, x);
+					sync_cursor();
+					turn_off_insert();
+					if (output_run(y, x, c, n, plain_cost)) {
+						if (string != NULL) string += n - 1;
+						i += n - 1;
+						x += n;
+						continue;
+					}
+				}
+			}
+		}
+
+		if (is_displayed(y, x, p, want_attr | (standout_wanted ? SHADOW_STANDOUT : 0), w)) {
+			want_y = y;
+			want_x = x + w;
+			lagging = true;
+			output_chars_skipped++;
+		}
+		else {
+			move_cursor(y, x);
+			sync_cursor();
+			turn_off_insert();
+			out(c, -1);
+			record_char(y, x, p, w);
+			cmplus(w);
+		}
+
+		x += w;
+	}
+
+	/* If we skipped the last characters of the line, the logical cursor must
+		wrap as the physical cursor would. */
+
+	if (lagging && want_x >= ne_columns && !MagicWrap) {
+		if (AutoWrap && want_y < ne_lines - 1) want_y++, want_x = 0;
+		else want_x = ne_columns - 1;
+	}
 }
 
 
@@ -753,11 +1323,33 @@ void output_spaces(const int n, const uint32_t * const attr) {
 	output_chars(NULL, attr, n, false);
 }
 
+
+/* Shifts right by n positions the part of line y of the shadow screen
+   starting at x, filling the gap with erased positions (if n is negative,
+   shifts left by -n positions, filling the end of the line). */
+
+static void shift_cells(const int y, const int x, const int n) {
+	shadow_cell * const s = shadow_at(y, x);
+	if (!s || n == 0) return;
+	const int len = shadow_columns - x, m = n > 0 ? (n < len ? n : len) : (-n < len ? -n : len);
+
+	if (n > 0) {
+		memmove(s + m, s, (len - m) * sizeof *s);
+		set_cells(y, x, m, blank_cell());
+	}
+	else {
+		memmove(s, s + m, (len - m) * sizeof *s);
+		set_cells(y, shadow_columns - m, m, blank_cell());
+	}
+}
+
+
 /* Same as output_chars(), but inserts instead. */
 
 void insert_chars(const char * start, const uint32_t * const attr, const int raw_len, const bool utf8) {
 	if (raw_len == 0) return;
 
+	sync_cursor();
 	standout_if_wanted();
 
 	/* If the string is non-NULL and UTF-8 encoded, compute its real length. */
@@ -774,6 +1366,7 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 
 		const char * const buf = tparm (ne_parm_ich, width);
 		OUTPUT1 (buf);
+		shift_cells(curY, curX, width);
 
 		if (start) output_chars(start, attr, raw_len, utf8);
 
@@ -787,19 +1380,23 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 		bottom line, if AutoWrap, since that would scroll the whole screen
 		on some terminals. */
 
-	cmplus(string_output_width(start, &len, ne_columns - curX - (AutoWrap && curY == ne_lines - 1), utf8));
+	const int y = curY;
+	int x = curX;
+	const int width = string_output_width(start, &len, ne_columns - curX - (AutoWrap && curY == ne_lines - 1), utf8);
+	cmplus(width);
+	shift_cells(y, x, width);
 
 	if (!ne_transparent_underline && !ne_tilde_glitch && start
 		  && ne_insert_padding == NULL && ne_insert_character == NULL) {
 		for(int i = 0; i < len; i++) {
-			if (attr) set_attr(attr[i]);
 			int c;
 			if (utf8) {
 				c = utf8char(start);
 				start += utf8len(*start);
 			}
 			else c = (unsigned char)*start++;
-			out(c, attr ? attr[i] : -1);
+			record_char(y, x, out(c, attr ? attr[i] : -1), output_width(c));
+			x += output_width(c);
 		}
 	}
 	else
@@ -809,10 +1406,9 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 
 			if (!start) {
 				/* When outputting spaces, it's only the first attribute that's used. */
-				out(' ', attr ? *attr : -1);
+				record_char(y, x++, out(' ', attr ? *attr : -1), 1);
 			}
 			else {
-				if (attr) set_attr(attr[i]);
 				int c;
 				if (utf8) {
 					c = utf8char(start);
@@ -822,7 +1418,8 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 
 				if (ne_tilde_glitch && c == '~') c = '`';
 
-				out(c, attr ? attr[i] : -1);
+				record_char(y, x, out(c, attr ? attr[i] : -1), output_width(c));
+				x += output_width(c);
 			}
 
 			OUTPUT1_IF(ne_insert_padding);
@@ -854,6 +1451,7 @@ void insert_char(const int c, const uint32_t attr, const bool utf8) {
 void delete_chars (int n) {
 	if (n == 0) return;
 
+	sync_cursor();
 	standout_if_wanted();
 	if (delete_in_insert_mode) turn_on_insert();
 	else {
@@ -861,6 +1459,8 @@ void delete_chars (int n) {
 		OUTPUT1_IF(ne_enter_delete_mode);
 	}
 
+	shift_cells(curY, curX, -n);
+
 	if (ne_parm_dch) {
 		const char * const buf = tparm(ne_parm_dch, n);
 		OUTPUT1(buf);
@@ -876,6 +1476,7 @@ for n lines, given a parametrized and/or a one-line capability
 for that purpose. */
 
 static void do_multi_ins_del(char * const multi, const char * const single, int n) {
+	sync_cursor();
 	if (multi) {
 		const char * const buf = tparm(multi, n);
 		OUTPUT(buf);
@@ -884,6 +1485,27 @@ static void do_multi_ins_del(char * const multi, const char * const single, int
 }
 
 
+/* Scrolls the lines of the shadow screen from top to bottom (inclusive) by n
+   lines (down if n is positive, up if n is negative), filling the gap with
+   erased lines. */
+
+static void scroll_shadow(const int top, const int bottom, const int n) {
+	shadow_cell * const s = shadow_at(top, 0);
+	if (!s || bottom >= shadow_lines) return;
+	const int height = bottom - top + 1, m = n > 0 ? (n < height ? n : height) : (-n < height ? -n : height);
+	const size_t line_size = shadow_columns * sizeof *s;
+
+	if (n > 0) {
+		memmove(s + (size_t)m * shadow_columns, s, (height - m) * line_size);
+		for(int i = 0; i < m; i++) set_cells(top + i, 0, shadow_columns, blank_cell());
+	}
+	else {
+		memmove(s, s + (size_t)m * shadow_columns, (height - m) * line_size);
+		for(int i = 0; i < m; i++) set_cells(bottom - i, 0, shadow_columns, blank_cell());
+	}
+}
+
+
 /* Inserts n lines at vertical position vpos. If n is negative, it deletes -n
    lines. specified_window is taken into account. This function assumes
    line_ins_del_ok == true. Returns true if an insertion/deletion actually happened. */
@@ -900,6 +1522,7 @@ int ins_del_lines (const int vpos, const int n) {
 
 	if (!ne_memory_below && vpos + i >= ne_lines) return false;
 
+	sync_cursor();
 	standout_if_wanted();
 
 	if (scroll_region_ok) {
@@ -907,14 +1530,17 @@ int ins_del_lines (const int vpos, const int n) {
 
 		if (n < 0) {
 			move_cursor(specified_window - 1, 0);
+			sync_cursor();
 			while (i-- != 0) OUTPUTL(ne_scroll_forward, specified_window - vpos + 1);
 		}
 		else {
 			move_cursor(vpos, 0);
+			sync_cursor();
 			while (i-- != 0) OUTPUTL(ne_scroll_reverse, specified_window - vpos + 1);
 		}
 
 		if (specified_window != ne_lines) set_scroll_region(0, ne_lines - 1);
+		scroll_shadow(vpos, specified_window - 1, n);
 	}
 	else {
 		if (n > 0) {
@@ -925,16 +1551,20 @@ int ins_del_lines (const int vpos, const int n) {
 
 			move_cursor(vpos, 0);
 			do_multi_ins_del(ne_parm_insert_line, ne_insert_line, i);
+			scroll_shadow(vpos, specified_window - 1, n);
 		}
 		else {
 			move_cursor(vpos, 0);
 			do_multi_ins_del(ne_parm_delete_line, ne_delete_line, i);
+			scroll_shadow(vpos, specified_window - 1, n);
 
 			if (specified_window != ne_lines) {
 				move_cursor(specified_window - i, 0);
 				do_multi_ins_del(ne_parm_insert_line, ne_insert_line, i);
 			}
 			else if (ne_memory_below) {
+				/* We do not know what was scrolled in from the memory below. */
+				for (int j = ne_lines + n; j < ne_lines; j++) set_cells(j, 0, ne_columns, (shadow_cell){ SHADOW_UNKNOWN, 0 });
 				move_cursor(ne_lines + n, 0);
 				clear_to_end ();
 			}
@@ -945,27 +1575,19 @@ int ins_del_lines (const int vpos, const int n) {
 }
 
 
-extern int cost;		/* In cm.c */
-extern int evalcost(int);
-
-
-/* Performs the cursor motion cost setup, and sets the variable RPov to the
-   number of characters (with padding) which are really output when repeating
-   one character. RPov is disable using UTF-8 I/O. */
+/* Performs the cursor motion cost setup, and sets the variables RPov and
+   ECHov to the number of characters (with padding) which are really output
+   when repeating one character, and when erasing one character and moving
+   past it. Runs shorter than that are never repeated or erased. */
 
 static void calculate_costs (void) {
 
-	if (ne_repeat_char) {
-
-		char *const buf = tparm(ne_repeat_char, ' ', 1);
-
-		cost = 0;
-		tputs(buf, 1, evalcost);
-
-		RPov = cost + 1;
-	}
+	if (ne_repeat_char) RPov = string_cost(tparm(ne_repeat_char, ' ', 1));
 	else RPov = ne_columns * 2;
 
+	if (ne_erase_chars) ECHov = string_cost(tparm(ne_erase_chars, 1)) + 1;
+	else ECHov = ne_columns * 2;
+
 	cmcostinit();
 }
 
@@ -1012,6 +1634,15 @@ int ttysize(void) {
 
 #ifndef TERMCAP
 
+/* Returns the given extended string capability, or NULL if the terminal
+   does not have it. */
+
+static char *extended_string(char * const name) {
+	char * const s = tigetstr(name);
+	return s == (char *)-1 ? NULL : s;
+}
+
+
 /* If we get capabilities from the database, then we copy them into our
    internal counterparts. */
 
@@ -1088,7 +1719,38 @@ void copy_caps(void) {
 	ne_exit_attribute_mode = exit_attribute_mode;
 	ne_exit_alt_charset_mode = exit_alt_charset_mode;
 
+	/* Synchronized updates are described by the extended capability Sync
+		(see user_caps(5)), whose parameter is 1 to begin and 2 to end an
+		update. */
+
+	char * const sync = extended_string("Sync");
+	if (sync) {
+		ne_begin_sync = strdup(tparm(sync, 1));
+		ne_end_sync = strdup(tparm(sync, 2));
+		if (!ne_begin_sync || !ne_end_sync) ne_begin_sync = ne_end_sync = NULL;
+	}
+
+	/* Bracketed paste is described by the extended capabilities BE, BD, PS
+		and PE. Terminals declaring xterm compatibility (XT) support it even if
+		their entry does not describe it. */
+
+	ne_enable_bracketed_paste = extended_string("BE");
+	ne_disable_bracketed_paste = extended_string("BD");
+	ne_paste_start = extended_string("PS");
+	ne_paste_end = extended_string("PE");
+
+	if (!ne_enable_bracketed_paste && tigetflag("XT") > 0) {
+		ne_enable_bracketed_paste = "\x1b[?2004h";
+		ne_disable_bracketed_paste = "\x1b[?2004l";
+		ne_paste_start = "\x1b[200~";
+		ne_paste_end = "\x1b[201~";
+	}
+
+	if (!ne_enable_bracketed_paste || !ne_disable_bracketed_paste || !ne_paste_start || !ne_paste_end || !*ne_paste_end)
+		ne_enable_bracketed_paste = ne_disable_bracketed_paste = ne_paste_start = ne_paste_end = NULL;
+
 	ne_repeat_char = repeat_char;
+	ne_erase_chars = erase_chars;
 
 	ne_tilde_glitch = tilde_glitch;
 	ne_memory_below = memory_below;
@@ -1234,4 +1896,8 @@ void term_init (void) {
 	cursor_on_off_ok = (ne_cursor_invisible && ne_cursor_normal);
 
 	color_ok = (ne_set_foreground && ne_set_background);
+
+	check_sgr();
+
+	frame_prefix = ne_begin_sync ? strlen(ne_begin_sync) : 0;
 }
@@ -21,6 +21,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+extern uint64_t output_bytes, output_writes, output_chars_skipped, output_attr_bytes;
+
 int output_width(int c);
 void ring_bell(void);
 void do_flash(void);
@@ -47,3 +49,5 @@ void delete_chars(int n);
 int ins_del_lines(int vpos, int n);
 int ttysize(void);
 void term_init(void);
+void flush_output(void);
+int put_byte(int c);
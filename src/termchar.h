@@ -172,7 +172,16 @@ extern char *ne_exit_ca_mode;
 extern char *ne_exit_attribute_mode;
 extern char *ne_exit_alt_charset_mode;
 
+extern char *ne_begin_sync;
+extern char *ne_end_sync;
+
+extern char *ne_enable_bracketed_paste;
+extern char *ne_disable_bracketed_paste;
+extern char *ne_paste_start;
+extern char *ne_paste_end;
+
 extern char *ne_repeat_char;
+extern char *ne_erase_chars;
 
 extern bool ne_tilde_glitch;
 extern bool ne_memory_below;